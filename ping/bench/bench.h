@@ -0,0 +1,27 @@
+#ifndef PING_BENCH_H_
+#define PING_BENCH_H_
+
+#include <stdio.h>
+#include <time.h>
+
+/// Shared helpers of the benchmarks. Every measurement is printed to stdout as a
+/// single JSON line, so runs of different builds can be compared by scripts.
+/// Progress and errors go to stderr.
+
+/// Return: monotonic time in seconds.
+static inline double bench_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/// Print result of `iters` calls of `bench` that took `sec`.
+/// `variant` tells implementations or formats of the same benchmark apart, `size` is bytes per call.
+static inline void bench_result(const char *bench, const char *variant, size_t size, size_t iters, double sec) {
+    printf(
+        "{\"bench\":\"%s\",\"variant\":\"%s\",\"size\":%zu,\"iters\":%zu,\"ns_per_op\":%.2f,\"mops\":%.3f}\n",
+        bench, variant, size, iters, sec * 1e9 / (double)iters, (double)iters / sec / 1e6
+    );
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/cksum.h"
+#include "bench.h"
+
+#define MAX_SIZE (64 * 1024)
+/// Bytes summed per measurement, so small sizes run enough iterations.
+#define BYTES_PER_RUN (256UL * 1024 * 1024)
+
+/// Checksum as it was originally implemented: 16-bit words into an `int`.
+/// Used as a reference for sizes it doesn't overflow at.
+static uint16_t in_cksum_reference(const char *addr, size_t size, uint16_t start) {
+    int sum = start;
+    while (size >= 2) {
+        sum += *(uint16_t *)addr;
+        addr += 2;
+        size -= 2;
+    }
+    if (size == 1) {
+        sum += *(uint8_t *)addr;
+    }
+    const int uint16_mask = 0xffff;
+    sum = (sum >> 16) + (sum & uint16_mask);
+    sum += (sum >> 16);
+    return (uint16_t)(~sum);
+}
+
+int main() {
+    char *buf = malloc(MAX_SIZE + 1);
+    srand(42);
+    for (size_t i = 0; i < MAX_SIZE + 1; i++) {
+        buf[i] = (char)rand();
+    }
+
+    // Results must be bit-identical across implementations, odd sizes and offsets included.
+    for (size_t size = 0; size <= 4096; size++) {
+        for (size_t offset = 0; offset < 2; offset++) {
+            uint16_t expected = in_cksum_reference(buf + offset, size, 0x1234);
+            for (CksumImpl impl = CksumScalar; impl <= CksumAvx2; impl++) {
+                if (in_cksum_supported(impl) == false) continue;
+                uint16_t got = in_cksum_with(impl, buf + offset, size, 0x1234);
+                if (got != expected) {
+                    (void)fprintf(stderr, "%s: mismatch at size %zu: %04x != %04x\n", in_cksum_name(impl), size, got, expected);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    for (CksumImpl impl = CksumScalar; impl <= CksumAvx2; impl++) {
+        if (in_cksum_supported(impl) == false) continue;
+        for (size_t size = 8; size <= MAX_SIZE; size *= 2) {
+            size_t iters = BYTES_PER_RUN / size;
+            volatile uint16_t sink = 0;
+            double start = bench_now();
+            for (size_t i = 0; i < iters; i++) {
+                sink += in_cksum_with(impl, buf, size, (uint16_t)i);
+            }
+            bench_result("cksum", in_cksum_name(impl), size, iters, bench_now() - start);
+        }
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../include/icmp.h"
+#include "../include/payload.h"
+#include "bench.h"
+
+#define ITERS (4UL * 1000 * 1000)
+/// Replies queued on the socket pair at once, well below the default `SO_SNDBUF`.
+#define RECV_QUEUE (ICMP_BATCH_MAX)
+#define RECV_ROUNDS (ITERS / 16 / RECV_QUEUE)
+#define PARSE_ROUNDS (ITERS / ICMP_BATCH_MAX)
+/// Bytes of echoed data checked per size.
+#define BYTES_PER_CHECK (1024UL * 1024 * 1024)
+
+/// Length of IPv4 echo reply as a raw socket receives it: IP header, ICMP header and payload.
+#define IP4_REPLY_LEN (sizeof(struct iphdr) + sizeof(IcmpPacket))
+
+/// Build echo reply with valid checksums into `buf`.
+static void new_ip4_reply(u_char buf[IP4_REPLY_LEN], uint16_t id, uint16_t seq) {
+    struct iphdr ip;
+    memset(&ip, 0, sizeof(ip));
+    ip.version = 4;
+    ip.ihl = sizeof(ip) / sizeof(int32_t);
+    ip.tot_len = htons(IP4_REPLY_LEN);
+    ip.ttl = 64;
+    ip.protocol = IPPROTO_ICMP;
+    ip.saddr = htonl(INADDR_LOOPBACK);
+    ip.daddr = htonl(INADDR_LOOPBACK);
+    ip.check = in_cksum((char *)&ip, sizeof(ip), 0);
+
+    IcmpPacket icm;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    icmp_echo4_template(&icm, id);
+    icmp_echo_update(&icm, seq, &now);
+    icm.h_type = ICMP_ECHOREPLY;
+    icm.h_cksum = 0;
+    icm.h_cksum = in_cksum((char *)&icm, sizeof(icm), 0);
+    memcpy(buf, &ip, sizeof(ip));
+    memcpy(buf + sizeof(ip), &icm, sizeof(icm));
+}
+
+static void bench_new_echo() {
+    volatile uint16_t sink = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < ITERS; i++) {
+        IcmpPacket *icm = new_echo4_request(0x1234, (uint16_t)i);
+        sink += icm->h_cksum;
+        free(icm);
+    }
+    bench_result("new_echo_request", "ipv4", sizeof(IcmpPacket), ITERS, bench_now() - start);
+
+    start = bench_now();
+    for (size_t i = 0; i < ITERS; i++) {
+        IcmpPacket *icm = new_echo6_request(0x1234, (uint16_t)i);
+        sink += icm->h_cksum;
+        free(icm);
+    }
+    bench_result("new_echo_request", "ipv6", sizeof(IcmpPacket), ITERS, bench_now() - start);
+
+    // What the engine does per probe: patch the prepared template.
+    IcmpPacket template;
+    icmp_echo4_template(&template, 0x1234);
+    start = bench_now();
+    for (size_t i = 0; i < ITERS; i++) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        icmp_echo_update(&template, (uint16_t)i, &now);
+        sink += template.h_cksum;
+    }
+    bench_result("new_echo_request", "template", sizeof(IcmpPacket), ITERS, bench_now() - start);
+}
+
+/// Queue `RECV_QUEUE` replies on the socket pair.
+static void fill(int sockfd, const u_char *reply) {
+    for (size_t i = 0; i < RECV_QUEUE; i++) {
+        if (send(sockfd, reply, IP4_REPLY_LEN, 0) == -1) {
+            perror("send");
+            exit(1);
+        }
+    }
+}
+
+/// Parse replies fed through a datagram socket pair, so the syscall cost is included
+/// the way the real receive path pays it, but without the network stack.
+static void bench_recv() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    (void)fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    u_char reply[IP4_REPLY_LEN];
+    new_ip4_reply(reply, 0x1234, 1);
+    static IcmpRecvSlot slots[ICMP_BATCH_MAX];
+    if (icmp_recv_ring_init(slots, ICMP_BATCH_MAX, ICMP_RECV_BUF_LEN) == -1) {
+        perror("icmp_recv_ring_init");
+        exit(1);
+    }
+    u_char *buf = slots[0].buf;
+
+    double sec = 0;
+    for (size_t round = 0; round < RECV_ROUNDS; round++) {
+        fill(fds[1], reply);
+        double start = bench_now();
+        for (size_t i = 0; i < RECV_QUEUE; i++) {
+            IcmpView view;
+            struct sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            IcmpResult res = icmp_func.recv4(&view, fds[0], buf, (int)slots[0].cap, &addr, &addr_len);
+            if (res != IcmpOk) {
+                (void)fprintf(stderr, "recv4: %s\n", icmp_func.strerror(res));
+                exit(1);
+            }
+        }
+        sec += bench_now() - start;
+    }
+    bench_result("recv_ip4_icmp", "single", IP4_REPLY_LEN, RECV_ROUNDS * RECV_QUEUE, sec);
+
+    sec = 0;
+    for (size_t round = 0; round < RECV_ROUNDS; round++) {
+        fill(fds[1], reply);
+        double start = bench_now();
+        for (size_t left = RECV_QUEUE; left > 0;) {
+            size_t received = 0;
+            IcmpResult res = icmp_func.recv4_batch(slots, ICMP_BATCH_MAX, fds[0], &received);
+            if (res != IcmpOk || received == 0) {
+                (void)fprintf(stderr, "recv4_batch: %s\n", icmp_func.strerror(res));
+                exit(1);
+            }
+            left -= received;
+        }
+        sec += bench_now() - start;
+    }
+    bench_result("recv_ip4_icmp", "batch", IP4_REPLY_LEN, RECV_ROUNDS * RECV_QUEUE, sec);
+    icmp_recv_ring_free(slots);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+/// Parse a full batch of replies already in memory, to see the parser apart from the syscalls.
+static void bench_parse() {
+    static IcmpRecvSlot slots[ICMP_BATCH_MAX];
+    if (icmp_recv_ring_init(slots, ICMP_BATCH_MAX, ICMP_RECV_BUF_LEN) == -1) {
+        perror("icmp_recv_ring_init");
+        exit(1);
+    }
+    for (size_t i = 0; i < ICMP_BATCH_MAX; i++) {
+        new_ip4_reply(slots[i].buf, 0x1234, (uint16_t)i);
+        slots[i].len = IP4_REPLY_LEN;
+    }
+    for (unsigned flags = 0; flags <= ICMP_VIEW_SKIP_IP_CKSUM; flags += ICMP_VIEW_SKIP_IP_CKSUM) {
+        uint64_t sink = 0;
+        double start = bench_now();
+        for (size_t round = 0; round < PARSE_ROUNDS; round++) {
+            icmp_func.parse_batch(slots, ICMP_BATCH_MAX, IcmpSockRaw, IPv4, flags);
+            sink += icmp_view_seq(&slots[round % ICMP_BATCH_MAX].view);
+        }
+        double sec = bench_now() - start;
+        if (slots[0].res != IcmpOk || sink == UINT64_MAX) exit(1);
+        bench_result("parse_ip4_icmp", flags ? "batch_skip_ip_cksum" : "batch", IP4_REPLY_LEN,
+            PARSE_ROUNDS * ICMP_BATCH_MAX, sec);
+    }
+    icmp_recv_ring_free(slots);
+}
+
+/// Check echoed data of replies from small to the largest, and that a flipped last byte is found.
+static void bench_payload_check() {
+    static const size_t sizes[] = {56, 1472, PAYLOAD_MAX_IP4};
+    IcmpPayload payload;
+    if (payload_init(&payload, PAYLOAD_MAX_IP4 - PAYLOAD_MIN, NULL, 0) == -1) {
+        perror("payload_init");
+        exit(1);
+    }
+    u_char *reply = malloc(sizeof(struct icmphdr) + PAYLOAD_MAX_IP4);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    memcpy(reply + sizeof(struct icmphdr), &ts, sizeof(ts));
+    memcpy(reply + sizeof(IcmpPacket), payload.data, payload.len);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        IcmpPayload sent = {.data = payload.data, .len = sizes[i] - PAYLOAD_MIN};
+        IcmpView view = {.icm = (const IcmpPacket *)reply, .icmp_len = sizeof(struct icmphdr) + sizes[i]};
+        size_t iters = BYTES_PER_CHECK / sizes[i];
+        long sink = 0;
+        double start = bench_now();
+        for (size_t j = 0; j < iters; j++) sink += payload_check(&sent, &view, &ts);
+        double sec = bench_now() - start;
+        reply[sizeof(struct icmphdr) + sizes[i] - 1] ^= 1;
+        long corrupt_at = payload_check(&sent, &view, &ts);
+        reply[sizeof(struct icmphdr) + sizes[i] - 1] ^= 1;
+        if (sink != -(long)iters || corrupt_at != (long)sizes[i] - 1) {
+            (void)fprintf(stderr, "payload_check: wrong result for %zu bytes\n", sizes[i]);
+            exit(1);
+        }
+        bench_result("payload_check", "intact", sizes[i], iters, sec);
+    }
+    free(reply);
+    payload_free(&payload);
+}
+
+int main() {
+    bench_new_echo();
+    bench_parse();
+    bench_payload_check();
+    bench_recv();
+    return 0;
+}
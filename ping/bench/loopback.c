@@ -0,0 +1,157 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../include/engine.h"
+#include "bench.h"
+
+#define DEFAULT_PROBES (500UL * 1000)
+/// Probes in flight per round, one full send batch.
+#define DEFAULT_TARGETS (ICMP_BATCH_MAX)
+
+/// Engine is too big for the stack.
+static Engine engine;
+
+static double cpu_sec() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/// Receive path under test.
+typedef enum BenchIo {
+    IoSyscalls,
+    IoUring,
+    IoPacketRing,
+} BenchIo;
+
+/// Flood `n_targets` copies of the loopback address with `probes` probes in total and
+/// print throughput, CPU time per probe and RTT distribution.
+/// Return: 0 on success, -1 if the socket can't be opened (no privileges), it is reported and skipped.
+static int bench_loopback(IpVersion ip, IcmpSocketKind kind, BenchIo io, size_t probes, size_t n_targets) {
+    const char *variant = ip == IPv4 ? "ipv4" : "ipv6";
+    uint16_t id = (uint16_t)getpid();
+    int sockfd = icmp_socket(ip, kind, &id);
+    if (sockfd == -1) {
+        (void)fprintf(stderr, "loopback %s: skipped: %s\n", variant, strerror(errno));
+        return -1;
+    }
+
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len;
+    if (ip == IPv4) {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr_len = sizeof(*in);
+    } else {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_loopback;
+        addr_len = sizeof(*in6);
+    }
+    TargetList targets;
+    if (target_list_init(&targets, n_targets) == -1) {
+        perror("target_list_init");
+        exit(1);
+    }
+    for (size_t i = 0; i < n_targets; i++) {
+        Target target;
+        target_init(&target, variant, i, &addr, addr_len);
+        target_list_push(&targets, &target);
+    }
+    target_list_finish(&targets);
+
+    EngineOptions opts = {
+        .count = (uint32_t)(probes / n_targets),
+        .interval = 1000,
+        .flood = true,
+        .io_uring = io == IoUring,
+        .packet_ring = io == IoPacketRing,
+    };
+    if (engine_init(&engine, sockfd, ip, id, &targets, 0, 1, &opts, NULL, NULL) == -1) {
+        perror("engine_init");
+        exit(1);
+    }
+    double cpu_start = cpu_sec();
+    double start = bench_now();
+    IcmpResult res = engine_run(&engine);
+    double sec = bench_now() - start;
+    double cpu = cpu_sec() - cpu_start;
+    if (res != IcmpOk) {
+        (void)fprintf(stderr, "loopback %s: %s\n", variant, icmp_func.strerror(res));
+        exit(1);
+    }
+
+    TargetStats total = {0};
+    for (size_t i = 0; i < n_targets; i++) {
+        const TargetStats *stats = &targets.items[i].stats;
+        total.sent += stats->sent;
+        total.received += stats->received;
+        hist_merge(&total.rtt, &stats->rtt);
+    }
+    const Histogram *rtt = &total.rtt;
+    printf(
+        "{\"bench\":\"loopback\",\"variant\":\"%s\",\"socket\":\"%s\",\"io\":\"%s\",\"targets\":%zu,"
+        "\"sent\":%u,\"received\":%u,\"sec\":%.3f,\"pps\":%.0f,\"cpu_ns_per_probe\":%.1f,"
+        "\"rtt_p50_us\":%.1f,\"rtt_p90_us\":%.1f,\"rtt_p99_us\":%.1f,\"rtt_p999_us\":%.1f,\"rtt_max_us\":%.1f}\n",
+        variant, engine.kind == IcmpSockRaw ? "raw" : "dgram", engine.io_uring ? "io_uring" : engine.packet_ring ? "packet_ring" : "syscalls", n_targets,
+        total.sent, total.received, sec, (double)total.received / sec,
+        total.received ? cpu * 1e9 / total.received : 0,
+        (double)hist_percentile(rtt, 50) / 1e3, (double)hist_percentile(rtt, 90) / 1e3,
+        (double)hist_percentile(rtt, 99) / 1e3, (double)hist_percentile(rtt, 99.9) / 1e3,
+        (double)rtt->max / 1e3
+    );
+    if (engine.io_uring) uring_close(&engine.uring);
+    if (engine.packet_ring) packet_ring_close(&engine.packet);
+    (void)close(sockfd);
+    (void)close(engine.wakefd);
+    hist_free(&engine.lag);
+    hist_free(&total.rtt);
+    for (size_t i = 0; i < n_targets; i++) hist_free(&targets.items[i].stats.rtt);
+    free(targets.items);
+    return 0;
+}
+
+/// End-to-end throughput of the whole engine against 127.0.0.1 and ::1.
+/// Every address is measured with plain syscalls, with `io_uring` (if the kernel has it)
+/// and with the `AF_PACKET` receive ring (if privileged).
+/// Usage: bench_loopback [-n PROBES] [-t TARGETS] [-s raw|dgram]
+int main(int argc, char *argv[]) {
+    size_t probes = DEFAULT_PROBES, n_targets = DEFAULT_TARGETS;
+    IcmpSocketKind kind = IcmpSockAuto;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            probes = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            n_targets = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            kind = strcmp(optarg, "raw") == 0 ? IcmpSockRaw : IcmpSockDgram;
+            break;
+        default:
+            (void)fprintf(stderr, "Usage: %s [-n PROBES] [-t TARGETS] [-s raw|dgram]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n_targets == 0 || probes < n_targets) {
+        (void)fprintf(stderr, "%s: need at least one probe per target\n", argv[0]);
+        return 1;
+    }
+    // Missing privileges skip the benchmark, they don't fail the whole suite.
+    for (BenchIo io = IoSyscalls; io <= IoPacketRing; io++) {
+        (void)bench_loopback(IPv4, kind, io, probes, n_targets);
+        (void)bench_loopback(IPv6, kind, io, probes, n_targets);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/engine.h"
+#include "../include/output.h"
+#include "bench.h"
+
+#define REPLY_ITERS (4UL * 1000 * 1000)
+#define STATS_ITERS (200UL * 1000)
+
+static const char *format_names[] = {"text", "json", "csv"};
+
+/// Format replies and statistics into `/dev/null`, so only formatting and the
+/// buffered writes are measured, not the terminal.
+int main() {
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("/dev/null");
+        return 1;
+    }
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Target target;
+    target_init(&target, "localhost", 0, &addr, sizeof(*in));
+    for (unsigned i = 0; i < 1000; i++) {
+        target.stats.sent ++;
+        target.stats.received ++;
+        hist_record(&target.stats.rtt, 20000 + (uint64_t)i * 37);
+    }
+
+    struct iphdr ip = {.ihl = 5, .ttl = 64};
+    IcmpPacket icm;
+    icmp_echo4_template(&icm, 0x1234);
+    EngineReply reply = {
+        .target = &target, .view = {.ip4 = &ip, .icm = &icm, .icmp_len = sizeof(icm)}, .corrupt_at = -1
+    };
+
+    static Output output;
+    for (OutputFormat format = FmtText; format <= FmtCsv; format++) {
+        output_init(&output, fd, format, false, 0, false);
+        double start = bench_now();
+        for (size_t i = 0; i < REPLY_ITERS; i++) {
+            reply.seq = (uint32_t)i;
+            reply.time = 0.05 + (double)(i % 1000) / 1000;
+            output_reply(&output, &reply);
+        }
+        output_flush(&output);
+        bench_result("output_reply", format_names[format], 0, REPLY_ITERS, bench_now() - start);
+
+        start = bench_now();
+        for (size_t i = 0; i < STATS_ITERS; i++) {
+            output_stats(&output, target.hostname, &target.stats);
+        }
+        output_flush(&output);
+        bench_result("output_stats", format_names[format], 0, STATS_ITERS, bench_now() - start);
+    }
+    hist_free(&target.stats.rtt);
+    (void)close(fd);
+    return 0;
+}
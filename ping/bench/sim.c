@@ -0,0 +1,246 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "../include/engine.h"
+#include "../include/sim.h"
+#include "../include/time_util.h"
+#include "bench.h"
+
+#define DEFAULT_PROBES (1000UL * 1000)
+#define DEFAULT_TARGETS (1000)
+#define DEFAULT_SEED (1)
+/// Every this many targets is a dead host, its probes are all lost.
+#define DEAD_EVERY (16)
+/// Identifier of our probes, the simulated network has no other traffic.
+#define SIM_ID (0x5157)
+
+/// Engine is too big for the stack.
+static Engine engine;
+
+static double cpu_sec() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/// Network conditions of a run and what they must leave in the statistics.
+typedef struct BenchScenario {
+    const char *name;
+    SimLink link;
+    /// Probe timeout in milliseconds.
+    double timeout;
+    /// Whether every reply arrives before the timeout, so every one must be counted.
+    bool all_in_time;
+} BenchScenario;
+
+/// Outcome of a run, equal for equal seeds.
+typedef struct BenchOutcome {
+    TargetStats total;
+    SimStats sim;
+    /// Virtual time the run took, in nanoseconds.
+    uint64_t now;
+} BenchOutcome;
+
+static void bench_fail(const char *scenario, const char *variant, const char *what) {
+    (void)fprintf(stderr, "sim %s %s: %s\n", scenario, variant, what);
+    exit(1);
+}
+
+/// Ping `n_targets` simulated hosts `probes` times in total in flood mode and check engine
+/// statistics against what the network did. Results are printed only if `report` is set.
+static BenchOutcome bench_sim(
+    IpVersion ip, const BenchScenario *scenario, size_t probes, size_t n_targets, uint64_t seed, bool report
+) {
+    const char *variant = ip == IPv4 ? "ipv4" : "ipv6";
+    SimNet net;
+    (void)sim_init(&net, ip, &scenario->link, seed);
+    SimLink dead = scenario->link;
+    dead.loss = 1;
+
+    TargetList targets;
+    if (target_list_init(&targets, n_targets) == -1) {
+        perror("target_list_init");
+        exit(1);
+    }
+    for (size_t i = 0; i < n_targets; i++) {
+        struct sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        socklen_t addr_len;
+        if (ip == IPv4) {
+            struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(0x0a000000 + (uint32_t)i);
+            addr_len = sizeof(*in);
+        } else {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&addr;
+            in6->sin6_family = AF_INET6;
+            (void)inet_pton(AF_INET6, "2001:db8::", &in6->sin6_addr);
+            uint32_t host = htonl((uint32_t)i);
+            memcpy(&in6->sin6_addr.s6_addr[12], &host, sizeof(host));
+            addr_len = sizeof(*in6);
+        }
+        if (i % DEAD_EVERY == DEAD_EVERY - 1 && sim_route(&net, &addr, &dead) == -1) {
+            perror("sim_route");
+            exit(1);
+        }
+        Target target;
+        target_init(&target, variant, i, &addr, addr_len);
+        target_list_push(&targets, &target);
+    }
+    target_list_finish(&targets);
+
+    Transport transport = sim_transport(&net);
+    EngineOptions opts = {
+        .count = (uint32_t)(probes / n_targets),
+        .interval = 1000,
+        .flood = true,
+        .timeout = scenario->timeout,
+        .transport = &transport,
+    };
+    if (engine_init(&engine, -1, ip, SIM_ID, &targets, 0, 1, &opts, NULL, NULL) == -1) {
+        perror("engine_init");
+        exit(1);
+    }
+    double cpu_start = cpu_sec();
+    double start = bench_now();
+    IcmpResult res = engine_run(&engine);
+    double sec = bench_now() - start;
+    double cpu = cpu_sec() - cpu_start;
+    if (res != IcmpOk) bench_fail(scenario->name, variant, icmp_func.strerror(res));
+
+    BenchOutcome outcome = {.sim = net.stats, .now = net.now};
+    TargetStats *total = &outcome.total;
+    for (size_t i = 0; i < n_targets; i++) {
+        const TargetStats *stats = &targets.items[i].stats;
+        if (i % DEAD_EVERY == DEAD_EVERY - 1 && stats->received > 0) {
+            bench_fail(scenario->name, variant, "dead host replied");
+        }
+        total->sent += stats->sent;
+        total->received += stats->received;
+        hist_merge(&total->rtt, &stats->rtt);
+    }
+    const Histogram *rtt = &total->rtt;
+    if (report) printf(
+        "{\"bench\":\"sim\",\"variant\":\"%s\",\"scenario\":\"%s\",\"targets\":%zu,"
+        "\"sent\":%u,\"received\":%u,\"lost\":%llu,\"duplicated\":%llu,\"errors\":%llu,"
+        "\"sec\":%.3f,\"virtual_sec\":%.3f,\"pps\":%.0f,\"cpu_ns_per_probe\":%.1f,"
+        "\"rtt_p50_us\":%.1f,\"rtt_p99_us\":%.1f,\"rtt_max_us\":%.1f}\n",
+        variant, scenario->name, n_targets, total->sent, total->received,
+        (unsigned long long)net.stats.lost, (unsigned long long)net.stats.duplicated,
+        (unsigned long long)net.stats.errors, sec, (double)net.now / 1e9, (double)total->sent / sec,
+        total->sent ? cpu * 1e9 / total->sent : 0,
+        (double)hist_percentile(rtt, 50) / 1e3, (double)hist_percentile(rtt, 99) / 1e3, (double)rtt->max / 1e3
+    );
+
+    // The network saw exactly what the engine counted as sent.
+    if (total->sent != net.stats.sent || total->sent != opts.count * n_targets) {
+        bench_fail(scenario->name, variant, "sent count differs from the network");
+    }
+    // Duplicates and errors are never counted, late replies only if they beat the timeout.
+    if (total->received > net.stats.replied) bench_fail(scenario->name, variant, "more replies than the network sent");
+    if (scenario->all_in_time && total->received != net.stats.replied) {
+        bench_fail(scenario->name, variant, "replies in time were not counted");
+    }
+    // A tick is processed once it has fully started, so replies beat the timeout by under a millisecond.
+    if (rtt->count > 0 && (double)rtt->max > (scenario->timeout + 1) * NANOS_IN_MILLI) {
+        bench_fail(scenario->name, variant, "reply counted after its timeout");
+    }
+    if (scenario->link.delay == SimConstant && rtt->count > 0) {
+        uint64_t expected = (uint64_t)(scenario->link.rtt * NANOS_IN_MILLI);
+        if (rtt->min != expected || rtt->max != expected) bench_fail(scenario->name, variant, "RTT differs from the link");
+    }
+
+    engine_free(&engine);
+    sim_free(&net);
+    for (size_t i = 0; i < n_targets; i++) hist_free(&targets.items[i].stats.rtt);
+    free(targets.items);
+    return outcome;
+}
+
+/// Engine overhead without the kernel: the whole engine (scheduling, matching, timeouts and
+/// statistics) is run against an in-memory network on a virtual clock, so the rate is bounded
+/// by the engine alone. Every scenario is run twice with the same seed and must come out the same.
+/// Usage: bench_sim [-n PROBES] [-t TARGETS] [-s SEED]
+int main(int argc, char *argv[]) {
+    size_t probes = DEFAULT_PROBES, n_targets = DEFAULT_TARGETS;
+    uint64_t seed = DEFAULT_SEED;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            probes = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            n_targets = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            (void)fprintf(stderr, "Usage: %s [-n PROBES] [-t TARGETS] [-s SEED]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n_targets == 0 || probes < n_targets) {
+        (void)fprintf(stderr, "%s: need at least one probe per target\n", argv[0]);
+        return 1;
+    }
+
+    const BenchScenario scenarios[] = {
+        {
+            .name = "clean",
+            .link = {.delay = SimConstant, .rtt = 10, .ttl = 64},
+            .timeout = 100,
+            .all_in_time = true,
+        },
+        {
+            .name = "lossy",
+            .link = {
+                .delay = SimUniform, .rtt = 5, .jitter = 20, .loss = 0.05,
+                .reorder = 0.02, .reorder_delay = 5, .duplicate = 0.01, .error = 0.01, .ttl = 57,
+            },
+            .timeout = 100,
+            .all_in_time = true,
+        },
+        {
+            .name = "long-tail",
+            .link = {.delay = SimExponential, .rtt = 1, .jitter = 20, .loss = 0.01, .ttl = 50},
+            .timeout = 50,
+        },
+        {
+            .name = "normal",
+            .link = {.delay = SimNormal, .rtt = 30, .jitter = 5, .duplicate = 0.05, .ttl = 60},
+            .timeout = 100,
+            .all_in_time = true,
+        },
+    };
+    const IpVersion ips[] = {IPv4, IPv6};
+    for (size_t v = 0; v < sizeof(ips) / sizeof(ips[0]); v++) {
+        IpVersion ip = ips[v];
+        for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+            BenchOutcome first = bench_sim(ip, &scenarios[i], probes, n_targets, seed, true);
+            BenchOutcome second = bench_sim(ip, &scenarios[i], probes, n_targets, seed, false);
+            if (
+                first.now != second.now || first.total.received != second.total.received ||
+                memcmp(&first.sim, &second.sim, sizeof(first.sim)) != 0 ||
+                first.total.rtt.sum != second.total.rtt.sum ||
+                first.total.rtt.lo != second.total.rtt.lo || first.total.rtt.n_buckets != second.total.rtt.n_buckets ||
+                memcmp(
+                    first.total.rtt.buckets, second.total.rtt.buckets,
+                    first.total.rtt.n_buckets * sizeof(*first.total.rtt.buckets)
+                ) != 0
+            ) {
+                bench_fail(scenarios[i].name, ip == IPv4 ? "ipv4" : "ipv6", "same seed gave different results");
+            }
+            hist_free(&first.total.rtt);
+            hist_free(&second.total.rtt);
+        }
+    }
+    return 0;
+}
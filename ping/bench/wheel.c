@@ -0,0 +1,179 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/wheel.h"
+#include "bench.h"
+
+#define N_TIMERS (200UL * 1000)
+/// Rounds of random operations, every round is followed by an advance and a full check.
+#define MODEL_ROUNDS (2000)
+#define MODEL_OPS (N_TIMERS / 100)
+/// Arbitrary first tick, so digits of every level start in the middle of their range.
+#define START_TICK (123456789ULL)
+
+/// Timer with the tick it must fire at, as a brute-force model of the wheel.
+typedef struct ModelTimer {
+    WheelTimer timer;
+    /// 0 if the timer is not scheduled.
+    uint64_t expires;
+} ModelTimer;
+
+typedef struct Model {
+    TimerWheel wheel;
+    ModelTimer *timers;
+    size_t pending;
+    uint64_t fired;
+    /// Reschedule every 7th fired timer from the callback.
+    bool reschedule;
+    uint64_t rng;
+} Model;
+
+/// Wheel is too big for the stack.
+static Model model;
+
+static void model_fail(const char *what) {
+    (void)fprintf(stderr, "wheel: %s at tick %llu\n", what, (unsigned long long)model.wheel.now);
+    exit(1);
+}
+
+/// splitmix64, so every run checks the same operations.
+static uint64_t model_rand(Model *self) {
+    uint64_t z = (self->rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// Return: random expiry: mostly near, sometimes on higher levels, already passed or beyond the wheel.
+static uint64_t model_expiry(Model *self) {
+    uint64_t now = self->wheel.now;
+    switch (model_rand(self) % 8) {
+    case 0:
+        return now - model_rand(self) % 1000;
+    case 1:
+        return now + model_rand(self) % (WHEEL_MAX_DELAY * 4);
+    case 2:
+    case 3:
+        return now + model_rand(self) % (1 << 20);
+    default:
+        return now + model_rand(self) % 200;
+    }
+}
+
+/// Schedule timer `i` at `expires` in the wheel, and where `wheel_insert` promises to fire it in the model.
+static void model_insert(Model *self, size_t i, uint64_t expires) {
+    ModelTimer *timer = &self->timers[i];
+    if (timer->expires == 0) self->pending ++;
+    wheel_insert(&self->wheel, &timer->timer, expires);
+    uint64_t now = self->wheel.now;
+    if (expires <= now) expires = now + 1;
+    if (expires - now > WHEEL_MAX_DELAY) expires = now + WHEEL_MAX_DELAY;
+    timer->expires = expires;
+}
+
+static void model_remove(Model *self, size_t i) {
+    ModelTimer *timer = &self->timers[i];
+    if (timer->expires != 0) self->pending --;
+    wheel_remove(&self->wheel, &timer->timer);
+    timer->expires = 0;
+}
+
+/// Every timer must fire exactly at its tick, some are rescheduled from the callback.
+static void model_expire(WheelTimer *wheel_timer, void *ctx) {
+    Model *self = ctx;
+    ModelTimer *timer = (ModelTimer *)((char *)wheel_timer - offsetof(ModelTimer, timer));
+    if (timer->expires == 0) model_fail("unscheduled timer fired");
+    if (timer->expires != self->wheel.now) model_fail("timer fired at the wrong tick");
+    timer->expires = 0;
+    self->pending --;
+    self->fired ++;
+    if (self->reschedule && self->fired % 7 == 0) model_insert(self, (size_t)(timer - self->timers), model_expiry(self));
+}
+
+/// Compare the wheel with the model: nothing due is left, counts match, and the next tick
+/// the wheel reports is no later than the earliest timer.
+static void model_check(Model *self) {
+    uint64_t earliest = UINT64_MAX;
+    for (size_t i = 0; i < N_TIMERS; i++) {
+        uint64_t expires = self->timers[i].expires;
+        if (expires == 0) continue;
+        if (expires <= self->wheel.now) model_fail("due timer didn't fire");
+        if (wheel_pending(&self->timers[i].timer) == 0) model_fail("scheduled timer is not pending");
+        if (expires < earliest) earliest = expires;
+    }
+    if (self->wheel.count != self->pending) model_fail("count differs from the model");
+    uint64_t next = wheel_next(&self->wheel);
+    if (next > earliest || (self->pending == 0 && next != UINT64_MAX)) model_fail("next tick is past the earliest timer");
+}
+
+/// Random inserts, reschedules, cancels and advances of `N_TIMERS` timers checked against
+/// the brute-force model after every advance.
+static void bench_model() {
+    wheel_init(&model.wheel, START_TICK);
+    model.timers = calloc(N_TIMERS, sizeof(*model.timers));
+    if (model.timers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    model.rng = 1;
+    model.reschedule = true;
+    for (size_t i = 0; i < N_TIMERS; i++) model_insert(&model, i, model_expiry(&model));
+    model_check(&model);
+
+    for (size_t round = 0; round < MODEL_ROUNDS; round++) {
+        for (size_t op = 0; op < MODEL_OPS; op++) {
+            size_t i = (size_t)(model_rand(&model) % N_TIMERS);
+            if (model_rand(&model) % 4 == 0) model_remove(&model, i);
+            else model_insert(&model, i, model_expiry(&model));
+        }
+        uint64_t jump = model_rand(&model) % 16 == 0 ? model_rand(&model) % (1 << 24) : model_rand(&model) % 64;
+        wheel_advance(&model.wheel, model.wheel.now + jump, model_expire, &model);
+        model_check(&model);
+    }
+    // Whatever is left fires by the farthest possible tick.
+    model.reschedule = false;
+    wheel_advance(&model.wheel, model.wheel.now + WHEEL_MAX_DELAY, model_expire, &model);
+    model_check(&model);
+    if (model.pending != 0) model_fail("timers left after the farthest tick");
+    free(model.timers);
+}
+
+static void count_expire(WheelTimer *timer, void *ctx) {
+    (void)timer;
+    (*(size_t *)ctx) ++;
+}
+
+/// Throughput of inserting timers a probe timeout apart and expiring them millisecond by millisecond.
+static void bench_speed() {
+    WheelTimer *timers = calloc(N_TIMERS, sizeof(*timers));
+    if (timers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    wheel_init(&model.wheel, START_TICK);
+    model.rng = 2;
+    double start = bench_now();
+    for (size_t i = 0; i < N_TIMERS; i++) {
+        wheel_insert(&model.wheel, &timers[i], START_TICK + 1000 + model_rand(&model) % 10000);
+    }
+    bench_result("wheel", "insert", 0, N_TIMERS, bench_now() - start);
+
+    size_t expired = 0;
+    start = bench_now();
+    for (uint64_t tick = START_TICK; tick <= START_TICK + 11000; tick++) {
+        wheel_advance(&model.wheel, tick, count_expire, &expired);
+    }
+    double sec = bench_now() - start;
+    if (expired != N_TIMERS) model_fail("not every timer expired");
+    bench_result("wheel", "expire", 0, N_TIMERS, sec);
+    free(timers);
+}
+
+/// Timer wheel against a brute-force model, then its insert and expiry throughput.
+int main() {
+    bench_model();
+    bench_speed();
+    return 0;
+}
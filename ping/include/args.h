@@ -1,11 +1,14 @@
 #ifndef PING_ARGS_H_
 #define PING_ARGS_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
 #include "icmp.h"
+#include "output.h"
+#include "payload.h"
 
 /// Print help message to the stdin.
 void help_message();
@@ -13,6 +16,9 @@ void help_message();
 /// Print usage message to the stdin and exit with status code.
 void usage_and_exit(int status_code);
 
+/// Most worker threads, one ICMP id each.
+#define MAX_THREADS (1024)
+
 enum color_config {
     ClrAlways = 1,
     ClrNever = -1,
@@ -21,14 +27,55 @@ enum color_config {
 
 struct AppConfig {
     IpVersion ip;
-    char *hostname;
+    /// Hosts from the command line and the targets file.
+    char **hostnames;
+    size_t n_hostnames;
+    /// File with one target per line (`-` for stdin).
+    char *targets_file;
     char *bin;
     uint verbosity;
     enum color_config color;
     /// How many packets to send (0 - infinity).
-    // uint16 because icmp.seq field is uint16.
-    uint16_t count;
-} extern config;
+    // Wire sequence numbers wrap around, so count is not limited by the uint16 icmp.seq field.
+    uint32_t count;
+    /// Time between packets in milliseconds.
+    double interval;
+    /// Send packets as fast as replies come back (but at least every `interval`).
+    bool flood;
+    /// Measure round-trip time with kernel timestamps.
+    bool kernel_ts;
+    IcmpSocketKind socket_kind;
+    OutputFormat format;
+    /// File every probe is recorded to, NULL if disabled.
+    char *record_file;
+    /// Most records kept in the file, older ones are overwritten.
+    uint32_t record_limit;
+    /// Time to wait for a reply in milliseconds (0 - wait until the end).
+    double timeout;
+    /// Total run time in milliseconds (0 - unlimited).
+    double deadline;
+    /// Worker threads the hosts are split between.
+    uint32_t threads;
+    /// Send and receive through `io_uring`.
+    bool io_uring;
+    /// Receive through an `AF_PACKET` ring.
+    bool packet_ring;
+    /// Trace the path with TTLs up to this many hops instead of pinging (0 - disabled).
+    uint32_t trace_hops;
+    /// Discover path MTU probing sizes up to this many bytes instead of pinging (0 - disabled).
+    uint32_t pmtu_max;
+    /// Data bytes of every echo request, the timestamp included (0 - timestamp only).
+    uint32_t size;
+    /// Bytes the data after the timestamp is filled with, repeated (none - incrementing bytes).
+    u_char pattern[PAYLOAD_PATTERN_MAX];
+    size_t pattern_len;
+    /// Tune for microsecond RTT fidelity: busy-polling, CPU pinning, locked memory, real-time priority.
+    bool low_jitter;
+    /// CPU the worker is pinned to with `low_jitter` (-1 - the one the process started on).
+    int low_jitter_cpu;
+};
+
+extern struct AppConfig config;
 
 /// Parse command line arguments into `config` global variable.
 void parse_args(int argc, char *argv[]);
@@ -0,0 +1,33 @@
+#ifndef PING_CKSUM_H_
+#define PING_CKSUM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Internet checksum implementations, `in_cksum` picks the fastest one supported by the CPU.
+typedef enum CksumImpl {
+    CksumScalar = 0,
+    CksumSse2 = 1,
+    CksumAvx2 = 2,
+} CksumImpl;
+
+/// Returns IPv4 checksum according to RFC 1071.
+/// Sum is accumulated in 64 bits, so buffers of any size are supported.
+/// Thread-safe: the implementation is picked once, before the first sum of any thread.
+uint16_t in_cksum(const char *addr, size_t size, uint16_t start);
+
+/// Same as `in_cksum`, but with explicit implementation (which must be supported).
+uint16_t in_cksum_with(CksumImpl impl, const char *addr, size_t size, uint16_t start);
+
+/// Return: true if the CPU can run the implementation.
+bool in_cksum_supported(CksumImpl impl);
+
+/// Return: name of the implementation.
+const char *in_cksum_name(CksumImpl impl);
+
+/// Returns checksum `cksum` updated after `size` bytes (even number) of data changed from `old` to `new`.
+/// Incremental update according to RFC 1624, so data doesn't need to be summed again.
+uint16_t in_cksum_update(uint16_t cksum, const void *old, const void *new, size_t size);
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef PING_ENGINE_H_
+#define PING_ENGINE_H_
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "icmp.h"
+#include "packet.h"
+#include "payload.h"
+#include "record.h"
+#include "stats.h"
+#include "target.h"
+#include "transport.h"
+#include "uring.h"
+#include "wheel.h"
+
+/// Reply matched back to the target and probe it answers.
+/// Packets are bounded to the engine receive buffer lifetime.
+typedef struct EngineReply {
+    Target *target;
+    /// Sequence number of the probe within its target.
+    uint32_t seq;
+    /// Round-trip time in milliseconds.
+    double time;
+    /// Link-layer header, only with `EngineOptions.packet_ring` on Ethernet-like interfaces.
+    const struct ether_header *eth;
+    /// IPv6 header, only with `EngineOptions.packet_ring`.
+    const struct ip6_hdr *ip6;
+    /// IPv6 header fields from ancillary data, NULL for IPv4 and with `EngineOptions.packet_ring`.
+    const Icmp6Info *info6;
+    /// ICMP message and IPv4 header (NULL for IPv6), read-only.
+    IcmpView view;
+    /// TTL or hop limit of the reply, -1 if unknown.
+    int ttl;
+    /// Offset into the ICMP data of the first byte that differs from the request,
+    /// -1 if the data came back intact or isn't checked (no `EngineOptions.payload`).
+    long corrupt_at;
+} EngineReply;
+
+typedef void (*engine_reply_cb)(const EngineReply *reply, void *ctx);
+typedef void (*engine_idle_cb)(void *ctx);
+typedef void (*engine_target_cb)(const Target *target, void *ctx);
+
+/// Most probes an engine can have in flight: one per ICMP sequence number on the wire.
+/// More hosts than that at once need several engines (ids), see `EngineOptions.timeout`.
+#define ENGINE_MAX_OUTSTANDING (UINT16_MAX + 1)
+
+/// Outstanding probe slot indexed by the ICMP sequence number on the wire.
+typedef struct EngineProbe {
+    /// Index of the target + 1, 0 means the slot is free.
+    uint32_t target;
+    uint32_t seq;
+    /// Time the probe was handed to the kernel, RTT is measured from it.
+    struct timespec sent_at;
+    /// Kernel transmit timestamp, used instead of `sent_at` when the reply has a kernel timestamp too.
+    IcmpTimestamp tx_ts;
+    /// Index of the probe in the record file.
+    uint64_t record;
+    /// Fires when the probe times out (only with `EngineOptions.timeout`).
+    WheelTimer timer;
+} EngineProbe;
+
+/// Probe schedule of the engine.
+typedef struct EngineOptions {
+    /// How many packets to send to every target (0 - infinity).
+    uint32_t count;
+    /// Time between rounds in milliseconds.
+    double interval;
+    /// Send the next round as soon as all replies to the previous one arrived,
+    /// but not less often than `interval`.
+    bool flood;
+    /// Measure RTT between kernel TX and RX timestamps (`SO_TIMESTAMPING`).
+    bool kernel_ts;
+    /// Milliseconds after which a probe without reply is lost (0 - until its slot is reused).
+    /// Own targets times `timeout / interval` + 1 probes must fit in `ENGINE_MAX_OUTSTANDING`,
+    /// otherwise slots are reused before the timeout and their probes counted as lost.
+    double timeout;
+    /// Milliseconds after which the engine stops regardless of `count` (0 - never).
+    double deadline;
+    /// Send and receive through `io_uring` instead of a syscall per batch.
+    bool io_uring;
+    /// Receive through an `AF_PACKET` ring instead of the ICMP socket, unless replies exceed `PACKET_MTU`.
+    bool packet_ring;
+    /// Data sent after the timestamp of every probe and checked in its reply (NULL - timestamp only).
+    const IcmpPayload *payload;
+    /// Network and clock to probe through instead of the socket and the system clock,
+    /// e.g. a simulated network (NULL - the socket). Must outlive the engine.
+    const Transport *transport;
+    /// Microseconds the loop spins on the socket instead of sleeping (0 - always sleep): right after
+    /// sends while replies are due, and up to every deadline, so neither waits for a wakeup.
+    /// Not used with a `transport`, its clock doesn't move while spinning.
+    uint32_t busy_poll;
+} EngineOptions;
+
+/// Drives any number of targets from a single ICMP socket and a single poll loop.
+/// ICMP sequence numbers are shared across targets, so replies are matched back
+/// to their target by `h_id`/`h_seq` and verified with the source address.
+/// Sends run on their own schedule, so any number of probes can be in flight.
+/// Targets are taken from a shared list as they get resolved: a new target gets
+/// its first probe right away and then joins the regular rounds.
+typedef struct Engine {
+    int sockfd;
+    /// Ping sockets deliver neither IP headers nor foreign packets.
+    IcmpSocketKind kind;
+    IpVersion ip;
+    /// ICMP identifier of all our probes.
+    uint16_t id;
+    TargetList *targets;
+    /// The engine owns targets with `index % n_shards == shard`.
+    size_t shard;
+    size_t n_shards;
+    /// Targets of the list below this index were seen by the engine.
+    size_t n_known;
+    /// Own targets seen so far, and how many of them were sent all `count` probes.
+    size_t n_owned;
+    size_t n_done;
+    EngineOptions opts;
+    /// Next ICMP sequence number on the wire.
+    uint16_t next_seq;
+    /// Replies we still wait for.
+    size_t outstanding;
+    EngineProbe probes[ENGINE_MAX_OUTSTANDING];
+    /// Probe timeouts, ticks are milliseconds since `epoch`.
+    TimerWheel wheel;
+    struct timespec epoch;
+    /// Receive ring used when more than one reply is pending, its first slot serves single receives too.
+    /// Buffers fit a reply with the whole payload.
+    IcmpRecvSlot ring[ICMP_BATCH_MAX];
+    /// Whether kernel timestamping is enabled on the socket.
+    bool kernel_ts;
+    /// Whether packets go through `uring`, if the kernel has no `io_uring` plain syscalls are used.
+    bool io_uring;
+    Uring uring;
+    /// Whether replies are read from `packet`, the ICMP socket then only sends.
+    bool packet_ring;
+    PacketRing packet;
+    /// `CLOCK_REALTIME` ahead of `CLOCK_MONOTONIC_RAW` in nanoseconds, sampled before every ring read.
+    long long clock_offset;
+    /// Number of packets sent since timestamping was enabled, matches TX timestamp ids.
+    uint32_t tx_id;
+    /// Wire sequence number of every TX timestamp id (modulo 65536).
+    uint16_t tx_seqs[UINT16_MAX + 1];
+    IcmpTxTimestamp tx_stamps[ICMP_BATCH_MAX];
+    engine_reply_cb on_reply;
+    /// Every probe and its outcome is appended to it (optional).
+    Recorder *recorder;
+    /// Called right before the loop blocks waiting for packets (optional).
+    engine_idle_cb on_idle;
+    /// Called once for every own target when the engine first sees it (optional).
+    engine_target_cb on_target;
+    void *ctx;
+    /// Set by `engine_stop`, checked once per loop iteration.
+    volatile sig_atomic_t stop;
+    /// Event file `engine_stop` wakes the loop with, even from another thread.
+    int wakefd;
+    /// How late the loop got going after every deadline it waited for (sends, timeouts), in nanoseconds.
+    Histogram lag;
+} Engine;
+
+/// Prepare engine to ping its shard of `targets` through `sockfd` (raw or ping socket).
+/// The list may still be growing, it is watched for new targets.
+/// For ping sockets `id` must be the identifier the socket is bound to,
+/// raw sockets get a kernel filter that drops everything not addressed to `id`.
+/// Socket is switched to non-blocking mode.
+/// With `EngineOptions.transport` the socket is not used at all and may be -1.
+/// If kernel timestamps are requested but not supported, `kernel_ts` stays false
+/// and RTT is measured in user space.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int engine_init(
+    Engine *self, int sockfd, IpVersion ip, uint16_t id,
+    TargetList *targets, size_t shard, size_t n_shards, const EngineOptions *opts,
+    engine_reply_cb on_reply, void *ctx
+);
+
+/// Send one echo request to every own target that wasn't sent all `count` probes yet.
+/// Several targets are sent with batched `sendmmsg` calls.
+IcmpResult engine_send_round(Engine *self);
+
+/// Receive and dispatch all replies that are already queued on the socket (non-blocking).
+/// While more than one reply is pending, replies are drained with batched `recvmmsg` calls.
+IcmpResult engine_recv(Engine *self);
+
+/// Main loop: send a round every `interval` and dispatch replies as they arrive.
+/// Probes without a reply in `timeout` are counted as lost as soon as it elapses.
+/// Returns after the last round to the last target once all replies arrived or timed out
+/// (one more second without a timeout), once the deadline passed, or as soon as
+/// `engine_stop` was called.
+IcmpResult engine_run(Engine *self);
+
+/// Ask `engine_run` to return. Async-signal-safe and callable from any thread.
+void engine_stop(Engine *self);
+
+/// Release receive buffers and rings of the engine, the socket is left to the caller.
+void engine_free(Engine *self);
+
+#endif
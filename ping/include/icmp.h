@@ -1,15 +1,18 @@
 #ifndef PING_ICMP_H_
 #define PING_ICMP_H_
 
+#include <arpa/inet.h>
 #include <netinet/icmp6.h>
 #include <netinet/ip_icmp.h>
 #include <stdbool.h>
+#include <sys/socket.h>
+#include <time.h>
 
-/// Returns IPv4 checksum according to RFC 1071.
-uint16_t in_cksum(const char *addr, size_t size, uint16_t start);
+#include "cksum.h"
 
 /// Icmp header with payload section containing creation timestamp.
-/// Fields are always in native byte order and are converted internally before sending/after receiving.
+/// Header fields are in network byte order, as on the wire: received packets are never converted,
+/// `IcmpView` accessors read them.
 typedef struct IcmpPacket {
     struct icmphdr header;
 #define h_type header.type
@@ -31,45 +34,318 @@ typedef enum IcmpResult {
     IcmpRecvFromErr = -2,
     IcmpInvalidIpCksumErr = -3,
     IcmpInvalidIcmpCksumErr = -4,
+    IcmpNoReplyErr = -5,
+    IcmpMalformedErr = -6,
 } IcmpResult;
 
+/// Kind of the ICMP socket.
+typedef enum IcmpSocketKind {
+    /// Ping socket if the user is allowed to open it, raw socket otherwise.
+    IcmpSockAuto = 0,
+    /// Raw socket, requires `CAP_NET_RAW` and receives every ICMP packet of the host.
+    IcmpSockRaw = 1,
+    /// Linux ping socket (`SOCK_DGRAM`), allowed by `net.ipv4.ping_group_range`.
+    /// Kernel assigns the id, computes checksums and delivers only our replies without IP header.
+    IcmpSockDgram = 2,
+} IcmpSocketKind;
+
+/// Maximum number of packets sent or received with a single batched syscall.
+#define ICMP_BATCH_MAX (64)
+/// How many of our own echo requests (seen on loopback) single-packet receive skips before giving up.
+#define ICMP_RECV_MAX_SKIP (16)
+/// Size of a single receive buffer of the batched receive ring, enough for echo replies without payload.
+#define ICMP_RECV_BUF_LEN (128)
+
+/// Space for ancillary data of a received packet: kernel timestamps, IPv6 packet info
+/// (`struct in6_pktinfo`, hidden without `_GNU_SOURCE`) and hop limit.
+#define ICMP_CONTROL_LEN ( \
+    CMSG_SPACE(3 * sizeof(struct timespec)) + \
+    CMSG_SPACE(sizeof(struct in6_addr) + sizeof(unsigned int)) + \
+    CMSG_SPACE(sizeof(int)) \
+)
+
+/// Kernel timestamps of a packet (`CLOCK_REALTIME` based), zeroed when not available.
+typedef struct IcmpTimestamp {
+    /// Software timestamp taken by the network stack.
+    struct timespec sw;
+    /// Raw hardware timestamp taken by the NIC.
+    struct timespec hw;
+} IcmpTimestamp;
+
+/// IPv6 header fields of a reply, delivered as ancillary data: ICMPv6 sockets don't see the IP header.
+typedef struct Icmp6Info {
+    /// Address the reply was sent to, i.e. the source address the kernel picked for the probe.
+    struct in6_addr dst;
+    /// Hop limit of the reply, -1 if unknown.
+    int hop_limit;
+} Icmp6Info;
+
+/// Transmit timestamp read from the socket error queue.
+typedef struct IcmpTxTimestamp {
+    /// Number of the packet sent through the socket since timestamping was enabled.
+    uint32_t id;
+    IcmpTimestamp ts;
+} IcmpTxTimestamp;
+
+/// Read-only view of a received ICMP packet: bounds-checked pointers into the receive buffer.
+/// The buffer is never written, so views can point into shared memory (batched and mapped rings).
+/// Pointers are bounded to the buffer lifetime.
+typedef struct IcmpView {
+    /// IPv4 header, NULL if the socket doesn't deliver one (IPv6 and ping sockets).
+    const struct iphdr *ip4;
+    /// ICMP header, `icmp_len` bytes of message start at it.
+    const IcmpPacket *icm;
+    /// Length of the ICMP message, at least the 8-byte header (`ts_creation` is there only if it fits).
+    size_t icmp_len;
+} IcmpView;
+
+/// `icmp_view_parse` flag: don't verify the IPv4 header checksum, for packets from a socket
+/// (the kernel drops ones with a bad header before any socket sees them).
+#define ICMP_VIEW_SKIP_IP_CKSUM (1u << 0)
+
+static inline uint8_t icmp_view_type(const IcmpView *self) {
+    return self->icm->h_type;
+}
+
+static inline uint8_t icmp_view_code(const IcmpView *self) {
+    return self->icm->h_code;
+}
+
+static inline uint16_t icmp_view_id(const IcmpView *self) {
+    return ntohs(self->icm->h_id);
+}
+
+static inline uint16_t icmp_view_seq(const IcmpView *self) {
+    return ntohs(self->icm->h_seq);
+}
+
+/// Return: TTL of the IPv4 header, -1 without one.
+static inline int icmp_view_ttl(const IcmpView *self) {
+    return self->ip4 != NULL ? self->ip4->ttl : -1;
+}
+
+/// Return: length of the packet: the ICMP message and the IPv4 header, if there is one.
+static inline size_t icmp_view_len(const IcmpView *self) {
+    return self->icmp_len + (self->ip4 != NULL ? (size_t)self->ip4->ihl * sizeof(int32_t) : 0);
+}
+
+/// Slot of the batched receive ring: buffer, source address and parse result of one packet.
+/// Packets are bounded to the `buf` lifetime.
+typedef struct IcmpRecvSlot {
+    /// Receive buffer of `cap` bytes, see `icmp_recv_ring_init`.
+    u_char *buf;
+    size_t cap;
+    u_char control[ICMP_CONTROL_LEN];
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    /// Receive timestamp, set only if timestamping is enabled on the socket.
+    IcmpTimestamp ts;
+    /// Set only for IPv6 sockets.
+    Icmp6Info info6;
+    /// Bytes received into `buf`.
+    size_t len;
+    /// Parsed packet, valid only if `res` is `IcmpOk`.
+    IcmpView view;
+    IcmpResult res;
+} IcmpRecvSlot;
+
+/// Echo reply or ICMP error quoting one of our echo requests, as traceroute-like probing sees it.
+typedef struct IcmpProbeReply {
+    uint8_t type;
+    uint8_t code;
+    /// Identifier and sequence number of the answered echo request (native byte order).
+    uint16_t id;
+    uint16_t seq;
+    /// Next-hop MTU of Fragmentation Needed or Packet Too Big, 0 for anything else (or if the router didn't tell).
+    uint32_t mtu;
+} IcmpProbeReply;
+
 typedef struct icmp_func_set {
     IcmpPacket *(*new_echo4_req)(uint16_t, uint16_t);
-    IcmpPacket *(*new_echo6_req)(struct in6_addr, struct in6_addr, uint16_t, uint16_t);
+    IcmpPacket *(*new_echo6_req)(uint16_t, uint16_t);
+    void (*echo4_template)(IcmpPacket *, uint16_t);
+    void (*echo6_template)(IcmpPacket *, uint16_t);
+    void (*echo_update)(IcmpPacket *, uint16_t, const struct timespec *);
     IcmpResult (*send)(const IcmpPacket *, int, const struct sockaddr_storage *);
-    IcmpResult (*recv4)(struct iphdr **, IcmpPacket **, int, u_char *, int, struct sockaddr_storage *, socklen_t *);
-    IcmpResult (*recv6)(IcmpPacket **, int, u_char *, int, struct sockaddr_storage *, socklen_t *);
+    IcmpResult (*recv4)(IcmpView *, int, u_char *, int, struct sockaddr_storage *, socklen_t *);
+    IcmpResult (*recv6)(IcmpView *, int, u_char *, int, struct sockaddr_storage *, socklen_t *);
+    IcmpResult (*recv_dgram)(IcmpView *, int, u_char *, int, struct sockaddr_storage *, socklen_t *);
+    IcmpResult (*send_batch)(const IcmpPacket *const *, const struct sockaddr_storage *const *, size_t, int, size_t *);
+    IcmpResult (*send_batch_payload)(
+        const IcmpPacket *const *, const struct sockaddr_storage *const *, const u_char *, size_t, size_t, int, size_t *
+    );
+    IcmpResult (*recv4_batch)(IcmpRecvSlot *, size_t, int, size_t *);
+    IcmpResult (*recv6_batch)(IcmpRecvSlot *, size_t, int, size_t *);
+    IcmpResult (*recv_dgram_batch)(IcmpRecvSlot *, size_t, int, size_t *);
+    IcmpResult (*recv_tx_ts)(IcmpTxTimestamp *, size_t, int, size_t *);
+    IcmpResult (*parse)(IcmpView *, IcmpSocketKind, IpVersion, const u_char *, size_t, unsigned);
+    void (*parse_batch)(IcmpRecvSlot *, size_t, IcmpSocketKind, IpVersion, unsigned);
     const char *(*strerror)(IcmpResult);
-    const char *(*to_str_pretty)(const IcmpPacket *);
 } icmp_func_set;
 
 extern const icmp_func_set icmp_func;
 
+/// Open ICMP socket of the IP version.
+/// For ping sockets `id` is set to the identifier the kernel bound the socket to,
+/// for raw sockets it is left untouched.
+/// IPv6 sockets deliver destination address and hop limit of replies as ancillary data,
+/// raw ones also pass only echo replies and errors (`ICMP6_FILTER`), so neighbor discovery
+/// and router advertisements never reach us.
+/// Return: socket, on error, -1 is returned, and errno is set.
+int icmp_socket(IpVersion ip, IcmpSocketKind kind, uint16_t *id);
+
+/// Return: kind of the opened ICMP socket (never `IcmpSockAuto`).
+IcmpSocketKind icmp_socket_kind(int sockfd);
+
+/// Attach classic BPF program to the raw socket that passes only echo replies with our `id`
+/// and ICMP errors quoting our echo request. Everything else is dropped in the kernel.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_attach_filter(int sockfd, IpVersion ip, uint16_t id);
+
+/// Attach classic BPF program that drops every packet, for sockets used only to send.
+/// Error queue (TX timestamps) is not filtered.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_attach_drop_filter(int sockfd);
+
 /// Return: Icmp Echo request struct base on IPv4 with timestamp in payload.
 IcmpPacket *new_echo4_request(uint16_t id, uint16_t seq);
 
 /// Return: Icmp Echo request struct based on IPv6 with timestamp in payload.
-/// There is need for `src` and `dest` because they are used to calculate checksum.
-IcmpPacket *new_echo6_request(struct in6_addr src, struct in6_addr dest, uint16_t id, uint16_t seq);
+/// Checksum is left zero, the kernel computes it for ICMPv6 sockets.
+IcmpPacket *new_echo6_request(uint16_t id, uint16_t seq);
+
+/// Build reusable IPv4 Icmp Echo request in place with zero sequence number and timestamp.
+/// Checksum is complete, so probes only need `icmp_echo_update`.
+void icmp_echo4_template(IcmpPacket *self, uint16_t id);
+
+/// Build reusable IPv6 Icmp Echo request in place, see `icmp_echo4_template`.
+/// Checksum is left zero: it covers the source address the kernel picks at send time, so the kernel fills it.
+void icmp_echo6_template(IcmpPacket *self, uint16_t id);
+
+/// Patch sequence number and creation timestamp of the echo request in place.
+/// IPv4 checksum is updated incrementally, no allocation or full checksum pass is made.
+void icmp_echo_update(IcmpPacket *self, uint16_t seq, const struct timespec *ts);
 
 /// Send Icmp packet to socket with specified IP address.
 /// Return: number of bytes sent, on error, -1 is returned, and errno is set.
 IcmpResult icmp_send(const IcmpPacket *self, int sockfd, const struct sockaddr_storage *addr);
 
-/// Recieve IPv4-ICMPv4 packet from socket (blocking) and verify checksum.
-/// IPv4 and ICMPv4 packets are bounded to the `buf` lifetime.
+/// Recieve IPv4-ICMPv4 packet from socket (blocking) into `buf` and verify ICMP checksum.
+/// Our own echo requests are skipped, at most `ICMP_RECV_MAX_SKIP` times (then `IcmpNoReplyErr`).
+/// `view` is bounded to the `buf` lifetime.
 IcmpResult recv_ip4_icmp(
-    struct iphdr **ip, IcmpPacket **icm, int sockfd, u_char buf[], int buf_len,
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
     struct sockaddr_storage *addr, socklen_t *addr_len
 );
 
-/// Recieve IPv6-ICMPv6 packet from socket (blocking) and verify checksum.
-/// IPv6 and ICMPv6 packets are bounded to the `buf` lifetime.
+/// Recieve IPv6-ICMPv6 packet from socket (blocking), the kernel has already verified checksum.
+/// Our own echo requests are skipped, at most `ICMP_RECV_MAX_SKIP` times (then `IcmpNoReplyErr`).
+/// `view` is bounded to the `buf` lifetime.
 IcmpResult recv_ip6_icmp(
-    IcmpPacket **icm, int sockfd, u_char buf[], int buf_len,
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
     struct sockaddr_storage *addr, socklen_t *addr_len
 );
 
+/// Recieve ICMPv4 or ICMPv6 packet from a ping socket (blocking).
+/// There is no IP header and the kernel has already verified checksums.
+/// `view` is bounded to the `buf` lifetime.
+IcmpResult recv_dgram_icmp(
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
+    struct sockaddr_storage *addr, socklen_t *addr_len
+);
+
+/// Send `n` Icmp packets with a single `sendmmsg`, `addrs[i]` is the destination of `packets[i]`.
+/// Packets are sent in chunks of `ICMP_BATCH_MAX`, `sent` is set to the number of packets sent.
+/// On error, `IcmpSendToErr` is returned, errno is set, and `sent` is the index of the packet that failed.
+IcmpResult icmp_send_batch(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], size_t n,
+    int sockfd, size_t *sent
+);
+
+/// Same as `icmp_send_batch`, but `packets[i]` leaves with TTL (hop limit for IPv6) `ttls[i]`.
+IcmpResult icmp_send_batch_ttl(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], const uint8_t ttls[],
+    size_t n, int sockfd, size_t *sent
+);
+
+/// Same as `icmp_send_batch`, but `packets[i]` is padded with zeros to an ICMP message of `lens[i]` bytes
+/// (lengths below `sizeof(IcmpPacket)` send it as is). Padding doesn't change the checksum.
+IcmpResult icmp_send_batch_len(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], const uint16_t lens[],
+    size_t n, int sockfd, size_t *sent
+);
+
+/// Same as `icmp_send_batch`, but every packet is followed by the same `payload_len` bytes of `payload`,
+/// sent straight from there as a second iovec. Checksums of IPv4 packets must already cover it.
+IcmpResult icmp_send_batch_payload(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[],
+    const u_char payload[], size_t payload_len, size_t n, int sockfd, size_t *sent
+);
+
+/// Set Don't Fragment on every packet sent through the socket, ignoring the path MTU the kernel cached.
+/// Packets larger than the interface MTU fail with `EMSGSIZE`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_set_dont_fragment(int sockfd, IpVersion ip);
+
+/// Give every of the `n` slots a receive buffer of `buf_len` bytes, all of them in a single allocation.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_recv_ring_init(IcmpRecvSlot slots[], size_t n, size_t buf_len);
+
+/// Free buffers of the slots set up by `icmp_recv_ring_init`.
+void icmp_recv_ring_free(IcmpRecvSlot slots[]);
+
+/// Fill up to `n` slots with a single `recvmmsg` (non-blocking), packets are left unparsed (`icm` is not set).
+/// `received` is set to the number of filled slots.
+/// On error (including no packets available), `IcmpRecvFromErr` is returned, and errno is set.
+IcmpResult icmp_recv_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received);
+
+/// Receive up to `n` IPv4-ICMPv4 packets into the `slots` ring with a single `recvmmsg` (non-blocking)
+/// and parse them with `icmp_view_parse_batch`. Our own echo requests are not filtered out.
+/// `received` is set to the number of filled slots.
+/// On error (including no packets available), `IcmpRecvFromErr` is returned, and errno is set.
+IcmpResult recv_ip4_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received);
+
+/// Same as `recv_ip4_icmp_batch` for IPv6-ICMPv6 packets.
+IcmpResult recv_ip6_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received);
+
+/// Same as `recv_ip4_icmp_batch` for ping sockets, see `recv_dgram_icmp`.
+IcmpResult recv_dgram_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received);
+
+/// Parse packet of `len` bytes received through a socket of `kind` and `ip` version (or its IP payload
+/// for IPv6 off a link-layer ring) into `view` without writing to `buf`. Headers are bounds-checked
+/// against `len` and the IPv4 total length; ICMPv4 checksum is verified over the whole message,
+/// and the IPv4 header one unless `flags` has `ICMP_VIEW_SKIP_IP_CKSUM`.
+/// Return: `IcmpOk`, checksum error, or `IcmpMalformedErr` if headers don't fit the buffer.
+IcmpResult icmp_view_parse(
+    IcmpView *view, IcmpSocketKind kind, IpVersion ip, const u_char buf[], size_t len, unsigned flags
+);
+
+/// Parse the first `n` filled slots, see `icmp_view_parse`: every slot gets its own `view` and `res`.
+void icmp_view_parse_batch(IcmpRecvSlot slots[], size_t n, IcmpSocketKind kind, IpVersion ip, unsigned flags);
+
+/// Parse packet of `len` bytes received through a raw socket of `ip` version without modifying it:
+/// echo reply, or error (time exceeded, destination unreachable, ...) quoting the echo request it answers.
+/// IPv4 checksums are verified, ICMP one only if the whole error was received.
+/// Return: `IcmpOk`, checksum error, or `IcmpNoReplyErr` if it is anything else.
+IcmpResult icmp_parse_probe_reply(IpVersion ip, const u_char buf[], size_t len, IcmpProbeReply *reply);
+
+/// Extract kernel timestamps from the `SCM_TIMESTAMPING` control message of `msg`, zeroed if there is none,
+/// and IPv6 packet info and hop limit into `info6` (optional).
+void icmp_read_control(struct msghdr *msg, IcmpTimestamp *ts, Icmp6Info *info6);
+
+/// Enable kernel software (and hardware, if the NIC has it turned on) RX and TX timestamps.
+/// TX timestamps are numbered in send order and delivered through the socket error queue.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_enable_timestamping(int sockfd);
+
+/// Read up to `n` transmit timestamps from the socket error queue with a single `recvmmsg` (non-blocking).
+/// `received` is set to the number of filled entries.
+/// On error (including empty queue), `IcmpRecvFromErr` is returned, and errno is set.
+IcmpResult icmp_recv_tx_timestamps(IcmpTxTimestamp stamps[], size_t n, int sockfd, size_t *received);
+
+/// Return: true if the kernel filled the timestamp.
+bool icmp_timestamp_valid(const struct timespec *ts);
+
 /// Return: string describing error number.
 const char *icmp_strerror(IcmpResult res);
 
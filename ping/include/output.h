@@ -0,0 +1,82 @@
+#ifndef PING_OUTPUT_H_
+#define PING_OUTPUT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "engine.h"
+#include "pmtu.h"
+#include "target.h"
+#include "trace.h"
+
+/// Size of the output buffer, it is flushed once it can't fit another record.
+#define OUTPUT_BUF_LEN (64 * 1024)
+/// Replies are flushed once the buffer is filled that much, so every `write`
+/// carries whole records even when several outputs share the file descriptor.
+#define OUTPUT_FLUSH_LEN (OUTPUT_BUF_LEN / 2)
+/// Longest preformatted (colored) separator.
+#define OUTPUT_SEP_LEN (80)
+
+typedef enum OutputFormat {
+    /// Human readable text, optionally colored.
+    FmtText = 0,
+    /// One JSON object per line.
+    FmtJson = 1,
+    /// Comma-separated values with a header line.
+    FmtCsv = 2,
+} OutputFormat;
+
+/// Buffered writer for replies and statistics. Nothing is allocated after `output_init`:
+/// colored separators are formatted once and records are written into a reusable buffer
+/// that is flushed in batches.
+typedef struct Output {
+    int fd;
+    OutputFormat format;
+    uint verbosity;
+    bool flood;
+    /// Color escape codes, empty strings when output is not colored.
+    const char *clr_underline;
+    const char *clr_reset;
+    char sep_greeting[OUTPUT_SEP_LEN];
+    char sep_stats[OUTPUT_SEP_LEN];
+    char sep_header[OUTPUT_SEP_LEN];
+    char sep_line[OUTPUT_SEP_LEN];
+    char name[OUTPUT_SEP_LEN];
+    size_t len;
+    char buf[OUTPUT_BUF_LEN];
+} Output;
+
+/// Prepare output to `fd`. In flood mode text output has no reply lines.
+void output_init(Output *self, int fd, OutputFormat format, bool color, uint verbosity, bool flood);
+
+/// Write buffered records to the file descriptor.
+void output_flush(Output *self);
+
+/// Greeting message and format header (CSV), printed before the main loop.
+void output_greeting(Output *self);
+
+/// Line announcing the target.
+void output_target(Output *self, const Target *target, size_t data_len);
+
+/// Record of a matched reply (and its headers in verbose text mode).
+void output_reply(Output *self, const EngineReply *reply);
+
+/// Statistics block with the `name` header.
+void output_stats(Output *self, const char *name, const TargetStats *stats);
+
+/// How late the loop got going after its deadlines (`lag`, see `Engine.lag`) next to how late
+/// plain sleeps woke up before the `--low-jitter` tuning (`baseline`). Both are scheduling
+/// lateness of this process, not jitter of the RTT.
+void output_lag(Output *self, const Histogram *lag, const Histogram *baseline);
+
+/// Hop table of the traced path (text), or a record per hop of the current round (JSON, CSV).
+/// Return: number of lines written.
+size_t output_trace(Output *self, const Tracer *tracer, const TracePath *path);
+
+/// Path MTU of the target, or the range it is in if the search didn't finish.
+void output_pmtu(Output *self, const PmtuProber *prober, const PmtuPath *path);
+
+/// Move the cursor `lines` up and clear everything below, so a table is redrawn in place.
+void output_rewind(Output *self, size_t lines);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef PING_PACKET_H_
+#define PING_PACKET_H_
+
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+
+/// Size of a ring block, frames are handed over to user space a block at a time.
+#define PACKET_BLOCK_SIZE (1 << 18)
+#define PACKET_BLOCK_NR (16)
+/// Largest frame, only used to size the ring.
+#define PACKET_FRAME_SIZE (2048)
+/// Largest reply the ring is used for, the Ethernet MTU: the ring sees packets before reassembly,
+/// so bigger replies would only show up as fragments.
+#define PACKET_MTU (1500)
+/// Milliseconds after which a partially filled block is handed over anyway.
+#define PACKET_BLOCK_TIMEOUT_MS (1)
+
+/// Echo reply viewed right in a ring block (never written), bounded to the `packet_ring_read` callback.
+typedef struct PacketFrame {
+    /// Link-layer header, NULL if the interface has no Ethernet header.
+    const struct ether_header *eth;
+    /// IPv6 header, NULL for IPv4 rings (the IPv4 one is in `view`).
+    const struct ip6_hdr *ip6;
+    IcmpView view;
+    struct sockaddr_storage from;
+    /// Time the kernel captured the frame (`CLOCK_REALTIME`), hardware one if the NIC stamps packets.
+    IcmpTimestamp ts;
+} PacketFrame;
+
+typedef void (*packet_frame_cb)(const PacketFrame *frame, void *ctx);
+
+/// `AF_PACKET` socket with a `TPACKET_V3` receive ring, seeing echo replies to `id` on every interface.
+/// Replies are parsed straight out of the shared ring: no copy and no syscall per packet,
+/// and link-layer and IPv6 headers are available, unlike on ICMP sockets.
+typedef struct PacketRing {
+    int fd;
+    IpVersion ip;
+    u_char *map;
+    size_t map_len;
+    /// Next block to read.
+    uint32_t block;
+} PacketRing;
+
+/// Open ring for echo replies of `ip` version to `id`, foreign packets are dropped by a kernel filter.
+/// Needs `CAP_NET_RAW`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int packet_ring_open(PacketRing *self, IpVersion ip, uint16_t id);
+
+/// Pass every valid reply of the blocks the kernel has handed over to `cb` and give the blocks back.
+/// Corrupted packets are dropped.
+void packet_ring_read(PacketRing *self, packet_frame_cb cb, void *ctx);
+
+void packet_ring_close(PacketRing *self);
+
+#endif
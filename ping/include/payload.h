@@ -0,0 +1,53 @@
+#ifndef PING_PAYLOAD_H_
+#define PING_PAYLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "icmp.h"
+
+/// Most data bytes of an IPv4 echo request: the largest IP packet minus IP and ICMP headers.
+#define PAYLOAD_MAX_IP4 (65507)
+/// Most data bytes of an IPv6 echo request: the largest payload minus the ICMPv6 header.
+#define PAYLOAD_MAX_IP6 (65527)
+/// Data bytes every echo request has: the creation timestamp.
+#define PAYLOAD_MIN (sizeof(struct timespec))
+/// Data bytes of echo requests with a fill pattern but no size, as ping(8) sends.
+#define PAYLOAD_DEFAULT (56)
+/// Most bytes of a fill pattern (`-p`).
+#define PAYLOAD_PATTERN_MAX (16)
+
+/// Data of every echo request following its timestamp. The bytes are held once and shared by
+/// all packets: they go out as a second iovec next to the packet and are never copied into it.
+typedef struct IcmpPayload {
+    u_char *data;
+    size_t len;
+    /// Checksum of `data`, folded into IPv4 templates by `payload_apply`.
+    uint16_t cksum;
+} IcmpPayload;
+
+/// Fill `len` bytes with `pattern` repeated (incrementing bytes if `pattern_len` is 0).
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int payload_init(IcmpPayload *self, size_t len, const u_char pattern[], size_t pattern_len);
+
+void payload_free(IcmpPayload *self);
+
+/// Account for the payload in the checksum of echo request template `packet`.
+/// Only IPv4 templates carry a checksum, IPv6 ones are left for the kernel.
+void payload_apply(const IcmpPayload *self, IcmpPacket *packet);
+
+/// Return: size of a receive buffer that holds an echo reply with the payload and any IPv4 header.
+size_t payload_recv_len(const IcmpPayload *self);
+
+/// Compare data of echo reply `view` with what the request carried: timestamp `ts`, then the payload.
+/// Return: offset into the ICMP data of the first byte that differs (or is missing, or is extra),
+/// -1 if the reply is intact.
+long payload_check(const IcmpPayload *self, const IcmpView *view, const struct timespec *ts);
+
+/// Return: index of the first byte that differs in `a` and `b` of `size` bytes, `size` if they are equal.
+/// The fastest implementation supported by the CPU is picked, like `in_cksum` does.
+size_t mem_mismatch(const void *a, const void *b, size_t size);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PING_PMTU_H_
+#define PING_PMTU_H_
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+#include "target.h"
+
+/// Largest packet `--pmtu` probes without an explicit size, covers jumbo frames.
+#define PMTU_DEFAULT_MAX (9000)
+/// Largest IP packet there is.
+#define PMTU_MAX (65535)
+/// Smallest MTU of an IPv4 path (RFC 791).
+#define PMTU_MIN_IP4 (68)
+/// Smallest MTU of an IPv6 link (RFC 8200).
+#define PMTU_MIN_IP6 (1280)
+/// Sizes probed in parallel per target and round, each round narrows the range that many times.
+#define PMTU_PROBES (8)
+
+typedef struct PmtuOptions {
+    /// Largest packet probed, in bytes of the IP packet.
+    uint32_t max_size;
+    /// Milliseconds after which a probe without an answer counts as too big (0 - default).
+    double timeout;
+} PmtuOptions;
+
+/// Path MTU search state of a target, sizes are in bytes of the whole IP packet.
+/// The path MTU is always in `[lo; hi - 1]`.
+typedef struct PmtuPath {
+    Target *target;
+    /// Largest size that got an echo reply, one below the protocol minimum until any did.
+    uint32_t lo;
+    /// Smallest size known not to get through, `max_size + 1` until any didn't.
+    uint32_t hi;
+    /// Search is over: the range is a single size, or nothing got through.
+    bool done;
+    /// Rounds it took.
+    uint32_t rounds;
+    uint32_t sent;
+    uint32_t received;
+    /// Router that reported the smallest next-hop MTU, `ss_family` is 0 if none did.
+    struct sockaddr_storage limit_addr;
+    char limit_ip[INET6_ADDRSTRLEN];
+    /// Next-hop MTU it reported, 0 if it didn't tell.
+    uint32_t limit_mtu;
+} PmtuPath;
+
+/// Probe slot indexed by the ICMP sequence number on the wire.
+typedef struct PmtuProbe {
+    /// Index of the path + 1, 0 means the slot is free.
+    uint32_t path;
+    /// Size of the IP packet.
+    uint32_t size;
+} PmtuProbe;
+
+struct PmtuProber;
+/// Called once for every path, as soon as its search is over (or when stopped).
+typedef void (*pmtu_path_cb)(const struct PmtuProber *prober, const PmtuPath *path, void *ctx);
+
+/// Parallel path MTU discovery. Every round sends `PMTU_PROBES` echo requests with
+/// Don't Fragment set and sizes spread over the unknown range to every target at once.
+/// Echo replies raise the lower bound; Fragmentation Needed / Packet Too Big lower the upper
+/// one straight to the next-hop MTU they report; probes lost for `timeout` lower it to their size.
+/// A range of thousands of sizes resolves in about four rounds.
+typedef struct PmtuProber {
+    /// Raw ICMP socket, ping sockets don't deliver errors as packets.
+    int sockfd;
+    IpVersion ip;
+    uint16_t id;
+    PmtuPath *paths;
+    size_t n_paths;
+    PmtuOptions opts;
+    /// Rounds sent so far.
+    uint32_t rounds;
+    /// Next ICMP sequence number on the wire.
+    uint16_t next_seq;
+    /// Probes we still wait an answer for.
+    size_t outstanding;
+    PmtuProbe probes[UINT16_MAX + 1];
+    IcmpRecvSlot ring[ICMP_BATCH_MAX];
+    /// Set by `pmtu_stop`, checked once per loop iteration.
+    volatile sig_atomic_t stop;
+    pmtu_path_cb on_path;
+    void *ctx;
+} PmtuProber;
+
+/// Discover path MTU of all ready targets of the list through raw socket `sockfd`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int pmtu_init(PmtuProber *self, int sockfd, IpVersion ip, uint16_t id, TargetList *targets, const PmtuOptions *opts);
+
+/// Send rounds until the search is over for every path, or until stopped.
+/// Return: `IcmpOk`, or the error that stopped it (errno is set).
+IcmpResult pmtu_run(PmtuProber *self);
+
+/// Make `pmtu_run` return, safe to call from a signal handler.
+void pmtu_stop(PmtuProber *self);
+
+void pmtu_free(PmtuProber *self);
+
+/// Return: path MTU once the search is over, 0 if nothing got through or it is not over yet.
+uint32_t pmtu_result(const PmtuProber *self, const PmtuPath *path);
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef PING_RECORD_H_
+#define PING_RECORD_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "target.h"
+
+#define RECORD_MAGIC "WTPREC\0\1"
+#define RECORD_VERSION (1)
+/// Length of the zero-terminated source address in the target table.
+#define RECORD_ADDR_LEN (48)
+/// Records preallocated when the file is created, it doubles when full.
+#define RECORD_INITIAL_CAPACITY (1 << 16)
+/// Default ring size (4 GiB of records). Oldest records are overwritten after it.
+#define RECORD_DEFAULT_LIMIT (1U << 27)
+
+/// Outcome of a single probe. Fixed size, stored as is in host byte order.
+typedef struct RecordEntry {
+    /// Send time in nanoseconds since `RecordHeader.start_ns`.
+    uint64_t send_ns;
+    /// Receive time in nanoseconds since `RecordHeader.start_ns`, valid for replies only.
+    uint64_t recv_ns;
+    /// Sequence number of the probe within its target.
+    uint32_t seq;
+    /// Index of the source in the target table.
+    uint32_t target;
+    /// TTL (hop limit) of the reply, 0 if unknown.
+    uint8_t ttl;
+    /// `IcmpResult` of the probe: `IcmpOk` for replies, `IcmpNoReplyErr` while nothing arrived.
+    int8_t result;
+    uint8_t reserved[6];
+} RecordEntry;
+
+/// First page of the file. Target table follows the header, records start at `data_offset`.
+typedef struct RecordHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    /// Records the file has room for, the ring wraps once it can't grow anymore.
+    uint64_t capacity;
+    /// Largest capacity the file may grow to.
+    uint64_t limit;
+    /// Records ever written, the newest one is at `(head - 1) % capacity`.
+    uint64_t head;
+    /// Wall clock time (`CLOCK_REALTIME`) of the record time origin.
+    uint64_t start_ns;
+    uint32_t n_targets;
+    uint32_t addr_len;
+    uint64_t data_offset;
+} RecordHeader;
+
+/// Writer of the memory-mapped record ring. Appending is a plain memory store,
+/// the only syscalls are the rare ones growing the file.
+typedef struct Recorder {
+    int fd;
+    /// Start of the mapping (the header), records follow at `header->data_offset`.
+    RecordHeader *header;
+    RecordEntry *entries;
+    size_t map_len;
+    /// Monotonic time matching `header->start_ns`.
+    struct timespec start;
+} Recorder;
+
+/// Create (truncate) record file at `path` for up to `n_targets` targets,
+/// keeping at most `limit` newest records.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int recorder_open(Recorder *self, const char *path, size_t n_targets, uint64_t limit);
+
+/// Store address of the target with index `index`, targets without one are left blank.
+void recorder_target(Recorder *self, size_t index, const Target *target);
+
+/// Append probe sent at `sent_at` (`CLOCK_MONOTONIC_RAW`) to target with index `target`.
+/// Return: index of the record, to complete it with `recorder_complete`.
+uint64_t recorder_append(Recorder *self, uint32_t target, uint32_t seq, const struct timespec *sent_at);
+
+/// Mark record `index` as replied `rtt` milliseconds after it was sent.
+/// Records already overwritten by the ring are skipped.
+void recorder_complete(Recorder *self, uint64_t index, double rtt, uint8_t ttl);
+
+/// Unmap and close the file. Records stay in the page cache and reach the disk asynchronously.
+void recorder_close(Recorder *self);
+
+/// Reader of a record file with buffered sequential reads, the file is never mapped whole.
+typedef struct RecordReader {
+    int fd;
+    RecordHeader header;
+    /// Source addresses, `header.n_targets` entries of `header.addr_len` bytes.
+    char *addrs;
+    /// Records left to read and index of the next one (oldest first).
+    uint64_t left;
+    uint64_t next;
+} RecordReader;
+
+/// Open record file and validate its header.
+/// Return: 0 on success, on error, -1 is returned, and errno is set (EINVAL for a bad header).
+int record_reader_open(RecordReader *self, const char *path);
+
+/// Read up to `n` next records into `entries`.
+/// Return: number of records read, 0 at the end, on error, -1 is returned, and errno is set.
+ssize_t record_reader_read(RecordReader *self, RecordEntry *entries, size_t n);
+
+/// Return: source address of target `index`.
+const char *record_reader_addr(const RecordReader *self, uint32_t index);
+
+void record_reader_close(RecordReader *self);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef PING_RESOLVE_H_
+#define PING_RESOLVE_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "icmp.h"
+#include "target.h"
+
+/// Most concurrent lookups, resolution is bound by the network, not the CPU.
+#define RESOLVE_MAX_THREADS (32)
+/// Seconds to cache names resolved without a DNS answer with a TTL (`getaddrinfo`, failures).
+#define RESOLVE_DEFAULT_TTL (60)
+/// Names of the hosts file are taken from it once, for good.
+#define RESOLVE_HOSTS_PATH "/etc/hosts"
+
+/// Cached result of a lookup, failures included.
+typedef struct ResolveEntry {
+    struct ResolveEntry *next;
+    /// Owned by the entry.
+    char *hostname;
+    /// 0 or `getaddrinfo` error code.
+    int status;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    /// `CLOCK_MONOTONIC` second the entry becomes stale at, 0 - never (hosts file).
+    time_t expires;
+    /// A thread is looking the name up, others wait for its result instead of querying too.
+    bool resolving;
+} ResolveEntry;
+
+/// Hash table of lookups keyed by hostname (case-insensitive). Entries live as long as the cache.
+typedef struct ResolveCache {
+    pthread_mutex_t lock;
+    /// Signalled whenever a lookup in progress finishes.
+    pthread_cond_t resolved;
+    ResolveEntry **buckets;
+    size_t n_buckets;
+} ResolveCache;
+
+/// Report a hostname that can't be resolved, called from resolver threads.
+typedef void (*resolve_error_cb)(const char *hostname, int status, void *ctx);
+
+/// Pool of threads resolving hostnames concurrently into a target list.
+/// Targets are published as soon as they resolve, out of order.
+/// Lookups go through the cache, and a name is looked up by one thread at a time, so duplicates
+/// in the list cost a single query. The hosts file is read into the cache up front, other names
+/// go through `getaddrinfo`, so every source of nsswitch is honored. DNS is then asked for the
+/// record only to learn its TTL; names without one (other sources, `.local` names of mDNS, failures)
+/// are cached for `RESOLVE_DEFAULT_TTL`. Numeric addresses are never looked up.
+typedef struct Resolver {
+    char **hostnames;
+    size_t n_hostnames;
+    IpVersion ip;
+    TargetList *targets;
+    ResolveCache cache;
+    pthread_t threads[RESOLVE_MAX_THREADS];
+    size_t n_threads;
+    /// Next hostname to take by a thread.
+    _Atomic size_t next;
+    /// Threads still running, the last one finishes the target list.
+    _Atomic size_t running;
+    _Atomic bool stop;
+    resolve_error_cb on_error;
+    void *ctx;
+} Resolver;
+
+/// Start resolving `hostnames` into `targets` in the background.
+/// Return: 0 on success, otherwise error number.
+int resolver_start(
+    Resolver *self, char **hostnames, size_t n_hostnames, IpVersion ip,
+    TargetList *targets, resolve_error_cb on_error, void *ctx
+);
+
+/// Stop taking new hostnames, lookups in progress still finish. Async-signal-safe.
+void resolver_stop(Resolver *self);
+
+/// Wait for all resolver threads (lookups in progress finish first) and free the cache.
+void resolver_join(Resolver *self);
+
+#endif
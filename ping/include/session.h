@@ -0,0 +1,86 @@
+#ifndef PING_SESSION_H_
+#define PING_SESSION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+#include "target.h"
+
+/// Probing session for programs that embed probing instead of running `ping`: its own socket,
+/// targets and statistics, and nothing shared with other sessions, so any number of them can
+/// run in one process. All calls on a session are serialized by its lock, so it can be fed
+/// from one thread and polled from another. No call blocks but `icmp_session_poll` with a timeout,
+/// and none exits the process: errors are returned as -1 with errno set.
+typedef struct IcmpSession IcmpSession;
+
+typedef struct IcmpSessionOptions {
+    IpVersion ip;
+    /// Ping socket where allowed (`IcmpSockAuto`), or a specific kind.
+    IcmpSocketKind kind;
+    /// Milliseconds after which a probe without reply is reported lost (0 - default, 1 second).
+    double timeout;
+} IcmpSessionOptions;
+
+typedef enum IcmpProbeStatus {
+    ProbeReply = 0,
+    /// No reply in `timeout`, late replies are ignored.
+    ProbeTimeout = 1,
+} IcmpProbeStatus;
+
+/// Outcome of a single probe.
+typedef struct IcmpProbeResult {
+    /// Index `icmp_session_add` returned for the target.
+    size_t target;
+    /// Sequence number of the probe within its target, counting from 0.
+    uint32_t seq;
+    IcmpProbeStatus status;
+    /// Round-trip time in milliseconds, 0 if lost.
+    double time;
+    /// TTL or hop limit of the reply, -1 if unknown.
+    int ttl;
+} IcmpProbeResult;
+
+/// Most results kept for `icmp_session_collect`, older ones are dropped once it is full.
+/// The queue starts small and grows up to it only while results pile up.
+#define ICMP_SESSION_RESULTS (UINT16_MAX + 1)
+
+/// Open session with a socket of its own.
+/// Return: session, on error, NULL is returned, and errno is set.
+IcmpSession *icmp_session_new(const IcmpSessionOptions *opts);
+
+/// Add target `name` with resolved address `addr` (see `target_lookup`), the name is copied.
+/// Return: index of the target, on error, -1 is returned, and errno is set.
+long icmp_session_add(IcmpSession *self, const char *name, const struct sockaddr_storage *addr, socklen_t addr_len);
+
+/// Return: socket of the session, readable when `icmp_session_poll` has replies to receive.
+/// It is owned by the session, so it may only be watched (`poll`, `epoll`, ...).
+int icmp_session_fd(const IcmpSession *self);
+
+/// Send one echo request to the target with index `target`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_session_submit(IcmpSession *self, size_t target);
+
+/// Send one echo request to every target, with batched `sendmmsg` calls.
+/// Return: 0 on success, on error, -1 is returned, and errno is set (probes sent before the error stand).
+int icmp_session_submit_all(IcmpSession *self);
+
+/// Receive replies already queued on the socket and expire probes whose timeout elapsed.
+/// With `timeout_ms` above zero it waits that long for the first reply if there are none.
+/// Return: number of results waiting for `icmp_session_collect`, on error, -1 is returned, and errno is set.
+int icmp_session_poll(IcmpSession *self, int timeout_ms);
+
+/// Move up to `n` oldest results to `results`.
+/// Return: number of results moved.
+size_t icmp_session_collect(IcmpSession *self, IcmpProbeResult results[], size_t n);
+
+/// Copy statistics of the target with index `target` to `stats`, release `stats->rtt` with `hist_free`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int icmp_session_stats(IcmpSession *self, size_t target, TargetStats *stats);
+
+/// Close the socket and free the session. Must not be called while other threads use it.
+void icmp_session_free(IcmpSession *self);
+
+#endif
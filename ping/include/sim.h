@@ -0,0 +1,112 @@
+#ifndef PING_SIM_H_
+#define PING_SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+#include "transport.h"
+
+/// Distribution round-trip times of a simulated link are drawn from.
+typedef enum SimDelay {
+    /// Always `rtt`.
+    SimConstant = 0,
+    /// Uniform in `[rtt; rtt + jitter]`.
+    SimUniform = 1,
+    /// Normal with mean `rtt` and standard deviation `jitter`, cut at zero.
+    SimNormal = 2,
+    /// `rtt` plus exponential with mean `jitter`: a long tail of slow replies.
+    SimExponential = 3,
+} SimDelay;
+
+/// Behavior of the path to a simulated host. Times are in milliseconds, probabilities in `[0; 1]`.
+typedef struct SimLink {
+    SimDelay delay;
+    double rtt;
+    double jitter;
+    /// Probe or its reply never comes back.
+    double loss;
+    /// Reply is held back for another `reorder_delay`, so replies sent after it overtake it.
+    double reorder;
+    double reorder_delay;
+    /// Reply arrives twice, the copy with a delay of its own.
+    double duplicate;
+    /// Probe is answered with Destination Unreachable instead of an echo reply.
+    double error;
+    /// TTL (hop limit) of replies.
+    uint8_t ttl;
+} SimLink;
+
+/// What the simulated network did, to check engine statistics against.
+typedef struct SimStats {
+    uint64_t sent;
+    uint64_t lost;
+    /// Echo replies scheduled, duplicates not included.
+    uint64_t replied;
+    uint64_t reordered;
+    uint64_t duplicated;
+    uint64_t errors;
+    /// Packets handed to the receiver, duplicates and errors included.
+    uint64_t delivered;
+} SimStats;
+
+/// Reply or error on its way back, delivered once the clock reaches `at`.
+typedef struct SimEvent {
+    uint64_t at;
+    /// Send order, keeps events due at the same time in order.
+    uint64_t order;
+    /// Route the reply comes from.
+    uint32_t route;
+    bool error;
+    /// Echo request as it was sent, and the payload that followed it.
+    IcmpPacket packet;
+    const u_char *payload;
+    size_t payload_len;
+} SimEvent;
+
+/// Host of the simulated network.
+typedef struct SimRoute {
+    struct sockaddr_storage addr;
+    SimLink link;
+} SimRoute;
+
+/// In-process network answering echo requests on a virtual clock, for tests and benchmarks that
+/// need neither privileges nor a network. Every send schedules its reply (or nothing, or an error)
+/// on a heap ordered by arrival time; waiting just moves the clock to the next arrival, so hours
+/// of probing run as fast as the engine goes. All randomness comes from a seeded generator, so the
+/// same seed and the same sends give the same replies at the same times. Not thread-safe.
+typedef struct SimNet {
+    IpVersion ip;
+    /// Virtual time in nanoseconds.
+    uint64_t now;
+    uint64_t rng;
+    /// Link of hosts without a route of their own.
+    SimLink default_link;
+    SimRoute *routes;
+    size_t n_routes;
+    /// Open addressing table of `routes` indices + 1 by address, 0 is an empty slot.
+    uint32_t *index;
+    size_t index_cap;
+    SimEvent *events;
+    size_t n_events;
+    size_t cap_events;
+    uint64_t next_order;
+    SimStats stats;
+} SimNet;
+
+/// Empty network of the `ip` version, every host is reached through `link` until it gets its own.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int sim_init(SimNet *self, IpVersion ip, const SimLink *link, uint64_t seed);
+
+/// Route packets to `addr` through `link`, replacing its previous one.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int sim_route(SimNet *self, const struct sockaddr_storage *addr, const SimLink *link);
+
+/// Return: transport of the engine backed by the network (see `EngineOptions.transport`).
+Transport sim_transport(SimNet *self);
+
+void sim_free(SimNet *self);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PING_STATS_H_
+#define PING_STATS_H_
+
+#include <stdint.h>
+
+/// Every power of two is split into 2^HIST_SUB_BITS linear sub-buckets,
+/// so a value is off by at most 1/2^HIST_SUB_BITS (~3%) of itself.
+#define HIST_SUB_BITS (5)
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+/// Largest recorded value is 2^HIST_MAX_BITS - 1 nanoseconds (~68 seconds), bigger ones are clamped.
+#define HIST_MAX_BITS (36)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/// Streaming log-bucketed (HDR-style) latency histogram in nanoseconds.
+/// Recording is amortized O(1) and histograms can be merged, so per-target or per-thread histograms
+/// can be combined into one. Buckets only cover the range of values seen, a power of two
+/// at a time: RTTs of one host take a few hundred bytes, not all `HIST_BUCKETS` counters.
+/// The price is an allocation whenever a sample widens that range, on the reply path: at most
+/// once per power of two, so a histogram allocates no more than `HIST_MAX_BITS` times in its life.
+/// A zeroed histogram is empty, once it has samples it must be released with `hist_free`.
+typedef struct Histogram {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    /// Sum and sum of squares in milliseconds for mean and standard deviation.
+    double sum;
+    double sum_sq;
+    /// Sum of absolute differences between consecutive samples in milliseconds.
+    double jitter_sum;
+    uint64_t jitter_count;
+    /// Previous sample, used for jitter.
+    uint64_t last;
+    /// Counts of buckets `lo` to `lo + n_buckets - 1`, NULL until the first sample.
+    uint32_t *buckets;
+    uint32_t lo;
+    uint32_t n_buckets;
+} Histogram;
+
+/// Reset histogram to the empty state, its buckets (if any) must have been released.
+void hist_init(Histogram *self);
+
+/// Record sample `ns` nanoseconds long, allocating buckets if it is out of the range seen so far.
+/// If they can't be allocated, the sample counts everywhere but in percentiles.
+void hist_record(Histogram *self, uint64_t ns);
+
+/// Add all samples of `other` to the histogram, with the same caveat as `hist_record`.
+void hist_merge(Histogram *self, const Histogram *other);
+
+/// Return: value (nanoseconds) at or below which `perc` percent of samples lie, 0 if empty.
+uint64_t hist_percentile(const Histogram *self, double perc);
+
+/// Return: mean in milliseconds.
+double hist_mean(const Histogram *self);
+
+/// Return: standard deviation (`mdev`) in milliseconds.
+double hist_stddev(const Histogram *self);
+
+/// Return: mean absolute difference of consecutive samples in milliseconds.
+double hist_jitter(const Histogram *self);
+
+/// Release buckets of the histogram and reset it to the empty state.
+void hist_free(Histogram *self);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef PING_TARGET_H_
+#define PING_TARGET_H_
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "icmp.h"
+#include "stats.h"
+
+/// Per-target statistics printed at the end of execution.
+typedef struct TargetStats {
+    uint sent;
+    uint received;
+    /// Round-trip times of all received replies.
+    Histogram rtt;
+} TargetStats;
+
+/// Single host we are pinging. Every target has its own statistics block.
+typedef struct Target {
+    const char *hostname;
+    /// Position of the hostname in the input, targets are resolved out of order.
+    size_t order;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    /// Numeric representation of `addr`.
+    char ip_str[INET6_ADDRSTRLEN];
+    /// Echo request template, every probe only patches sequence number and timestamp in it.
+    IcmpPacket packet;
+    /// Probes sent to the target so far (failed sends included), the next per-target sequence number.
+    uint32_t next_seq;
+    TargetStats stats;
+} Target;
+
+/// Resolve `hostname` to the first address of the `ip` family with `getaddrinfo`.
+/// Return: 0 on success, otherwise `getaddrinfo` error code (see `gai_strerror`).
+int target_lookup(const char *hostname, IpVersion ip, struct sockaddr_storage *addr, socklen_t *addr_len);
+
+/// Initialize target of the resolved `hostname`.
+void target_init(Target *self, const char *hostname, size_t order, const struct sockaddr_storage *addr, socklen_t addr_len);
+
+/// Return: true if `addr` is the address of the target.
+bool target_addr_eq(const Target *self, const struct sockaddr_storage *addr);
+
+/// Most threads that can watch a target list.
+#define TARGET_LIST_MAX_WATCHERS (1024)
+
+/// Targets published by resolver threads while engines already probe them.
+/// Storage is preallocated, so published targets never move. Items below `ready`
+/// are handed over to the engines and are not touched by the resolver anymore.
+typedef struct TargetList {
+    Target *items;
+    size_t capacity;
+    _Atomic size_t ready;
+    /// Set once no more targets will be published.
+    _Atomic bool done;
+    /// Serializes publishers, readers only load `ready`.
+    pthread_mutex_t lock;
+    /// Event files signalled on every publish.
+    int watchers[TARGET_LIST_MAX_WATCHERS];
+    size_t n_watchers;
+} TargetList;
+
+/// Allocate storage for `capacity` targets.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int target_list_init(TargetList *self, size_t capacity);
+
+/// Signal event file `fd` whenever targets are published or the list is done.
+void target_list_watch(TargetList *self, int fd);
+
+/// Copy target to the end of the list and wake watchers. Thread-safe.
+void target_list_push(TargetList *self, const Target *target);
+
+/// Mark the list as complete and wake watchers.
+void target_list_finish(TargetList *self);
+
+/// Return: number of targets published so far, all of them are safe to read.
+static inline size_t target_list_ready(TargetList *self) {
+    return atomic_load_explicit(&self->ready, memory_order_acquire);
+}
+
+/// Return: true if no more targets will be published.
+static inline bool target_list_done(TargetList *self) {
+    return atomic_load_explicit(&self->done, memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PING_TIME_UTIL_H_
+#define PING_TIME_UTIL_H_
+
+#include <time.h>
+
+#define MILLIS_IN_SEC (1000)
+#define NANOS_IN_MICRO (1000)
+#define NANOS_IN_MILLI (1000000)
+#define NANOS_IN_SEC (1000000000L)
+
+/// Convert nanoseconds to milliseconds.
+#define NS_TO_MS(ns) ((double)(ns) / NANOS_IN_MILLI)
+
+/// Calculate time between `start` and `end` in milliseconds with precision.
+static inline double calc_time(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * MILLIS_IN_SEC +
+        (double)(end->tv_nsec - start->tv_nsec) / NANOS_IN_MILLI;
+}
+
+/// Return: `ts` shifted by `ns` nanoseconds (may be negative).
+static inline struct timespec ts_add_ns(struct timespec ts, long long ns) {
+    ts.tv_sec += ns / NANOS_IN_SEC;
+    ts.tv_nsec += ns % NANOS_IN_SEC;
+    if (ts.tv_nsec >= NANOS_IN_SEC) {
+        ts.tv_sec ++;
+        ts.tv_nsec -= NANOS_IN_SEC;
+    } else if (ts.tv_nsec < 0) {
+        ts.tv_sec --;
+        ts.tv_nsec += NANOS_IN_SEC;
+    }
+    return ts;
+}
+
+/// Return: `ts` shifted by `ms` milliseconds (may be negative).
+static inline struct timespec ts_add_ms(struct timespec ts, double ms) {
+    return ts_add_ns(ts, (long long)(ms * NANOS_IN_MILLI));
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PING_TRACE_H_
+#define PING_TRACE_H_
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+#include "target.h"
+
+/// Hops probed by `--trace` without an explicit number, as traceroute does.
+#define TRACE_DEFAULT_HOPS (30)
+/// Largest TTL there is.
+#define TRACE_MAX_HOPS (255)
+
+typedef struct TraceOptions {
+    /// Probes are sent with every TTL from 1 to `max_hops`.
+    uint32_t max_hops;
+    /// How many rounds to send (0 - until stopped).
+    uint32_t count;
+    /// Time between rounds in milliseconds.
+    double interval;
+    /// Milliseconds to wait for late answers after the last round (0 - default).
+    double timeout;
+} TraceOptions;
+
+/// Statistics of the probes sent to a target with the same TTL.
+typedef struct TraceHop {
+    /// Router (or the target) that answered the last of them, `ss_family` is 0 until one does.
+    struct sockaddr_storage addr;
+    char ip_str[INET6_ADDRSTRLEN];
+    /// ICMP type and code of the last answer.
+    uint8_t type;
+    uint8_t code;
+    TargetStats stats;
+} TraceHop;
+
+/// Path to a single target, hop `i` is `hops[i - 1]`.
+typedef struct TracePath {
+    Target *target;
+    TraceHop *hops;
+    /// Hops still probed: `max_hops` until the target answers (or is reported unreachable),
+    /// then the closest TTL that got there.
+    uint32_t n_hops;
+    /// Whether the last probed hop is the end of the path.
+    bool done;
+} TracePath;
+
+/// Probe slot indexed by the ICMP sequence number on the wire.
+typedef struct TraceProbe {
+    /// Index of the path + 1, 0 means the slot is free.
+    uint32_t path;
+    uint8_t ttl;
+    /// `CLOCK_REALTIME`, the clock of kernel receive timestamps.
+    struct timespec sent_at;
+} TraceProbe;
+
+struct Tracer;
+/// Called after every round, right before the next one is sent, and once at the end.
+typedef void (*trace_round_cb)(const struct Tracer *tracer, void *ctx);
+
+/// mtr-like path tracer. Every round sends echo requests with every TTL to every
+/// target at once, and routers on the way answer with Time Exceeded quoting them,
+/// so the whole path resolves in about one RTT instead of one RTT per hop.
+/// Answers are matched back to their probe by the quoted `h_id`/`h_seq`.
+typedef struct Tracer {
+    /// Raw ICMP socket, ping sockets don't deliver errors as packets.
+    int sockfd;
+    IpVersion ip;
+    uint16_t id;
+    TracePath *paths;
+    size_t n_paths;
+    TraceOptions opts;
+    /// Rounds sent so far.
+    uint32_t rounds;
+    /// Next ICMP sequence number on the wire.
+    uint16_t next_seq;
+    /// Probes we still wait an answer for.
+    size_t outstanding;
+    TraceProbe probes[UINT16_MAX + 1];
+    IcmpRecvSlot ring[ICMP_BATCH_MAX];
+    /// Set by `tracer_stop`, checked once per loop iteration.
+    volatile sig_atomic_t stop;
+    trace_round_cb on_round;
+    void *ctx;
+} Tracer;
+
+/// Trace paths to all ready targets of the list through raw socket `sockfd`.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int tracer_init(Tracer *self, int sockfd, IpVersion ip, uint16_t id, TargetList *targets, const TraceOptions *opts);
+
+/// Send rounds until `count` of them were sent (and answered, or `timeout` passed), or until stopped.
+/// Return: `IcmpOk`, or the error that stopped it (errno is set).
+IcmpResult tracer_run(Tracer *self);
+
+/// Make `tracer_run` return, safe to call from a signal handler.
+void tracer_stop(Tracer *self);
+
+void tracer_free(Tracer *self);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PING_TRANSPORT_H_
+#define PING_TRANSPORT_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "icmp.h"
+
+/// Network and clock the engine probes through instead of its ICMP socket and the system clock,
+/// e.g. the simulated network of `sim.h`. Every function gets `ctx` as its first argument.
+/// Only batched calls are made, `io_uring`, the packet ring and kernel timestamps don't apply.
+typedef struct Transport {
+    /// Current time, like `CLOCK_MONOTONIC_RAW`.
+    void (*now)(void *ctx, struct timespec *ts);
+    /// Send `n` packets, each followed by `payload_len` bytes of `payload`, see `icmp_send_batch_payload`.
+    IcmpResult (*send)(
+        void *ctx, const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[],
+        const u_char payload[], size_t payload_len, size_t n, size_t *sent
+    );
+    /// Receive and parse up to `n` packets without blocking, see `recv_ip4_icmp_batch`.
+    /// On error (including no packets available), `IcmpRecvFromErr` is returned, and errno is set.
+    IcmpResult (*recv)(void *ctx, IcmpRecvSlot slots[], size_t n, size_t *received);
+    /// Wait until packets may be received, but no longer than `timeout`.
+    /// Return: 1 if packets may be received, 0 on timeout, on error, -1 is returned, and errno is set.
+    int (*wait)(void *ctx, const struct timespec *timeout);
+    void *ctx;
+} Transport;
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef PING_URING_H_
+#define PING_URING_H_
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "icmp.h"
+
+/// Submission queue entries, enough for several send batches.
+#define URING_ENTRIES (256)
+/// Sends in flight at once, each one holds a copy of its packet until completion.
+#define URING_SENDS (4 * ICMP_BATCH_MAX)
+/// Provided receive buffers (power of two), replies the kernel can queue before we reap them.
+/// Large buffers come in fewer numbers, see `URING_BUFS_MEM`.
+#define URING_BUFS (1024)
+/// Bytes of receive buffers a ring holds at most: with large payloads (`-s`) the number of
+/// buffers is halved until they fit, but never below `ICMP_BATCH_MAX`.
+#define URING_BUFS_MEM (4 << 20)
+/// Receive buffer: `io_uring_recvmsg_out`, source address, control data and a packet of up to
+/// `ICMP_RECV_BUF_LEN` bytes. Larger packets get larger buffers, see `uring_init`.
+#define URING_BUF_LEN (512)
+/// Buffer group of the provided buffer ring.
+#define URING_BGID (0)
+
+/// Send in flight. Packet and address are copied, so the engine may reuse its template right away;
+/// the payload is not, it must stay until the ring is closed.
+typedef struct UringSend {
+    IcmpPacket packet;
+    struct sockaddr_storage addr;
+    struct iovec iov[2];
+    struct msghdr msg;
+    /// Caller tag reported back if the send fails.
+    uint64_t tag;
+} UringSend;
+
+/// `io_uring` receive and send backend of a single ICMP socket, driven by raw syscalls.
+/// A multishot `recvmsg` stays armed on the socket and fills buffers from a registered
+/// provided buffer ring, so replies arrive without a syscall per packet; sends are queued
+/// as `sendmsg` entries and submitted together. Completions are reaped from the shared
+/// ring, the ring file descriptor is pollable for them.
+typedef struct Uring {
+    int fd;
+    int sockfd;
+    IcmpSocketKind kind;
+    IpVersion ip;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+    struct io_uring_sqe *sqes;
+    /// Tail including entries not yet visible to the kernel, and entries not yet submitted.
+    unsigned sq_local_tail;
+    unsigned sq_queued;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len, sqes_len;
+
+    struct io_uring_buf_ring *buf_ring;
+    u_char *bufs;
+    /// Number (power of two) and size of `bufs`.
+    size_t n_bufs;
+    size_t buf_len;
+    uint16_t buf_tail;
+    /// Template of the multishot receive: sizes of the address and control data.
+    struct msghdr recv_msg;
+    bool recv_armed;
+    /// Whether the multishot receive ever delivered a packet, so a rejection can be told from an error.
+    bool recv_works;
+
+    UringSend sends[URING_SENDS];
+    /// Stack of free `sends` indices.
+    uint16_t free_sends[URING_SENDS];
+    size_t n_free_sends;
+} Uring;
+
+/// Handle received packet. `ts` is the kernel receive timestamp, NULL if the socket has none.
+/// `info6` is NULL for IPv4.
+typedef void (*uring_recv_cb)(
+    const IcmpView *view, const struct sockaddr_storage *from,
+    const IcmpTimestamp *ts, const Icmp6Info *info6, void *ctx
+);
+/// Handle send that failed with `err` after it was queued.
+typedef void (*uring_send_cb)(uint64_t tag, int err, void *ctx);
+
+/// Set up ring for `sockfd` receiving packets of up to `recv_len` bytes and arm the multishot receive.
+/// Return: 0 on success, on error (including kernels without `io_uring`), -1 is returned, and errno is set.
+int uring_init(Uring *self, int sockfd, IcmpSocketKind kind, IpVersion ip, bool kernel_ts, size_t recv_len);
+
+/// Queue send of `packet` followed by `payload_len` bytes of `payload` to `addr`.
+/// Nothing is sent until `uring_submit`.
+/// Return: 0 on success, -1 with errno `ENOBUFS` if all send slots are in flight.
+int uring_send(
+    Uring *self, const IcmpPacket *packet, const u_char *payload, size_t payload_len,
+    const struct sockaddr_storage *addr, uint64_t tag
+);
+
+/// Submit all queued entries with a single syscall.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+int uring_submit(Uring *self);
+
+/// Handle all available completions: replies go to `on_recv`, failed sends to `on_send_err`.
+/// Parse failures are dropped. The multishot receive is re-armed if the kernel stopped it.
+/// Return: 0 on success, on error, -1 is returned, and errno is set
+/// (`EINVAL` if the kernel doesn't support multishot receive).
+int uring_reap(Uring *self, uring_recv_cb on_recv, uring_send_cb on_send_err, void *ctx);
+
+/// Close the ring, in-flight operations are cancelled.
+void uring_close(Uring *self);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PING_WHEEL_H_
+#define PING_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Every level of the wheel splits its range into 2^WHEEL_BITS slots.
+#define WHEEL_BITS (6)
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+/// Levels cover 2^(WHEEL_BITS * WHEEL_LEVELS) ticks (~12 days of milliseconds).
+#define WHEEL_LEVELS (5)
+/// Farthest expiry relative to the current tick, later ones are clamped to it.
+#define WHEEL_MAX_DELAY ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+/// Timer embedded into the structure it belongs to. Nothing is allocated by the wheel.
+typedef struct WheelTimer {
+    struct WheelTimer *next;
+    struct WheelTimer *prev;
+    /// Absolute tick the timer fires at.
+    uint64_t expires;
+    uint8_t level;
+    uint8_t slot;
+} WheelTimer;
+
+typedef void (*wheel_expire_cb)(WheelTimer *timer, void *ctx);
+
+/// Hierarchical timing wheel: insert, remove and expiry of a timer are O(1).
+/// Level 0 has a slot per tick, every next level has a slot per whole previous level.
+/// Timers are kept at the lowest level where their expiry shares the higher digits
+/// with the current tick and cascade down as the time approaches them.
+typedef struct TimerWheel {
+    /// Last processed tick.
+    uint64_t now;
+    size_t count;
+    /// Bitmap of non-empty slots of every level, lets advance skip idle ticks.
+    uint64_t occupied[WHEEL_LEVELS];
+    /// Sentinels of the circular timer lists.
+    WheelTimer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} TimerWheel;
+
+/// Empty wheel starting at tick `now`.
+void wheel_init(TimerWheel *self, uint64_t now);
+
+/// Return: true if the timer is in a wheel.
+static inline int wheel_pending(const WheelTimer *timer) {
+    return timer->next != NULL;
+}
+
+/// Schedule the timer at tick `expires` (rescheduled if already pending).
+/// Ticks that already passed fire on the next one.
+void wheel_insert(TimerWheel *self, WheelTimer *timer, uint64_t expires);
+
+/// Cancel the timer, no-op if it is not pending.
+void wheel_remove(TimerWheel *self, WheelTimer *timer);
+
+/// Process ticks up to `now` inclusive, calling `on_expire` for every expired timer.
+/// Idle ticks are skipped, so the cost doesn't depend on how long the wheel wasn't advanced.
+/// The callback may insert and remove timers.
+void wheel_advance(TimerWheel *self, uint64_t now, wheel_expire_cb on_expire, void *ctx);
+
+/// Return: next tick `wheel_advance` has to process (an expiry or a cascade),
+/// UINT64_MAX if the wheel is empty.
+uint64_t wheel_next(const TimerWheel *self);
+
+#endif
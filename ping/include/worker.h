@@ -0,0 +1,41 @@
+#ifndef PING_WORKER_H_
+#define PING_WORKER_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "engine.h"
+#include "output.h"
+
+/// Engine with its own socket, ICMP id, targets shard and output buffer.
+/// Workers share nothing but the output file descriptor, every target belongs
+/// to exactly one of them, so statistics need no locking and are merged after join.
+typedef struct Worker {
+    pthread_t thread;
+    /// CPU the worker thread is pinned to, -1 to leave it to the scheduler.
+    int cpu;
+    Engine engine;
+    Output output;
+    /// Result of `engine_run`.
+    IcmpResult res;
+} Worker;
+
+/// Fill `cpus` with up to `max` CPUs the process is allowed to run on.
+/// Return: number of CPUs, 0 if unknown.
+size_t worker_cpus(int *cpus, size_t max);
+
+/// Return: CPU the calling thread is running on, -1 if unknown.
+int worker_current_cpu(void);
+
+/// Run the engine in the calling thread (pinned to `cpu` if set) and flush the output.
+void worker_run(Worker *self);
+
+/// Start `worker_run` on a new thread. Signals are blocked in it, so they are
+/// delivered to the thread that started it.
+/// Return: 0 on success, otherwise error number.
+int worker_start(Worker *self);
+
+/// Wait for the worker thread to finish.
+void worker_join(Worker *self);
+
+#endif
@@ -1,21 +1,51 @@
 #include "../include/args.h"
+#include "../include/pmtu.h"
+#include "../include/record.h"
+#include "../include/trace.h"
 
+#include <errno.h>
 #include <getopt.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 struct AppConfig config = {
-    IPv4, NULL, NULL, 0, ClrAuto, 0
+    IPv4, NULL, 0, NULL, NULL, 0, ClrAuto, 0, 1000, false, false, IcmpSockAuto, FmtText,
+    NULL, RECORD_DEFAULT_LIMIT, 0, 0, 1, false, false, 0, 0, 0, {0}, 0, false, -1
 };
 
+/// Interval used by flood mode unless `--interval` is given.
+#define FLOOD_INTERVAL_MS (10)
+
 void help_message() {
     printf(
-        "Usage: %s [OPTION...] hostname\n"
+        "Usage: %s [OPTION...] hostname...\n"
         "Send ICMP ECHO_REQUEST packets to network hosts.\n\n"
         " Options:\n"
-        "  -c, --count <NUM>          stop after sending NUMBER packets\n"
+        "  -c, --count <NUM>          stop after sending NUMBER packets to every host\n"
+        "  -f, --file <FILE>          read list of hosts from FILE ('-' for stdin)\n"
+        "  -i, --interval <SEC>       wait SEC seconds between sending packets (fractions allowed)\n"
+        "  -s, --size <NUM>           send NUM data bytes (16 - just the timestamp, up to 65507),\n"
+        "                             large sizes get fewer io_uring buffers, up to 4 MiB per thread\n"
+        "  -p, --pattern <HEX>        fill the data with up to 16 bytes of HEX repeated, e.g. 'ff00'\n"
+        "                             (56 data bytes unless --size is given)\n"
+        "  -W, --timeout <SEC>        count a packet as lost if there is no reply in SEC seconds\n"
+        "  -w, --deadline <SEC>       stop after SEC seconds regardless of how many packets were sent\n"
+        "      --threads <NUM>        split hosts between NUM threads pinned to CPUs\n"
+        "      --flood                send packets as fast as replies come back, print only statistics\n"
+        "      --kernel-ts            measure time with kernel (hardware if available) timestamps\n"
+        "      --io-uring             send and receive through io_uring if the kernel supports it\n"
+        "      --packet-ring          receive through a mapped AF_PACKET ring (needs CAP_NET_RAW)\n"
+        "      --low-jitter[=CPU]     busy-poll on CPU (the current one) for microsecond RTT fidelity\n"
+        "      --trace[=HOPS]         trace the path, probing every hop up to HOPS (30) at once\n"
+        "      --pmtu[=SIZE]          find path MTU up to SIZE (9000) bytes, probing several sizes at once\n"
+        "      --socket <KIND>        KIND is 'raw', 'dgram' (unprivileged ping socket) or 'auto'\n"
+        "      --format <FMT>         FMT is 'text', 'json' (one object per line) or 'csv'\n"
+        "      --record <FILE>        record every probe to binary FILE (see ping-analyze)\n"
+        "      --record-limit <NUM>   keep only NUM newest records in the FILE\n"
         "      --ip4                  use IPv4 for sending packets\n"
         "      --ip6                  use IPv6 for sending packets\n"
         "      --color <WHEN>         WHEN is 'always', 'never', or 'auto'\n"
@@ -30,9 +60,9 @@ void usage_and_exit(const int status_code) {
     exit(status_code);
 }
 
-/// Try to convert Ascii string to unsigned 16-bit integer.
+/// Try to convert Ascii string to unsigned 32-bit integer.
 /// Returns `-1` on error or overflow.
-int atou16(const char *str, uint16_t *res) {
+int atou32(const char *str, uint32_t *res) {
     uint count = 0;
     for (int i=0; str[i] != '\0'; i++) {
         if (str[i] < '0' || str[i] > '9') return -1;
@@ -40,11 +70,50 @@ int atou16(const char *str, uint16_t *res) {
         if (__builtin_umul_overflow(count, 10, &count)) return -1;
         if (__builtin_uadd_overflow(count, str[i] - '0', &count)) return -1;
     }
-    if (count > UINT16_MAX) return -1;
-    *res = (uint16_t)count;
+    *res = (uint32_t)count;
+    return 0;
+}
+
+/// Convert string of hex digit pairs to at most `max` bytes, `len` is set to their number.
+/// Returns `-1` on error.
+int atohex(const char *str, u_char *res, size_t max, size_t *len) {
+    size_t digits = strlen(str);
+    if (digits == 0 || digits % 2 != 0 || digits / 2 > max) return -1;
+    for (size_t i = 0; i < digits / 2; i++) {
+        unsigned byte = 0;
+        for (size_t j = 0; j < 2; j++) {
+            char c = str[2 * i + j];
+            if (c >= '0' && c <= '9') byte = byte * 16 + (unsigned)(c - '0');
+            else if (c >= 'a' && c <= 'f') byte = byte * 16 + (unsigned)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') byte = byte * 16 + (unsigned)(c - 'A' + 10);
+            else return -1;
+        }
+        res[i] = (u_char)byte;
+    }
+    *len = digits / 2;
     return 0;
 }
 
+/// Convert Ascii string to the number of a CPU the system has.
+/// Returns `-1` on error or if there is no such CPU.
+int atocpu(const char *str) {
+    uint32_t cpu;
+    if (atou32(str, &cpu) == -1 || cpu >= sysconf(_SC_NPROCESSORS_CONF)) return -1;
+    return (int)cpu;
+}
+
+/// Convert Ascii string with (fractional) seconds to milliseconds.
+/// Exits with the usage message on error, `name` is the option to report.
+double atoms(const char *str, const char *name) {
+    char *end = NULL;
+    double sec = strtod(str, &end);
+    if (end == str || *end != '\0' || !(sec >= 0) || sec > UINT16_MAX) {
+        (void)fprintf(stderr, "%s: invalid %s '%s'\n", config.bin, name, str);
+        usage_and_exit(1);
+    }
+    return sec * 1000;
+}
+
 static const struct option long_options[] = {
     {"help", no_argument, 0, 0},
     {"verbose", no_argument, 0, 'v'},
@@ -52,6 +121,24 @@ static const struct option long_options[] = {
     {"count", required_argument, 0, 'c'},
     {"ip4", no_argument, 0, 0},
     {"ip6", no_argument, 0, 0},
+    {"file", required_argument, 0, 'f'},
+    {"interval", required_argument, 0, 'i'},
+    {"flood", no_argument, 0, 0},
+    {"kernel-ts", no_argument, 0, 0},
+    {"socket", required_argument, 0, 0},
+    {"format", required_argument, 0, 0},
+    {"record", required_argument, 0, 0},
+    {"record-limit", required_argument, 0, 0},
+    {"timeout", required_argument, 0, 'W'},
+    {"deadline", required_argument, 0, 'w'},
+    {"threads", required_argument, 0, 0},
+    {"io-uring", no_argument, 0, 0},
+    {"packet-ring", no_argument, 0, 0},
+    {"trace", optional_argument, 0, 0},
+    {"pmtu", optional_argument, 0, 0},
+    {"size", required_argument, 0, 's'},
+    {"pattern", required_argument, 0, 'p'},
+    {"low-jitter", optional_argument, 0, 0},
     {0, 0, 0, 0}
 };
 
@@ -80,19 +167,125 @@ void parse_args_long(int index) {
     case 5:
         config.ip = IPv6;
         break;
+    case 8:
+        config.flood = true;
+        break;
+    case 9:
+        config.kernel_ts = true;
+        break;
+    case 10:
+        if (!strcmp(optarg, "auto")) config.socket_kind = IcmpSockAuto;
+        else if (!strcmp(optarg, "raw")) config.socket_kind = IcmpSockRaw;
+        else if (!strcmp(optarg, "dgram")) config.socket_kind = IcmpSockDgram;
+        else {
+            (void)fprintf(
+                stderr, "'%s': valid values: auto, raw, dgram.\n",
+                long_options[index].name
+            );
+            usage_and_exit(1);
+        }
+        break;
+    case 11:
+        if (!strcmp(optarg, "text")) config.format = FmtText;
+        else if (!strcmp(optarg, "json")) config.format = FmtJson;
+        else if (!strcmp(optarg, "csv")) config.format = FmtCsv;
+        else {
+            (void)fprintf(
+                stderr, "'%s': valid values: text, json, csv.\n",
+                long_options[index].name
+            );
+            usage_and_exit(1);
+        }
+        break;
+    case 12:
+        config.record_file = optarg;
+        break;
+    case 13:
+        if (atou32(optarg, &config.record_limit) == -1 || config.record_limit == 0) {
+            (void)fprintf(stderr, "%s: valid record limit range is [1; %u]\n", config.bin, UINT32_MAX);
+            usage_and_exit(1);
+        }
+        break;
+    case 16:
+        if (atou32(optarg, &config.threads) == -1 || config.threads == 0 || config.threads > MAX_THREADS) {
+            (void)fprintf(stderr, "%s: valid threads range is [1; %u]\n", config.bin, MAX_THREADS);
+            usage_and_exit(1);
+        }
+        break;
+    case 17:
+        config.io_uring = true;
+        break;
+    case 18:
+        config.packet_ring = true;
+        break;
+    case 19:
+        config.trace_hops = TRACE_DEFAULT_HOPS;
+        if (optarg == NULL) break;
+        if (atou32(optarg, &config.trace_hops) == -1 || config.trace_hops == 0 || config.trace_hops > TRACE_MAX_HOPS) {
+            (void)fprintf(stderr, "%s: valid hops range is [1; %u]\n", config.bin, TRACE_MAX_HOPS);
+            usage_and_exit(1);
+        }
+        break;
+    case 20:
+        config.pmtu_max = PMTU_DEFAULT_MAX;
+        if (optarg == NULL) break;
+        if (atou32(optarg, &config.pmtu_max) == -1 || config.pmtu_max < PMTU_MIN_IP4 || config.pmtu_max > PMTU_MAX) {
+            (void)fprintf(stderr, "%s: valid pmtu size range is [%u; %u]\n", config.bin, PMTU_MIN_IP4, PMTU_MAX);
+            usage_and_exit(1);
+        }
+        break;
+    case 23:
+        config.low_jitter = true;
+        if (optarg == NULL) break;
+        config.low_jitter_cpu = atocpu(optarg);
+        if (config.low_jitter_cpu == -1) {
+            (void)fprintf(stderr, "%s: valid CPU range is [0; %ld]\n", config.bin, sysconf(_SC_NPROCESSORS_CONF) - 1);
+            usage_and_exit(1);
+        }
+        break;
     default:
         usage_and_exit(1);
     }
 }
 
+/// Whether `--interval` was given explicitly.
+static bool interval_set = false;
+
 void parse_args_short(int opt) {
     switch (opt) {
     case 'v':
         config.verbosity ++;
         break;
     case 'c':
-        if (atou16(optarg, &config.count) == -1) {
-            (void)fprintf(stderr, "%s: valid count range is [0; %u]\n", config.bin, UINT16_MAX);
+        if (atou32(optarg, &config.count) == -1) {
+            (void)fprintf(stderr, "%s: valid count range is [0; %u]\n", config.bin, UINT32_MAX);
+            usage_and_exit(1);
+        }
+        break;
+    case 'f':
+        config.targets_file = optarg;
+        break;
+    case 'i':
+        config.interval = atoms(optarg, "interval");
+        interval_set = true;
+        break;
+    case 'W':
+        config.timeout = atoms(optarg, "timeout");
+        break;
+    case 'w':
+        config.deadline = atoms(optarg, "deadline");
+        break;
+    case 's':
+        if (atou32(optarg, &config.size) == -1 || config.size < PAYLOAD_MIN || config.size > PAYLOAD_MAX_IP6) {
+            (void)fprintf(stderr, "%s: valid size range is [%zu; %u]\n", config.bin, PAYLOAD_MIN, PAYLOAD_MAX_IP6);
+            usage_and_exit(1);
+        }
+        break;
+    case 'p':
+        if (atohex(optarg, config.pattern, PAYLOAD_PATTERN_MAX, &config.pattern_len) == -1) {
+            (void)fprintf(
+                stderr, "%s: pattern must be 1 to %u bytes of hex digits\n", config.bin, PAYLOAD_PATTERN_MAX
+            );
             usage_and_exit(1);
         }
         break;
@@ -101,16 +294,120 @@ void parse_args_short(int opt) {
     }
 }
 
+/// Append hostname to `config.hostnames`.
+void push_hostname(char *hostname) {
+    config.hostnames = realloc(config.hostnames, (config.n_hostnames + 1) * sizeof(char *));
+    if (config.hostnames == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    config.hostnames[config.n_hostnames++] = hostname;
+}
+
+/// Read hosts from file, one per line. Empty lines and lines starting with '#' are skipped.
+void read_targets_file(const char *path) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        (void)fprintf(stderr, "%s: %s: %s\n", config.bin, path, strerror(errno));
+        exit(1);
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, file) != -1) {
+        char *host = line + strspn(line, " \t");
+        host[strcspn(host, " \t\r\n#")] = '\0';
+        if (*host != '\0') push_hostname(strdup(host));
+    }
+    free(line);
+    if (file != stdin) (void)fclose(file);
+}
+
+/// Raise `config.threads` so no worker has more probes in flight than its engine has sequence
+/// numbers (`ENGINE_MAX_OUTSTANDING`): with a timeout, every host has up to `timeout / interval` + 1
+/// probes waiting for replies. Without a timeout probes only wait until their slot is reused.
+static void fit_in_flight() {
+    if (config.timeout <= 0 || config.trace_hops != 0 || config.pmtu_max != 0) return;
+    // Flood mode without an interval sends a round only once the previous one is answered.
+    double per_host = config.interval > 0 ? ceil(config.timeout / config.interval) + 1 : config.flood ? 1 : INFINITY;
+    if (per_host > ENGINE_MAX_OUTSTANDING) {
+        (void)fprintf(
+            stderr, "%s: a host may have more than %u probes in flight, lower --timeout or raise --interval\n",
+            config.bin, ENGINE_MAX_OUTSTANDING
+        );
+        usage_and_exit(1);
+    }
+    size_t hosts_per_thread = (size_t)(ENGINE_MAX_OUTSTANDING / per_host);
+    size_t needed = (config.n_hostnames + hosts_per_thread - 1) / hosts_per_thread;
+    if (needed <= config.threads) return;
+    if (needed > MAX_THREADS || config.record_file != NULL || config.low_jitter_cpu >= 0) {
+        (void)fprintf(
+            stderr, "%s: %.0f probes may be in flight, tracking them takes %zu threads%s; "
+            "lower --timeout or raise --interval\n", config.bin, per_host * (double)config.n_hostnames, needed,
+            needed > MAX_THREADS ? "" : ", which --record and --low-jitter=CPU don't allow"
+        );
+        usage_and_exit(1);
+    }
+    (void)fprintf(
+        stderr, "%s: %.0f probes may be in flight, splitting hosts between %zu threads\n",
+        config.bin, per_host * (double)config.n_hostnames, needed
+    );
+    config.threads = (uint32_t)needed;
+}
+
 void parse_args(int argc, char *argv[]) {
     config.bin = argv[0];
     int opt = -1, long_index = 0;
-    while ((opt = getopt_long(argc, argv, "vc:", long_options, &long_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vc:f:i:W:w:s:p:", long_options, &long_index)) != -1) {
         if (opt == 0) parse_args_long(long_index);
         else parse_args_short(opt);
     }
-    if (optind < argc) {
-        config.hostname = argv[optind];
-    } else {
+    for (; optind < argc; optind++) push_hostname(argv[optind]);
+    if (config.targets_file != NULL) read_targets_file(config.targets_file);
+    if (config.n_hostnames == 0) usage_and_exit(1);
+    if (config.flood && interval_set == false) config.interval = FLOOD_INTERVAL_MS;
+    // Record file is a single ring written without synchronization.
+    if (config.record_file != NULL && config.threads > 1) {
+        (void)fprintf(stderr, "%s: --record can't be used with several --threads\n", config.bin);
+        usage_and_exit(1);
+    }
+    // Ping sockets report ICMP errors only through the error queue, without the router address in the packet.
+    if (config.trace_hops != 0 && config.socket_kind == IcmpSockDgram) {
+        (void)fprintf(stderr, "%s: --trace needs a raw socket\n", config.bin);
+        usage_and_exit(1);
+    }
+    if (config.trace_hops != 0 && config.record_file != NULL) {
+        (void)fprintf(stderr, "%s: --record can't be used with --trace\n", config.bin);
+        usage_and_exit(1);
+    }
+    if (config.pmtu_max != 0 && config.socket_kind == IcmpSockDgram) {
+        (void)fprintf(stderr, "%s: --pmtu needs a raw socket\n", config.bin);
+        usage_and_exit(1);
+    }
+    if (config.pmtu_max != 0 && (config.trace_hops != 0 || config.record_file != NULL)) {
+        (void)fprintf(stderr, "%s: --pmtu can't be used with --trace or --record\n", config.bin);
+        usage_and_exit(1);
+    }
+    if (config.ip == IPv4 && config.size > PAYLOAD_MAX_IP4) {
+        (void)fprintf(stderr, "%s: size can't be above %u for IPv4\n", config.bin, PAYLOAD_MAX_IP4);
+        usage_and_exit(1);
+    }
+    if ((config.size != 0 || config.pattern_len != 0) && (config.trace_hops != 0 || config.pmtu_max != 0)) {
+        (void)fprintf(stderr, "%s: --size and --pattern can't be used with --trace or --pmtu\n", config.bin);
+        usage_and_exit(1);
+    }
+    if (config.low_jitter && (config.trace_hops != 0 || config.pmtu_max != 0)) {
+        (void)fprintf(stderr, "%s: --low-jitter can't be used with --trace or --pmtu\n", config.bin);
+        usage_and_exit(1);
+    }
+    // Several workers are pinned round-robin, a single CPU can't take them all.
+    if (config.low_jitter_cpu >= 0 && config.threads > 1) {
+        (void)fprintf(stderr, "%s: --low-jitter=CPU can't be used with several --threads\n", config.bin);
+        usage_and_exit(1);
+    }
+    // Every IPv6 link carries 1280 bytes, there is nothing to search below.
+    if (config.pmtu_max != 0 && config.ip == IPv6 && config.pmtu_max < PMTU_MIN_IP6) {
+        (void)fprintf(stderr, "%s: --pmtu size can't be below %u for IPv6\n", config.bin, PMTU_MIN_IP6);
         usage_and_exit(1);
     }
+    fit_in_flight();
 }
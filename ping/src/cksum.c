@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CKSUM_X86
+#endif
+
+#include "../include/cksum.h"
+
+/// Sum of the buffer as 32-bit words (one's complement sum is word size agnostic).
+/// Trailing half word and byte are added the same way RFC 1071 does.
+static uint64_t sum_scalar(const char *addr, size_t size) {
+    uint64_t sum = 0;
+    while (size >= 4) {
+        uint32_t word;
+        memcpy(&word, addr, sizeof(word));
+        sum += word;
+        addr += 4;
+        size -= 4;
+    }
+    if (size >= 2) {
+        uint16_t half;
+        memcpy(&half, addr, sizeof(half));
+        sum += half;
+        addr += 2;
+        size -= 2;
+    }
+    if (size == 1) {
+        sum += *(uint8_t *)addr;
+    }
+    return sum;
+}
+
+#ifdef CKSUM_X86
+/// 32-bit words are zero-extended into 64-bit lanes, so lanes never overflow.
+__attribute__((target("sse2")))
+static uint64_t sum_sse2(const char *addr, size_t size) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    while (size >= 32) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)addr);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(addr + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(lo, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(lo, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(hi, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(hi, zero));
+        addr += 32;
+        size -= 32;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + sum_scalar(addr, size);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(const char *addr, size_t size) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    while (size >= 64) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)addr);
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(addr + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(lo, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(lo, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(hi, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(hi, zero));
+        addr += 64;
+        size -= 64;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_sse2(addr, size);
+}
+#endif
+
+bool in_cksum_supported(CksumImpl impl) {
+    switch (impl) {
+    case CksumScalar:
+        return true;
+#ifdef CKSUM_X86
+    case CksumSse2:
+        return __builtin_cpu_supports("sse2");
+    case CksumAvx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const char *in_cksum_name(CksumImpl impl) {
+    switch (impl) {
+    case CksumScalar:
+        return "scalar";
+    case CksumSse2:
+        return "sse2";
+    case CksumAvx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+/// Return: one's complement of the 64-bit sum folded to 16 bits.
+static uint16_t fold(uint64_t sum) {
+    const uint64_t uint16_mask = 0xffff;
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & uint16_mask);
+    }
+    return (uint16_t)~sum;
+}
+
+uint16_t in_cksum_with(CksumImpl impl, const char *addr, size_t size, uint16_t start) {
+    switch (impl) {
+#ifdef CKSUM_X86
+    case CksumSse2:
+        return fold(start + sum_sse2(addr, size));
+    case CksumAvx2:
+        return fold(start + sum_avx2(addr, size));
+#endif
+    default:
+        return fold(start + sum_scalar(addr, size));
+    }
+}
+
+/// Fastest implementation supported by the CPU, resolved once on the first call from any thread.
+static uint64_t (*sum_impl)(const char *, size_t) = sum_scalar;
+static pthread_once_t sum_impl_once = PTHREAD_ONCE_INIT;
+
+static void sum_impl_resolve(void) {
+#ifdef CKSUM_X86
+    if (in_cksum_supported(CksumAvx2)) sum_impl = sum_avx2;
+    else if (in_cksum_supported(CksumSse2)) sum_impl = sum_sse2;
+#endif
+}
+
+uint16_t in_cksum(const char *addr, size_t size, uint16_t start) {
+    pthread_once(&sum_impl_once, sum_impl_resolve);
+    return fold(start + sum_impl(addr, size));
+}
+
+uint16_t in_cksum_update(uint16_t cksum, const void *old, const void *new, size_t size) {
+    // RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'), applied to every 16-bit word of the region.
+    uint64_t sum = (uint16_t)~cksum;
+    const uint16_t *old_words = old, *new_words = new;
+    for (size_t i = 0; i < size / 2; i++) {
+        sum += (uint16_t)~old_words[i];
+        sum += new_words[i];
+    }
+    return fold(sum);
+}
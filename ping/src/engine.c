@@ -0,0 +1,665 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../include/engine.h"
+#include "../include/time_util.h"
+
+/// How long we wait for late replies after the last round.
+#define LINGER_MS (1000)
+/// Socket buffer space reserved for every target, so a whole round (our own
+/// echo requests included on loopback) fits into the queue.
+#define SOCK_BUF_PER_TARGET (4096)
+/// Clock reads further apart than this were interrupted and are sampled again.
+#define CLOCK_OFFSET_MAX_GAP_NS (2000)
+
+/// Read the engine clock: the transport one if there is a transport, `CLOCK_MONOTONIC_RAW` otherwise.
+static inline void engine_now(const Engine *self, struct timespec *ts) {
+    const Transport *transport = self->opts.transport;
+    if (transport != NULL) transport->now(transport->ctx, ts);
+    else clock_gettime(CLOCK_MONOTONIC_RAW, ts);
+}
+
+int engine_init(
+    Engine *self, int sockfd, IpVersion ip, uint16_t id,
+    TargetList *targets, size_t shard, size_t n_shards, const EngineOptions *opts,
+    engine_reply_cb on_reply, void *ctx
+) {
+    memset(self, 0, sizeof(*self));
+    self->sockfd = sockfd;
+    self->kind = icmp_socket_kind(sockfd);
+    self->ip = ip;
+    self->id = id;
+    self->targets = targets;
+    self->shard = shard;
+    self->n_shards = n_shards;
+    self->opts = *opts;
+    self->on_reply = on_reply;
+    self->ctx = ctx;
+    wheel_init(&self->wheel, 0);
+    engine_now(self, &self->epoch);
+
+    size_t recv_len = opts->payload != NULL ? payload_recv_len(opts->payload) : ICMP_RECV_BUF_LEN;
+    if (icmp_recv_ring_init(self->ring, ICMP_BATCH_MAX, recv_len) == -1) return -1;
+    self->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (self->wakefd == -1) return -1;
+    target_list_watch(targets, self->wakefd);
+    // Transport replaces the socket, nothing below applies to it.
+    if (opts->transport != NULL) return 0;
+
+    // Ping sockets are already filtered by the kernel.
+    if (self->kind == IcmpSockRaw && icmp_attach_filter(sockfd, ip, id) == -1) return -1;
+    if (opts->kernel_ts) self->kernel_ts = icmp_enable_timestamping(sockfd) == 0;
+
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+
+    // Kernels without `io_uring` (or with it disabled) are served by plain syscalls.
+    if (opts->io_uring) self->io_uring = uring_init(&self->uring, sockfd, self->kind, ip, self->kernel_ts, recv_len) == 0;
+    // Replies are taken from the ring, so the socket queue is kept empty; it still sends
+    // and carries TX timestamps. Without `CAP_NET_RAW`, or with replies that would be fragmented,
+    // the socket receives as usual.
+    size_t reply_len = (ip == IPv4 ? sizeof(struct ip) : sizeof(struct ip6_hdr)) + sizeof(IcmpPacket)
+        + (opts->payload != NULL ? opts->payload->len : 0);
+    if (opts->packet_ring && reply_len <= PACKET_MTU && packet_ring_open(&self->packet, ip, id) == 0) {
+        if (icmp_attach_drop_filter(sockfd) == -1) {
+            packet_ring_close(&self->packet);
+            return -1;
+        }
+        self->packet_ring = true;
+    }
+
+    // Kernel busy-polls the device queue on blocking reads too, where the driver supports it.
+    // Raising the limit above `net.core.busy_read` needs `CAP_NET_ADMIN`, so failures are not fatal.
+    if (opts->busy_poll > 0) {
+        int busy_poll = opts->busy_poll < INT_MAX ? (int)opts->busy_poll : INT_MAX;
+        (void)setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+    }
+
+    // Kernel silently caps the size at `net.core.[rw]mem_max`, so failures are not fatal.
+    size_t n_targets = (targets->capacity + n_shards - 1) / n_shards;
+    size_t per_target = SOCK_BUF_PER_TARGET + (opts->payload != NULL ? 2 * opts->payload->len : 0);
+    int buf_size = n_targets < INT_MAX / per_target ? (int)(n_targets * per_target) : INT_MAX;
+    int curr_size = 0;
+    socklen_t opt_len = sizeof(curr_size);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &curr_size, &opt_len) == 0 && curr_size < buf_size) {
+        (void)setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        (void)setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    }
+    return 0;
+}
+
+/// Return: target with index `i` of the list.
+static inline Target *engine_target(const Engine *self, size_t i) {
+    return &self->targets->items[i];
+}
+
+/// Patch echo request template of the target with index `i` with the next wire sequence number.
+static const IcmpPacket *engine_new_probe(Engine *self, size_t i, uint16_t *seq, const struct timespec *now) {
+    *seq = self->next_seq++;
+    Target *target = engine_target(self, i);
+    if (++target->next_seq == self->opts.count) self->n_done ++;
+    icmp_func.echo_update(&target->packet, *seq, now);
+    return &target->packet;
+}
+
+/// Return: milliseconds from the engine epoch to `ts`.
+static double engine_ms(const Engine *self, const struct timespec *ts) {
+    return calc_time(&self->epoch, ts);
+}
+
+/// Count probe as lost once its timeout elapsed. Late replies to it are ignored.
+static void engine_expire(WheelTimer *timer, void *ctx) {
+    Engine *self = ctx;
+    EngineProbe *probe = (EngineProbe *)((char *)timer - offsetof(EngineProbe, timer));
+    probe->target = 0;
+    self->outstanding --;
+}
+
+/// Remember probe handed to the kernel in the outstanding table.
+static void engine_track_probe(Engine *self, uint16_t seq, size_t i, const struct timespec *sent_at) {
+    EngineProbe *probe = &self->probes[seq];
+    // Slot is still taken if the reply to the probe sent 65536 packets ago never came.
+    if (probe->target == 0) self->outstanding ++;
+    probe->target = i + 1;
+    probe->seq = engine_target(self, i)->next_seq - 1;
+    probe->sent_at = *sent_at;
+    memset(&probe->tx_ts, 0, sizeof(probe->tx_ts));
+    if (self->kernel_ts) self->tx_seqs[self->tx_id++ & UINT16_MAX] = seq;
+    if (self->recorder) probe->record = recorder_append(self->recorder, i, probe->seq, sent_at);
+    // Expire no earlier than the timeout: a tick is processed once it has fully started.
+    if (self->opts.timeout > 0) {
+        wheel_insert(&self->wheel, &probe->timer, (uint64_t)ceil(engine_ms(self, sent_at) + self->opts.timeout));
+    }
+    engine_target(self, i)->stats.sent ++;
+}
+
+/// Count probe to the target with index `i` that couldn't be sent as sent and lost:
+/// its sequence number and its share of `count` are spent either way.
+static void engine_fail_probe(Engine *self, size_t i, const struct timespec *sent_at) {
+    Target *target = engine_target(self, i);
+    if (self->recorder) (void)recorder_append(self->recorder, i, target->next_seq - 1, sent_at);
+    target->stats.sent ++;
+}
+
+/// Return: true if send error `err` is of the socket itself rather than of one destination,
+/// so no other probe can be sent either.
+static bool engine_send_fatal(int err) {
+    return err == EBADF || err == ENOTSOCK;
+}
+
+static IcmpResult engine_uring_reap(Engine *self);
+
+/// Queue prepared probes to `io_uring` and submit them with a single syscall.
+/// Probes are tracked as soon as they are queued: replies may be reaped before the batch is
+/// complete, and sends that fail later are counted as lost by `engine_uring_send_err`.
+static IcmpResult engine_uring_send(
+    Engine *self, const size_t *idx, const IcmpPacket *const *packets,
+    const struct sockaddr_storage *const *addrs, const uint16_t *seqs, size_t n, const struct timespec *sent_at
+) {
+    const u_char *payload = self->opts.payload != NULL ? self->opts.payload->data : NULL;
+    size_t payload_len = self->opts.payload != NULL ? self->opts.payload->len : 0;
+    for (size_t i = 0; i < n; i++) {
+        if (uring_send(&self->uring, packets[i], payload, payload_len, addrs[i], seqs[i]) == -1) {
+            // Every send slot is in flight, completions of the submitted ones free them.
+            bool retry = uring_submit(&self->uring) == 0 && engine_uring_reap(self) == IcmpOk && self->io_uring;
+            if (retry == false || uring_send(&self->uring, packets[i], payload, payload_len, addrs[i], seqs[i]) == -1) {
+                engine_fail_probe(self, idx[i], sent_at);
+                continue;
+            }
+        }
+        engine_track_probe(self, seqs[i], idx[i], sent_at);
+    }
+    // Entries the kernel couldn't take yet stay queued and go with the next submit.
+    if (uring_submit(&self->uring) == -1 && errno != ENOBUFS) return IcmpSendToErr;
+    return IcmpOk;
+}
+
+/// Send probes to targets with list indices `idx`, with a single `sendmmsg` if there are several.
+static IcmpResult engine_send_targets(Engine *self, const size_t *idx, size_t n) {
+    const IcmpPacket *packets[ICMP_BATCH_MAX];
+    const struct sockaddr_storage *addrs[ICMP_BATCH_MAX];
+    uint16_t seqs[ICMP_BATCH_MAX];
+    struct timespec sent_at;
+    engine_now(self, &sent_at);
+    for (size_t i = 0; i < n; i++) {
+        packets[i] = engine_new_probe(self, idx[i], &seqs[i], &sent_at);
+        addrs[i] = &engine_target(self, idx[i])->addr;
+    }
+
+    if (self->io_uring) return engine_uring_send(self, idx, packets, addrs, seqs, n, &sent_at);
+    const IcmpPayload *payload = self->opts.payload;
+    const Transport *transport = self->opts.transport;
+    size_t done = 0;
+    while (done < n) {
+        size_t sent = 0;
+        IcmpResult res;
+        if (transport != NULL) {
+            res = transport->send(
+                transport->ctx, packets + done, addrs + done, payload != NULL ? payload->data : NULL,
+                payload != NULL ? payload->len : 0, n - done, &sent
+            );
+        } else if (payload != NULL && payload->len > 0) {
+            res = icmp_func.send_batch_payload(
+                packets + done, addrs + done, payload->data, payload->len, n - done, self->sockfd, &sent
+            );
+        } else if (n - done == 1) {
+            res = icmp_func.send(packets[done], self->sockfd, addrs[done]);
+            sent = res == IcmpOk;
+        } else {
+            res = icmp_func.send_batch(packets + done, addrs + done, n - done, self->sockfd, &sent);
+        }
+        for (size_t i = done; i < done + sent; i++) {
+            engine_track_probe(self, seqs[i], idx[i], &sent_at);
+        }
+        done += sent;
+        if (res == IcmpOk || done == n) break;
+        if (engine_send_fatal(errno)) return res;
+        // Unreachable destination or full socket buffer only costs the probe that hit it.
+        engine_fail_probe(self, idx[done], &sent_at);
+        done ++;
+    }
+    return IcmpOk;
+}
+
+/// Return: true if all `count` probes were sent to the target.
+static bool engine_target_done(const Engine *self, size_t i) {
+    return self->opts.count != 0 && engine_target(self, i)->next_seq >= self->opts.count;
+}
+
+IcmpResult engine_send_round(Engine *self) {
+    IcmpResult res = IcmpOk;
+    size_t idx[ICMP_BATCH_MAX];
+    size_t n = 0;
+    for (size_t i = self->shard; i < self->n_known; i += self->n_shards) {
+        if (engine_target_done(self, i)) continue;
+        idx[n++] = i;
+        if (n < ICMP_BATCH_MAX) continue;
+        IcmpResult batch_res = engine_send_targets(self, idx, n);
+        if (batch_res != IcmpOk) res = batch_res;
+        n = 0;
+    }
+    if (n > 0) {
+        IcmpResult batch_res = engine_send_targets(self, idx, n);
+        if (batch_res != IcmpOk) res = batch_res;
+    }
+    return res;
+}
+
+/// Take own targets published since the last call: prepare their echo templates
+/// and, unless a round is about to cover them, send their first probes right away.
+static IcmpResult engine_refresh_targets(Engine *self, bool send) {
+    size_t ready = target_list_ready(self->targets);
+    if (ready <= self->n_known) return IcmpOk;
+    IcmpResult res = IcmpOk;
+    size_t idx[ICMP_BATCH_MAX];
+    size_t n = 0;
+    // First own index at or after `n_known`.
+    size_t i = self->n_known + (self->shard + self->n_shards - self->n_known % self->n_shards) % self->n_shards;
+    for (; i < ready; i += self->n_shards) {
+        Target *target = engine_target(self, i);
+        if (self->ip == IPv4) {
+            icmp_func.echo4_template(&target->packet, self->id);
+        } else {
+            icmp_func.echo6_template(&target->packet, self->id);
+        }
+        if (self->opts.payload != NULL) payload_apply(self->opts.payload, &target->packet);
+        self->n_owned ++;
+        if (self->recorder) recorder_target(self->recorder, i, target);
+        if (self->on_target) self->on_target(target, self->ctx);
+        if (send == false || engine_target_done(self, i)) continue;
+        idx[n++] = i;
+        if (n < ICMP_BATCH_MAX) continue;
+        IcmpResult batch_res = engine_send_targets(self, idx, n);
+        if (batch_res != IcmpOk) res = batch_res;
+        n = 0;
+    }
+    self->n_known = ready;
+    if (n > 0) {
+        IcmpResult batch_res = engine_send_targets(self, idx, n);
+        if (batch_res != IcmpOk) res = batch_res;
+    }
+    return res;
+}
+
+/// Return: RTT between kernel timestamps when both ends have them (hardware preferred),
+/// otherwise between user-space send and receive times.
+/// Kernel timestamps that put the reply before its probe (the clock was stepped in between,
+/// or the NIC clock isn't the one that stamped the send) are not trusted.
+static double engine_rtt(const EngineProbe *probe, const struct timespec *recv_at, const IcmpTimestamp *rx_ts) {
+    if (rx_ts != NULL) {
+        if (icmp_timestamp_valid(&probe->tx_ts.hw) && icmp_timestamp_valid(&rx_ts->hw)) {
+            double rtt = calc_time(&probe->tx_ts.hw, &rx_ts->hw);
+            if (rtt >= 0) return rtt;
+        }
+        if (icmp_timestamp_valid(&probe->tx_ts.sw) && icmp_timestamp_valid(&rx_ts->sw)) {
+            double rtt = calc_time(&probe->tx_ts.sw, &rx_ts->sw);
+            if (rtt >= 0) return rtt;
+        }
+    }
+    return calc_time(&probe->sent_at, recv_at);
+}
+
+/// Match reply with parsed headers in `reply` to the outstanding probe, fill the rest of it
+/// and pass it to the callback. `rx_ts` is the kernel receive timestamp, NULL if unknown.
+static void engine_dispatch(
+    Engine *self, EngineReply *reply,
+    const struct sockaddr_storage *from, const struct timespec *recv_at, const IcmpTimestamp *rx_ts
+) {
+    const IcmpView *view = &reply->view;
+    uint8_t reply_type = self->ip == IPv4 ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY;
+    if (icmp_view_type(view) != reply_type || icmp_view_id(view) != self->id) return;
+
+    EngineProbe *probe = &self->probes[icmp_view_seq(view)];
+    if (probe->target == 0) return;
+    Target *target = engine_target(self, probe->target - 1);
+    if (target_addr_eq(target, from) == false) return;
+
+    reply->target = target;
+    reply->seq = probe->seq;
+    // Echoed timestamp is the probe send time, so the whole data is known without keeping packets.
+    reply->corrupt_at = self->opts.payload != NULL ? payload_check(self->opts.payload, view, &probe->sent_at) : -1;
+    probe->target = 0;
+    self->outstanding --;
+    wheel_remove(&self->wheel, &probe->timer);
+
+    reply->time = engine_rtt(probe, recv_at, rx_ts);
+    target->stats.received ++;
+    hist_record(&target->stats.rtt, (uint64_t)llround(reply->time * NANOS_IN_MILLI));
+    if (view->ip4 != NULL) reply->ttl = view->ip4->ttl;
+    else if (reply->ip6 != NULL) reply->ttl = reply->ip6->ip6_hlim;
+    else if (reply->info6 != NULL) reply->ttl = reply->info6->hop_limit;
+    else reply->ttl = -1;
+    if (self->recorder) recorder_complete(self->recorder, probe->record, reply->time, reply->ttl >= 0 ? reply->ttl : 0);
+
+    if (self->on_reply) self->on_reply(reply, self->ctx);
+}
+
+/// Reply received through `io_uring`.
+static void engine_uring_recv(
+    const IcmpView *view, const struct sockaddr_storage *from,
+    const IcmpTimestamp *ts, const Icmp6Info *info6, void *ctx
+) {
+    struct timespec recv_at;
+    engine_now((Engine *)ctx, &recv_at);
+    EngineReply reply = {.info6 = info6, .view = *view};
+    engine_dispatch((Engine *)ctx, &reply, from, &recv_at, ts);
+}
+
+/// Sample `CLOCK_REALTIME` minus `CLOCK_MONOTONIC_RAW` in nanoseconds.
+/// The realtime read is bracketed by monotonic ones and retried if we were preempted between them.
+static long long engine_clock_offset(void) {
+    long long best = 0, best_gap = LLONG_MAX;
+    for (int i = 0; i < 4; i++) {
+        struct timespec before, real, after;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &before);
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &after);
+        long long mono = ((long long)before.tv_sec + after.tv_sec) * NANOS_IN_SEC / 2
+            + ((long long)before.tv_nsec + after.tv_nsec) / 2;
+        long long gap = (long long)(calc_time(&before, &after) * NANOS_IN_MILLI);
+        if (gap < best_gap) {
+            best_gap = gap;
+            best = (long long)real.tv_sec * NANOS_IN_SEC + real.tv_nsec - mono;
+        }
+        if (gap < CLOCK_OFFSET_MAX_GAP_NS) break;
+    }
+    return best;
+}
+
+/// Reply read from the `AF_PACKET` ring. Blocks are handed over with a delay, so the
+/// receive time is the software capture time moved to the monotonic clock. Hardware
+/// capture times are on the NIC clock, which needn't follow `CLOCK_REALTIME`: such
+/// frames are timed when they are read (kernel timestamps still use them for RTT).
+static void engine_packet_recv(const PacketFrame *frame, void *ctx) {
+    Engine *self = ctx;
+    struct timespec recv_at;
+    if (icmp_timestamp_valid(&frame->ts.sw)) recv_at = ts_add_ns(frame->ts.sw, -self->clock_offset);
+    else engine_now(self, &recv_at);
+
+    EngineReply reply = {.eth = frame->eth, .ip6 = frame->ip6, .view = frame->view};
+    engine_dispatch(self, &reply, &frame->from, &recv_at, self->kernel_ts ? &frame->ts : NULL);
+}
+
+/// Forget the TX timestamp id given to the send of wire sequence number `seq` that failed:
+/// the kernel numbers only packets it sent, so ids of the sends queued after it move down by one.
+/// Sends complete in order, so it is one of the last `URING_SENDS` ids.
+static void engine_untrack_tx(Engine *self, uint16_t seq) {
+    for (uint32_t k = 1; k <= URING_SENDS && k <= self->tx_id; k++) {
+        uint32_t id = self->tx_id - k;
+        if (self->tx_seqs[id & UINT16_MAX] != seq) continue;
+        for (; id + 1 < self->tx_id; id++) self->tx_seqs[id & UINT16_MAX] = self->tx_seqs[(id + 1) & UINT16_MAX];
+        self->tx_id --;
+        return;
+    }
+}
+
+/// Queued send with wire sequence number `seq` failed, the probe stays counted as sent and is lost.
+static void engine_uring_send_err(uint64_t seq, int err, void *ctx) {
+    (void)err;
+    Engine *self = ctx;
+    if (self->kernel_ts) engine_untrack_tx(self, (uint16_t)seq);
+    EngineProbe *probe = &self->probes[seq & UINT16_MAX];
+    if (probe->target == 0) return;
+    probe->target = 0;
+    self->outstanding --;
+    wheel_remove(&self->wheel, &probe->timer);
+}
+
+/// Handle all `io_uring` completions.
+static IcmpResult engine_uring_reap(Engine *self) {
+    if (uring_reap(&self->uring, engine_uring_recv, engine_uring_send_err, self) == 0) return IcmpOk;
+    if (errno != EINVAL) return IcmpRecvFromErr;
+    // Kernels before 6.0 have `io_uring` but no multishot receive, the socket takes over for good.
+    uring_close(&self->uring);
+    self->io_uring = false;
+    return IcmpOk;
+}
+
+/// Receive replies with `recvmmsg` into the receive ring until the socket is drained.
+static IcmpResult engine_recv_batch(Engine *self) {
+    while (true) {
+        size_t received = 0;
+        IcmpResult res;
+        if (self->opts.transport != NULL) {
+            res = self->opts.transport->recv(self->opts.transport->ctx, self->ring, ICMP_BATCH_MAX, &received);
+        } else if (self->kind == IcmpSockDgram) {
+            res = icmp_func.recv_dgram_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        } else if (self->ip == IPv4) {
+            res = icmp_func.recv4_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        } else {
+            res = icmp_func.recv6_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        }
+        if (res == IcmpRecvFromErr && (errno == EAGAIN || errno == EWOULDBLOCK)) return IcmpOk;
+        if (res != IcmpOk) return res;
+
+        struct timespec recv_at;
+        engine_now(self, &recv_at);
+        for (size_t i = 0; i < received; i++) {
+            IcmpRecvSlot *slot = &self->ring[i];
+            // Corrupted packets are dropped just like foreign ones.
+            if (slot->res != IcmpOk) continue;
+            EngineReply reply = {.info6 = self->ip == IPv6 ? &slot->info6 : NULL, .view = slot->view};
+            engine_dispatch(self, &reply, &slot->addr, &recv_at, self->kernel_ts ? &slot->ts : NULL);
+        }
+        // Short batch means the socket queue is empty, spare one more syscall.
+        if (received < ICMP_BATCH_MAX) return IcmpOk;
+    }
+}
+
+/// Attach TX timestamps from the socket error queue to their outstanding probes.
+static void engine_recv_tx_timestamps(Engine *self) {
+    size_t received = 0;
+    while (icmp_func.recv_tx_ts(self->tx_stamps, ICMP_BATCH_MAX, self->sockfd, &received) == IcmpOk) {
+        for (size_t i = 0; i < received; i++) {
+            const IcmpTxTimestamp *stamp = &self->tx_stamps[i];
+            EngineProbe *probe = &self->probes[self->tx_seqs[stamp->id & UINT16_MAX]];
+            if (probe->target != 0) probe->tx_ts = stamp->ts;
+        }
+    }
+}
+
+IcmpResult engine_recv(Engine *self) {
+    // TX timestamp is queued before the packet leaves the host, so it is always
+    // available by the time we read the reply.
+    if (self->kernel_ts) engine_recv_tx_timestamps(self);
+    if (self->io_uring) {
+        IcmpResult res = engine_uring_reap(self);
+        if (res != IcmpOk) return res;
+    }
+    if (self->packet_ring) {
+        self->clock_offset = engine_clock_offset();
+        packet_ring_read(&self->packet, engine_packet_recv, self);
+        return IcmpOk;
+    }
+    if (self->io_uring) return IcmpOk;
+    // Only the batched path reads ancillary data with kernel timestamps and IPv6 header fields,
+    // and transports receive in batches only.
+    if (self->outstanding > 1 || self->kernel_ts || self->ip == IPv6 || self->opts.transport != NULL) {
+        return engine_recv_batch(self);
+    }
+    u_char *buf = self->ring[0].buf;
+    int buf_len = (int)self->ring[0].cap;
+    while (true) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        IcmpView view;
+        IcmpResult res;
+        if (self->kind == IcmpSockDgram) {
+            res = icmp_func.recv_dgram(&view, self->sockfd, buf, buf_len, &from, &from_len);
+        } else if (self->ip == IPv4) {
+            res = icmp_func.recv4(&view, self->sockfd, buf, buf_len, &from, &from_len);
+        } else {
+            res = icmp_func.recv6(&view, self->sockfd, buf, buf_len, &from, &from_len);
+        }
+        if (res == IcmpRecvFromErr && (errno == EAGAIN || errno == EWOULDBLOCK)) return IcmpOk;
+        // Corrupted packets are dropped just like foreign ones.
+        if (
+            res == IcmpNoReplyErr || res == IcmpInvalidIpCksumErr || res == IcmpInvalidIcmpCksumErr ||
+            res == IcmpMalformedErr
+        ) continue;
+        if (res != IcmpOk) return res;
+        struct timespec recv_at;
+        engine_now(self, &recv_at);
+        EngineReply reply = {.view = view};
+        engine_dispatch(self, &reply, &from, &recv_at, NULL);
+    }
+}
+
+/// Spin on non-blocking receives instead of sleeping for up to `busy_poll` microseconds of `*wait`
+/// nanoseconds. `*wait` is left with the time still to wait, 0 once a reply was dispatched.
+static IcmpResult engine_spin(Engine *self, long long *wait) {
+    long long budget = (long long)self->opts.busy_poll * NANOS_IN_MICRO;
+    if (budget > *wait) budget = *wait;
+    size_t outstanding = self->outstanding;
+    struct timespec start, now;
+    engine_now(self, &start);
+    long long spent = 0;
+    while (spent < budget && self->stop == false) {
+        IcmpResult res = engine_recv(self);
+        if (res != IcmpOk) return res;
+        engine_now(self, &now);
+        spent = (long long)(calc_time(&start, &now) * NANOS_IN_MILLI);
+        // Replies may complete a flood round, so the loop goes around right away.
+        if (self->outstanding != outstanding) {
+            *wait = 0;
+            return IcmpOk;
+        }
+    }
+    *wait = *wait > spent ? *wait - spent : 0;
+    return IcmpOk;
+}
+
+/// Return: true if every probe of every target, including ones still being resolved, was sent.
+/// An engine left without targets is done too, even if it would ping forever.
+static bool engine_all_sent(const Engine *self) {
+    return (self->opts.count != 0 || self->n_owned == 0)
+        && target_list_done(self->targets)
+        && self->n_known == target_list_ready(self->targets)
+        && self->n_done == self->n_owned;
+}
+
+IcmpResult engine_run(Engine *self) {
+    struct pollfd pfds[] = {
+        {.fd = self->sockfd, .events = POLLIN},
+        {.fd = self->wakefd, .events = POLLIN},
+        // Completions of `io_uring`, polled only while it is used.
+        {.fd = -1, .events = POLLIN},
+        // Blocks of the `AF_PACKET` ring.
+        {.fd = self->packet_ring ? self->packet.fd : -1, .events = POLLIN},
+    };
+    long long interval = (long long)(self->opts.interval * NANOS_IN_MILLI);
+    // Without a timeout late replies are awaited for a fixed time after the last round.
+    double linger_ms = self->opts.timeout > 0 ? self->opts.timeout : LINGER_MS;
+    struct timespec now, next_send, linger, end;
+    // Deadline of the last wait, the loop is late by however far past it it wakes up.
+    struct timespec wake_at;
+    bool waiting = false;
+    long long busy_poll = self->opts.transport == NULL ? (long long)self->opts.busy_poll * NANOS_IN_MICRO : 0;
+    engine_now(self, &now);
+    next_send = now;
+    end = ts_add_ns(now, (long long)(self->opts.deadline * NANOS_IN_MILLI));
+    bool lingering = false;
+
+    while (self->stop == false) {
+        engine_now(self, &now);
+        if (waiting && calc_time(&wake_at, &now) >= 0) {
+            hist_record(&self->lag, (uint64_t)llround(calc_time(&wake_at, &now) * NANOS_IN_MILLI));
+        }
+        waiting = false;
+        if (self->opts.deadline > 0 && calc_time(&end, &now) >= 0) break;
+        wheel_advance(&self->wheel, (uint64_t)engine_ms(self, &now), engine_expire, self);
+
+        bool due = calc_time(&next_send, &now) >= 0 || (self->opts.flood && self->outstanding == 0);
+        // Freshly resolved targets are probed right away, unless the round is about to do that.
+        IcmpResult res = engine_refresh_targets(self, due == false);
+        // Probes that failed to go out are counted as lost, only errors of the socket itself end the run.
+        if (res != IcmpOk) return res;
+        if (engine_all_sent(self) == false && due) {
+            res = engine_send_round(self);
+            if (res != IcmpOk) return res;
+            // Keep the schedule absolute, unless we fell behind it by more than one interval.
+            next_send = ts_add_ns(next_send, interval);
+            if (calc_time(&next_send, &now) >= 0) next_send = ts_add_ns(now, interval);
+        }
+        // Even when the next round is already due, replies are drained first (zero timeout).
+        bool all_sent = engine_all_sent(self);
+        if (all_sent && lingering == false) {
+            linger = ts_add_ns(now, (long long)(linger_ms * NANOS_IN_MILLI));
+            lingering = true;
+        }
+        const struct timespec *deadline = all_sent ? &linger : &next_send;
+        if (all_sent && (self->outstanding == 0 || calc_time(deadline, &now) >= 0)) break;
+
+        // Sleep until the next send, timer tick or the deadline, whichever is first.
+        double wait_ms = calc_time(&now, deadline);
+        if (self->opts.deadline > 0) wait_ms = fmin(wait_ms, calc_time(&now, &end));
+        uint64_t next_tick = wheel_next(&self->wheel);
+        if (next_tick != UINT64_MAX) wait_ms = fmin(wait_ms, (double)next_tick - engine_ms(self, &now));
+        // Rounded up: a wait cut to zero short of a tick would spin until the tick starts.
+        long long wait = (long long)ceil(wait_ms * NANOS_IN_MILLI);
+        if (wait > 0) {
+            wake_at = ts_add_ns(now, wait);
+            waiting = true;
+        }
+        if (wait > 0 && self->on_idle) self->on_idle(self->ctx);
+        if (busy_poll > 0 && wait > 0) {
+            // Replies are awaited spinning while they are due, and so is the deadline itself.
+            if (self->outstanding > 0 || wait <= busy_poll) {
+                res = engine_spin(self, &wait);
+                if (res != IcmpOk) return res;
+            }
+            // Sleep wakes up one budget ahead of the deadline, the rest of the way is spun.
+            wait = wait > busy_poll ? wait - busy_poll : 0;
+        }
+        struct timespec timeout = ts_add_ns((struct timespec){0, 0}, wait > 0 ? wait : 0);
+        const Transport *transport = self->opts.transport;
+        if (transport != NULL) {
+            int ready = transport->wait(transport->ctx, &timeout);
+            if (ready == -1) return IcmpRecvFromErr;
+            res = ready > 0 ? engine_recv(self) : IcmpOk;
+            if (res != IcmpOk) return res;
+            continue;
+        }
+        // With `io_uring` or the packet ring replies come from elsewhere, the socket is left for TX timestamps.
+        pfds[0].events = self->io_uring || self->packet_ring ? 0 : POLLIN;
+        pfds[2].fd = self->io_uring ? self->uring.fd : -1;
+        if (ppoll(pfds, 4, &timeout, NULL) == -1) {
+            if (errno == EINTR) continue;
+            return IcmpRecvFromErr;
+        }
+        // TX timestamps in the error queue are reported as POLLERR.
+        if ((pfds[0].revents & (POLLIN | POLLERR)) || (pfds[2].revents & POLLIN) || (pfds[3].revents & POLLIN)) {
+            res = engine_recv(self);
+            if (res != IcmpOk) return res;
+        }
+        // Wakeups only interrupt the wait, new targets are picked up at the top of the loop.
+        if (pfds[1].revents & POLLIN) {
+            uint64_t wakeups;
+            (void)!read(self->wakefd, &wakeups, sizeof(wakeups));
+        }
+    }
+    return IcmpOk;
+}
+
+void engine_stop(Engine *self) {
+    self->stop = true;
+    uint64_t one = 1;
+    (void)!write(self->wakefd, &one, sizeof(one));
+}
+
+void engine_free(Engine *self) {
+    if (self->io_uring) uring_close(&self->uring);
+    if (self->packet_ring) packet_ring_close(&self->packet);
+    (void)close(self->wakefd);
+    icmp_recv_ring_free(self->ring);
+    hist_free(&self->lag);
+}
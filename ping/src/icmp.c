@@ -1,17 +1,36 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <netinet/ip6.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 
 #include "../include/icmp.h"
 
 const icmp_func_set icmp_func = {
     .new_echo4_req = new_echo4_request,
     .new_echo6_req = new_echo6_request,
+    .echo4_template = icmp_echo4_template,
+    .echo6_template = icmp_echo6_template,
+    .echo_update = icmp_echo_update,
     .send = icmp_send,
     .recv4 = recv_ip4_icmp,
     .recv6 = recv_ip6_icmp,
+    .recv_dgram = recv_dgram_icmp,
+    .send_batch = icmp_send_batch,
+    .send_batch_payload = icmp_send_batch_payload,
+    .recv4_batch = recv_ip4_icmp_batch,
+    .recv6_batch = recv_ip6_icmp_batch,
+    .recv_dgram_batch = recv_dgram_icmp_batch,
+    .recv_tx_ts = icmp_recv_tx_timestamps,
+    .parse = icmp_view_parse,
+    .parse_batch = icmp_view_parse_batch,
     .strerror = icmp_strerror,
 };
 
@@ -27,69 +46,180 @@ const char *icmp_strerror(IcmpResult res) {
         return "received ip frame with invalid checksum";
     case IcmpInvalidIcmpCksumErr:
         return "received icmp packet with invalid checksum";
+    case IcmpNoReplyErr:
+        return "received only our own echo requests";
+    case IcmpMalformedErr:
+        return "received packet too short for its headers";
     }
+    return "unknown error";
 }
 
-/// IcmpV6 Pseudo Header according to https://en.wikipedia.org/wiki/ICMPv6#Checksum
-typedef struct Icmp6PseudoHeader {
-    struct in6_addr src;
-    struct in6_addr dest;
-    // IcmpV6 packet length
-    uint length;
-    // Zeros
-    const uint8_t _padding[3];
-    // Always 58
-    const uint8_t header;
-} Icmp6PseudoHeader;
-
-Icmp6PseudoHeader new_pseudo_header(struct in6_addr src, struct in6_addr dest, uint length) {
-    Icmp6PseudoHeader ph = {
-        .src = src,
-        .dest = dest,
-        .length = length,
-        ._padding = {0, 0, 0},
-        .header = 58
-    };
-    return ph;
+/// Open ping socket and bind it, so the kernel picks the identifier right away.
+static int icmp_dgram_socket(IpVersion ip, uint16_t *id) {
+    int sockfd = ip == IPv4
+        ? socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP)
+        : socket(AF_INET6, SOCK_DGRAM, IPPROTO_ICMPV6);
+    if (sockfd < 0) return -1;
+
+    struct sockaddr_storage addr = {.ss_family = ip == IPv4 ? AF_INET : AF_INET6};
+    socklen_t addr_len = ip == IPv4 ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    if (
+        bind(sockfd, (struct sockaddr *)&addr, addr_len) == -1 ||
+        getsockname(sockfd, (struct sockaddr *)&addr, &addr_len) == -1
+    ) {
+        int err = errno;
+        close(sockfd);
+        errno = err;
+        return -1;
+    }
+    // Identifier of ping sockets is their "port".
+    *id = ntohs(ip == IPv4 ? ((struct sockaddr_in *)&addr)->sin_port : ((struct sockaddr_in6 *)&addr)->sin6_port);
+    return sockfd;
 }
 
-uint16_t in_cksum(const char *addr, size_t size, uint16_t start) {
-    int sum = start;
-    while (size >= 2) {
-        sum += *(uint16_t *)addr;
-        addr += 2;
-        size -= 2;
+/// Ask for IPv6 header fields as ancillary data; on raw sockets, also drop every ICMPv6 type
+/// but echo reply and errors before the packet is even queued (cheaper than the BPF filter).
+static int icmp6_setup_socket(int sockfd, IcmpSocketKind kind) {
+    int on = 1;
+    if (
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) == -1 ||
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) == -1
+    ) return -1;
+    if (kind == IcmpSockDgram) return 0;
+
+    struct icmp6_filter filter;
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+    ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter);
+    ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter);
+    ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter);
+    ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &filter);
+    return setsockopt(sockfd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter));
+}
+
+int icmp_socket(IpVersion ip, IcmpSocketKind kind, uint16_t *id) {
+    int sockfd = -1;
+    if (kind != IcmpSockRaw) {
+        sockfd = icmp_dgram_socket(ip, id);
+        if (sockfd >= 0) kind = IcmpSockDgram;
+        else if (kind == IcmpSockDgram) return -1;
+    }
+    if (sockfd == -1) {
+        kind = IcmpSockRaw;
+        sockfd = ip == IPv4
+            ? socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)
+            : socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+        if (sockfd == -1) return -1;
     }
-    if (size == 1) {
-        sum += *(uint8_t *)addr;
+    if (ip == IPv6 && icmp6_setup_socket(sockfd, kind) == -1) {
+        int err = errno;
+        close(sockfd);
+        errno = err;
+        return -1;
     }
-    const int uint16_mask = 0xffff;
-    sum = (sum >> 16) + (sum & uint16_mask);
-    sum += (sum >> 16);
-    return (uint16_t)(~sum);
+    return sockfd;
 }
 
-IcmpPacket *new_echo_default(uint16_t id, uint16_t seq) {
-    IcmpPacket *icm = malloc(sizeof(IcmpPacket));
-    memset(icm, 0, sizeof(*icm));
-    icm->h_id = htons(id);
-    icm->h_seq = htons(seq);
-    clock_gettime(CLOCK_MONOTONIC_RAW, &icm->ts_creation);
-    return icm;
+IcmpSocketKind icmp_socket_kind(int sockfd) {
+    int type = SOCK_RAW;
+    socklen_t len = sizeof(type);
+    (void)getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &type, &len);
+    return type == SOCK_DGRAM ? IcmpSockDgram : IcmpSockRaw;
+}
+
+int icmp_attach_filter(int sockfd, IpVersion ip, uint16_t id) {
+    // Raw IPv4 sockets see the IP header, so X register holds its length and offsets are relative to it.
+    // Raw IPv6 sockets start right at the ICMPv6 header, the quoted IPv6 header of errors is 40 bytes.
+    struct sock_filter ip4_code[] = {
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 2),
+        // Echo reply: our identifier.
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 11, 12),
+        // Errors quoting the original datagram.
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_DEST_UNREACH, 3, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIME_EXCEEDED, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_PARAMETERPROB, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_SOURCE_QUENCH, 0, 8),
+        // X += length of the quoted IP header, so X + 8 points to the quoted ICMP header.
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_filter ip6_code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 2),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 3, 4),
+        // Error messages have types 1-4 and quote the IPv6 header of the original packet.
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, ICMP6_PARAM_PROB, 3, 0),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 8 + 40 + 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = ip == IPv4
+        ? (struct sock_fprog){sizeof(ip4_code) / sizeof(*ip4_code), ip4_code}
+        : (struct sock_fprog){sizeof(ip6_code) / sizeof(*ip6_code), ip6_code};
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+int icmp_attach_drop_filter(int sockfd) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = {sizeof(code) / sizeof(*code), code};
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+void icmp_echo4_template(IcmpPacket *self, uint16_t id) {
+    memset(self, 0, sizeof(*self));
+    self->h_type = ICMP_ECHO;
+    self->h_id = htons(id);
+    self->h_cksum = in_cksum((char *)self, sizeof(*self), 0);
+}
+
+void icmp_echo6_template(IcmpPacket *self, uint16_t id) {
+    memset(self, 0, sizeof(*self));
+    self->h_type = ICMP6_ECHO_REQUEST;
+    self->h_id = htons(id);
+}
+
+void icmp_echo_update(IcmpPacket *self, uint16_t seq, const struct timespec *ts) {
+    uint16_t new_seq = htons(seq);
+    if (self->h_type == ICMP6_ECHO_REQUEST) {
+        self->h_seq = new_seq;
+        self->ts_creation = *ts;
+        return;
+    }
+    self->h_cksum = in_cksum_update(self->h_cksum, &self->h_seq, &new_seq, sizeof(new_seq));
+    self->h_seq = new_seq;
+    self->h_cksum = in_cksum_update(self->h_cksum, &self->ts_creation, ts, sizeof(*ts));
+    self->ts_creation = *ts;
 }
 
 IcmpPacket *new_echo4_request(uint16_t id, uint16_t seq) {
-    IcmpPacket *icm = new_echo_default(id, seq);
-    icm->h_type = ICMP_ECHO;
-    icm->h_cksum = in_cksum((char *)icm, sizeof(*icm), 0);
+    IcmpPacket *icm = malloc(sizeof(IcmpPacket));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    icmp_echo4_template(icm, id);
+    icmp_echo_update(icm, seq, &now);
     return icm;
 }
 
-IcmpPacket *new_echo6_request(struct in6_addr src, struct in6_addr dest, uint16_t id, uint16_t seq) {
-    IcmpPacket *icm = new_echo_default(id, seq);
-    icm->h_type = ICMP6_ECHO_REQUEST;
-    Icmp6PseudoHeader ph = new_pseudo_header(src, dest, sizeof(*icm));
-    icm->h_cksum = in_cksum((char *)icm, sizeof(*icm), in_cksum((char *)&ph, sizeof(ph), 0));
+IcmpPacket *new_echo6_request(uint16_t id, uint16_t seq) {
+    IcmpPacket *icm = malloc(sizeof(IcmpPacket));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    icmp_echo6_template(icm, id);
+    icmp_echo_update(icm, seq, &now);
     return icm;
 }
 
@@ -100,75 +230,390 @@ IcmpResult icmp_send(const IcmpPacket *self, int sockfd, const struct sockaddr_s
     return IcmpOk;
 }
 
-bool icmp_verify_checksum(IcmpPacket *self, const Icmp6PseudoHeader *const pseudo) {
-    uint16_t save = self->h_cksum;
-    self->h_cksum = 0;
-    uint16_t start = (pseudo == NULL ? 0 : in_cksum((char *)pseudo, sizeof(*pseudo), 0));
-    uint16_t cksum = in_cksum((char *)self, sizeof(*self), start);
-    self->h_cksum = save;
-    return save == cksum;
+IcmpResult icmp_view_parse(
+    IcmpView *view, IcmpSocketKind kind, IpVersion ip, const u_char buf[], size_t len, unsigned flags
+) {
+    memset(view, 0, sizeof(*view));
+    if (kind != IcmpSockRaw || ip != IPv4) {
+        // ICMPv6 and ping sockets deliver the ICMP message alone, with checksum verified by the kernel.
+        if (len < sizeof(struct icmphdr)) return IcmpMalformedErr;
+        view->icm = (const IcmpPacket *)buf;
+        view->icmp_len = len;
+        return IcmpOk;
+    }
+    const struct iphdr *ip4 = (const struct iphdr *)buf;
+    if (len < sizeof(*ip4)) return IcmpMalformedErr;
+    size_t ip_len = (size_t)ip4->ihl * sizeof(int32_t);
+    // Link-layer rings may deliver padding past the total length, but never less of it.
+    size_t tot_len = ntohs(ip4->tot_len);
+    if (ip_len < sizeof(*ip4) || tot_len < ip_len + sizeof(struct icmphdr) || tot_len > len) return IcmpMalformedErr;
+    // Valid header or message sums up to zero together with its checksum.
+    if ((flags & ICMP_VIEW_SKIP_IP_CKSUM) == 0 && in_cksum((const char *)buf, ip_len, 0) != 0) {
+        return IcmpInvalidIpCksumErr;
+    }
+    if (in_cksum((const char *)buf + ip_len, tot_len - ip_len, 0) != 0) return IcmpInvalidIcmpCksumErr;
+    view->ip4 = ip4;
+    view->icm = (const IcmpPacket *)(buf + ip_len);
+    view->icmp_len = tot_len - ip_len;
+    return IcmpOk;
 }
 
-// TODO Move to separate library.
-bool ip_verify_checksum(struct iphdr *ip) {
-    uint16_t save = ip->check;
-    ip->check = 0;
-    uint16_t cksum = in_cksum((char *)ip, ip->ihl * sizeof(int32_t), 0);
-    ip->check = save;
-    return save == cksum;
+void icmp_view_parse_batch(IcmpRecvSlot slots[], size_t n, IcmpSocketKind kind, IpVersion ip, unsigned flags) {
+    for (size_t i = 0; i < n; i++) {
+        slots[i].res = icmp_view_parse(&slots[i].view, kind, ip, slots[i].buf, slots[i].len, flags);
+    }
 }
 
 IcmpResult recv_ip4_icmp(
-    struct iphdr **ip, IcmpPacket **icm, int sockfd, u_char buf[], int buf_len,
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
+    struct sockaddr_storage *addr, socklen_t *addr_len
+) {
+    socklen_t addr_cap = *addr_len;
+    for (int i = 0; i < ICMP_RECV_MAX_SKIP; i++) {
+        *addr_len = addr_cap;
+        ssize_t recv_len = recvfrom(sockfd, buf, buf_len, 0, (struct sockaddr *)addr, addr_len);
+        if (recv_len == -1) {
+            // perror("recvfrom");
+            return IcmpRecvFromErr;
+        }
+
+        IcmpResult res = icmp_view_parse(view, IcmpSockRaw, IPv4, buf, recv_len, ICMP_VIEW_SKIP_IP_CKSUM);
+        if (res != IcmpOk) return res;
+        // If we're pinging localhost, we'll receive our message too, so filter them out.
+        if (icmp_view_type(view) != ICMP_ECHO) return IcmpOk;
+    }
+    return IcmpNoReplyErr;
+}
+
+IcmpResult recv_ip6_icmp(
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
     struct sockaddr_storage *addr, socklen_t *addr_len
 ) {
-    size_t recv_len = recvfrom(sockfd, buf, buf_len, 0, (struct sockaddr *)addr, addr_len);
+    socklen_t addr_cap = *addr_len;
+    for (int i = 0; i < ICMP_RECV_MAX_SKIP; i++) {
+        *addr_len = addr_cap;
+        ssize_t recv_len = recvfrom(sockfd, buf, buf_len, 0, (struct sockaddr *)addr, addr_len);
+        if (recv_len == -1) {
+            // perror("recvfrom");
+            return IcmpRecvFromErr;
+        }
+
+        IcmpResult res = icmp_view_parse(view, IcmpSockRaw, IPv6, buf, recv_len, 0);
+        if (res != IcmpOk) return res;
+        // If we're pinging localhost, we'll receive our message too, so filter them out.
+        if (icmp_view_type(view) != ICMP6_ECHO_REQUEST) return IcmpOk;
+    }
+    return IcmpNoReplyErr;
+}
+
+IcmpResult recv_dgram_icmp(
+    IcmpView *view, int sockfd, u_char buf[], int buf_len,
+    struct sockaddr_storage *addr, socklen_t *addr_len
+) {
+    ssize_t recv_len = recvfrom(sockfd, buf, buf_len, 0, (struct sockaddr *)addr, addr_len);
     if (recv_len == -1) {
-        // perror("recvfrom");
         return IcmpRecvFromErr;
     }
+    return icmp_view_parse(view, IcmpSockDgram, IPv4, buf, recv_len, 0);
+}
 
-    *ip = (struct iphdr *)buf;
-    struct iphdr *pip = *ip;
-    if (ip_verify_checksum(*ip) == false) return IcmpInvalidIpCksumErr;
-    pip->tot_len = ntohs(pip->tot_len);
-    pip->id = ntohs(pip->id);
-    pip->frag_off = ntohs(pip->frag_off);
+/// Zeros echo requests are padded with, they leave the ICMPv4 checksum unchanged.
+static const u_char zero_pad[UINT16_MAX];
 
-    *icm = (struct IcmpPacket *)(buf + pip->ihl * sizeof(int32_t));
-    IcmpPacket *picm = (struct IcmpPacket *)(*icm);
-    // If we're pinging localhost, we'll receive our message too, so filter them out.
-    if (picm->h_type == ICMP_ECHO) {
-        return recv_ip4_icmp(ip, icm, sockfd, buf, buf_len, addr, addr_len);
-    }
-    if (icmp_verify_checksum(picm, NULL) == false) return IcmpInvalidIcmpCksumErr;
+/// Send packets in chunks of `ICMP_BATCH_MAX`, with TTL control messages if `ttls` is given,
+/// padded with zeros to `lens` bytes if it is given, followed by `payload` otherwise.
+static IcmpResult send_batch(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], const uint8_t ttls[],
+    const uint16_t lens[], const u_char payload[], size_t payload_len, size_t n, int sockfd, size_t *sent
+) {
+    struct mmsghdr msgs[ICMP_BATCH_MAX];
+    struct iovec iovs[ICMP_BATCH_MAX][2];
+    u_char control[ICMP_BATCH_MAX][CMSG_SPACE(sizeof(int))];
+    *sent = 0;
+    while (*sent < n) {
+        size_t chunk = n - *sent < ICMP_BATCH_MAX ? n - *sent : ICMP_BATCH_MAX;
+        memset(msgs, 0, chunk * sizeof(*msgs));
+        for (size_t i = 0; i < chunk; i++) {
+            iovs[i][0].iov_base = (void *)packets[*sent + i];
+            iovs[i][0].iov_len = sizeof(IcmpPacket);
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (lens != NULL && lens[*sent + i] > sizeof(IcmpPacket)) {
+                iovs[i][1].iov_base = (void *)zero_pad;
+                iovs[i][1].iov_len = lens[*sent + i] - sizeof(IcmpPacket);
+                msgs[i].msg_hdr.msg_iovlen = 2;
+            } else if (payload_len > 0) {
+                iovs[i][1].iov_base = (void *)payload;
+                iovs[i][1].iov_len = payload_len;
+                msgs[i].msg_hdr.msg_iovlen = 2;
+            }
+            msgs[i].msg_hdr.msg_name = (void *)addrs[*sent + i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            if (ttls == NULL) continue;
 
-    picm->h_id = ntohs(picm->h_id);
-    picm->h_seq = ntohs(picm->h_seq);
+            memset(control[i], 0, sizeof(control[i]));
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+            bool ip6 = addrs[*sent + i]->ss_family == AF_INET6;
+            cmsg->cmsg_level = ip6 ? IPPROTO_IPV6 : IPPROTO_IP;
+            cmsg->cmsg_type = ip6 ? IPV6_HOPLIMIT : IP_TTL;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            int ttl = ttls[*sent + i];
+            memcpy(CMSG_DATA(cmsg), &ttl, sizeof(ttl));
+        }
+        int res = sendmmsg(sockfd, msgs, chunk, 0);
+        if (res == -1) return IcmpSendToErr;
+        *sent += res;
+    }
     return IcmpOk;
 }
 
-IcmpResult recv_ip6_icmp(
-    IcmpPacket **icm, int sockfd, u_char buf[], int buf_len,
-    struct sockaddr_storage *addr, socklen_t *addr_len
+IcmpResult icmp_send_batch(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], size_t n,
+    int sockfd, size_t *sent
 ) {
-    size_t recv_len = recvfrom(sockfd, buf, buf_len, 0, (struct sockaddr *)addr, addr_len);
-    if (recv_len == -1) {
-        // perror("recvfrom");
+    return send_batch(packets, addrs, NULL, NULL, NULL, 0, n, sockfd, sent);
+}
+
+IcmpResult icmp_send_batch_ttl(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], const uint8_t ttls[],
+    size_t n, int sockfd, size_t *sent
+) {
+    return send_batch(packets, addrs, ttls, NULL, NULL, 0, n, sockfd, sent);
+}
+
+IcmpResult icmp_send_batch_len(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[], const uint16_t lens[],
+    size_t n, int sockfd, size_t *sent
+) {
+    return send_batch(packets, addrs, NULL, lens, NULL, 0, n, sockfd, sent);
+}
+
+IcmpResult icmp_send_batch_payload(
+    const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[],
+    const u_char payload[], size_t payload_len, size_t n, int sockfd, size_t *sent
+) {
+    return send_batch(packets, addrs, NULL, NULL, payload, payload_len, n, sockfd, sent);
+}
+
+int icmp_set_dont_fragment(int sockfd, IpVersion ip) {
+    // Probe mode sets DF, but neither fragments locally nor clamps packets to the cached path MTU.
+    int mode = ip == IPv4 ? IP_PMTUDISC_PROBE : IPV6_PMTUDISC_PROBE;
+    if (ip == IPv4) return setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode));
+    int on = 1;
+    if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &mode, sizeof(mode)) == -1) return -1;
+    return setsockopt(sockfd, IPPROTO_IPV6, IPV6_DONTFRAG, &on, sizeof(on));
+}
+
+/// Return: true if `type` is an ICMPv4 error that quotes the original datagram.
+static bool icmp4_is_error(uint8_t type) {
+    return type == ICMP_DEST_UNREACH || type == ICMP_TIME_EXCEEDED
+        || type == ICMP_PARAMETERPROB || type == ICMP_SOURCE_QUENCH;
+}
+
+/// Fill `reply` with identifier and sequence number of the echo header `echo` (network byte order).
+static void probe_reply_echo(IcmpProbeReply *reply, const u_char *echo) {
+    const struct icmphdr *hdr = (const struct icmphdr *)echo;
+    reply->id = ntohs(hdr->un.echo.id);
+    reply->seq = ntohs(hdr->un.echo.sequence);
+}
+
+static IcmpResult parse_probe_reply4(const u_char buf[], size_t len, IcmpProbeReply *reply) {
+    const struct iphdr *ip = (const struct iphdr *)buf;
+    if (len < sizeof(*ip)) return IcmpNoReplyErr;
+    size_t ip_len = (size_t)ip->ihl * sizeof(int32_t);
+    if (ip_len < sizeof(*ip) || len < ip_len + ICMP_MINLEN) return IcmpNoReplyErr;
+    // Valid header sums up to zero together with its checksum.
+    if (in_cksum((const char *)buf, ip_len, 0) != 0) return IcmpInvalidIpCksumErr;
+    size_t icmp_len = ntohs(ip->tot_len) > ip_len ? ntohs(ip->tot_len) - ip_len : 0;
+    if (icmp_len <= len - ip_len && in_cksum((const char *)buf + ip_len, icmp_len, 0) != 0) {
+        return IcmpInvalidIcmpCksumErr;
+    }
+
+    const u_char *icmp = buf + ip_len;
+    reply->type = icmp[0];
+    reply->code = icmp[1];
+    if (reply->type == ICMP_ECHOREPLY) {
+        probe_reply_echo(reply, icmp);
+        return IcmpOk;
+    }
+    if (icmp4_is_error(reply->type) == false) return IcmpNoReplyErr;
+    if (reply->type == ICMP_DEST_UNREACH && reply->code == ICMP_FRAG_NEEDED) {
+        reply->mtu = ntohs(((const struct icmphdr *)icmp)->un.frag.mtu);
+    }
+    // Quoted datagram: its IP header and at least 8 bytes of our echo request.
+    const u_char *quoted = icmp + ICMP_MINLEN;
+    if (len < ip_len + ICMP_MINLEN + sizeof(*ip)) return IcmpNoReplyErr;
+    const struct iphdr *quoted_ip = (const struct iphdr *)quoted;
+    size_t quoted_ip_len = (size_t)quoted_ip->ihl * sizeof(int32_t);
+    if (quoted_ip->protocol != IPPROTO_ICMP || quoted_ip_len < sizeof(*ip)) return IcmpNoReplyErr;
+    if (len < ip_len + ICMP_MINLEN + quoted_ip_len + ICMP_MINLEN) return IcmpNoReplyErr;
+    if (quoted[quoted_ip_len] != ICMP_ECHO) return IcmpNoReplyErr;
+    probe_reply_echo(reply, quoted + quoted_ip_len);
+    return IcmpOk;
+}
+
+static IcmpResult parse_probe_reply6(const u_char buf[], size_t len, IcmpProbeReply *reply) {
+    // Raw ICMPv6 sockets have no IP header and the kernel has verified the checksum.
+    if (len < sizeof(struct icmp6_hdr)) return IcmpNoReplyErr;
+    reply->type = buf[0];
+    reply->code = buf[1];
+    if (reply->type == ICMP6_ECHO_REPLY) {
+        probe_reply_echo(reply, buf);
+        return IcmpOk;
+    }
+    // Errors have types below 128 and quote the original packet, extension headers are not followed.
+    if (reply->type > ICMP6_PARAM_PROB) return IcmpNoReplyErr;
+    if (reply->type == ICMP6_PACKET_TOO_BIG) reply->mtu = ntohl(((const struct icmp6_hdr *)buf)->icmp6_mtu);
+    const u_char *quoted = buf + sizeof(struct icmp6_hdr);
+    if (len < sizeof(struct icmp6_hdr) + sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr)) return IcmpNoReplyErr;
+    if (((const struct ip6_hdr *)quoted)->ip6_nxt != IPPROTO_ICMPV6) return IcmpNoReplyErr;
+    if (quoted[sizeof(struct ip6_hdr)] != ICMP6_ECHO_REQUEST) return IcmpNoReplyErr;
+    probe_reply_echo(reply, quoted + sizeof(struct ip6_hdr));
+    return IcmpOk;
+}
+
+IcmpResult icmp_parse_probe_reply(IpVersion ip, const u_char buf[], size_t len, IcmpProbeReply *reply) {
+    memset(reply, 0, sizeof(*reply));
+    return ip == IPv4 ? parse_probe_reply4(buf, len, reply) : parse_probe_reply6(buf, len, reply);
+}
+
+void icmp_read_control(struct msghdr *msg, IcmpTimestamp *ts, Icmp6Info *info6) {
+    memset(ts, 0, sizeof(*ts));
+    if (info6 != NULL) {
+        memset(info6, 0, sizeof(*info6));
+        info6->hop_limit = -1;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            ts->sw = stamps.ts[0];
+            ts->hw = stamps.ts[2];
+        } else if (info6 != NULL && cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            info6->dst = info.ipi6_addr;
+        } else if (info6 != NULL && cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT) {
+            memcpy(&info6->hop_limit, CMSG_DATA(cmsg), sizeof(info6->hop_limit));
+        }
+    }
+}
+
+bool icmp_timestamp_valid(const struct timespec *ts) {
+    return ts->tv_sec != 0 || ts->tv_nsec != 0;
+}
+
+int icmp_enable_timestamping(int sockfd) {
+    int flags =
+        SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+        SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+        // Number TX timestamps in send order and don't loop the whole packet back.
+        SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    return setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+IcmpResult icmp_recv_tx_timestamps(IcmpTxTimestamp stamps[], size_t n, int sockfd, size_t *received) {
+    struct mmsghdr msgs[ICMP_BATCH_MAX];
+    u_char control[ICMP_BATCH_MAX][ICMP_CONTROL_LEN + CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_storage))];
+    if (n > ICMP_BATCH_MAX) n = ICMP_BATCH_MAX;
+    memset(msgs, 0, n * sizeof(*msgs));
+    for (size_t i = 0; i < n; i++) {
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+    int res = recvmmsg(sockfd, msgs, n, MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+    if (res == -1) {
+        *received = 0;
         return IcmpRecvFromErr;
     }
+    *received = 0;
+    for (int i = 0; i < res; i++) {
+        struct msghdr *msg = &msgs[i].msg_hdr;
+        IcmpTxTimestamp *stamp = &stamps[*received];
+        bool has_id = false;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+            if (
+                (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)
+            ) {
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno == ENOMSG && err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    stamp->id = err.ee_data;
+                    has_id = true;
+                }
+            }
+        }
+        icmp_read_control(msg, &stamp->ts, NULL);
+        if (has_id) (*received) ++;
+    }
+    return IcmpOk;
+}
 
-    *icm = (struct IcmpPacket *)buf;
-    IcmpPacket *picm = (struct IcmpPacket *)(*icm);
-    // If we're pinging localhost, we'll receive our message too, so filter them out.
-    if (picm->h_type == ICMP6_ECHO_REQUEST) {
-        return recv_ip6_icmp(icm, sockfd, buf, buf_len, addr, addr_len);
+int icmp_recv_ring_init(IcmpRecvSlot slots[], size_t n, size_t buf_len) {
+    u_char *bufs = malloc(n * buf_len);
+    if (bufs == NULL) return -1;
+    for (size_t i = 0; i < n; i++) {
+        slots[i].buf = bufs + i * buf_len;
+        slots[i].cap = buf_len;
     }
-    // TODO verify checksum
-    // Icmp6PseudoHeader ph = new_pseudo_header((*ip)->ip6_src, (*ip)->ip6_dst, (*ip)->ip6_plen);
-    // if (icmp_verify_checksum(picm, &ph) == false) return IcmpInvalidIcmpCksumErr;
+    return 0;
+}
+
+void icmp_recv_ring_free(IcmpRecvSlot slots[]) {
+    free(slots[0].buf);
+    slots[0].buf = NULL;
+}
+
+IcmpResult icmp_recv_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received) {
+    struct mmsghdr msgs[ICMP_BATCH_MAX];
+    struct iovec iovs[ICMP_BATCH_MAX];
+    if (n > ICMP_BATCH_MAX) n = ICMP_BATCH_MAX;
+    memset(msgs, 0, n * sizeof(*msgs));
+    for (size_t i = 0; i < n; i++) {
+        iovs[i].iov_base = slots[i].buf;
+        iovs[i].iov_len = slots[i].cap;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &slots[i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(slots[i].addr);
+        msgs[i].msg_hdr.msg_control = slots[i].control;
+        msgs[i].msg_hdr.msg_controllen = sizeof(slots[i].control);
+    }
+    int res = recvmmsg(sockfd, msgs, n, MSG_DONTWAIT, NULL);
+    if (res == -1) {
+        *received = 0;
+        return IcmpRecvFromErr;
+    }
+    for (int i = 0; i < res; i++) {
+        slots[i].addr_len = msgs[i].msg_hdr.msg_namelen;
+        slots[i].len = msgs[i].msg_len;
+        memset(&slots[i].view, 0, sizeof(slots[i].view));
+        icmp_read_control(&msgs[i].msg_hdr, &slots[i].ts, &slots[i].info6);
+    }
+    *received = res;
+    return IcmpOk;
+}
+
+IcmpResult recv_ip4_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received) {
+    IcmpResult res = icmp_recv_batch(slots, n, sockfd, received);
+    if (res != IcmpOk) return res;
+    icmp_view_parse_batch(slots, *received, IcmpSockRaw, IPv4, ICMP_VIEW_SKIP_IP_CKSUM);
+    return IcmpOk;
+}
+
+IcmpResult recv_ip6_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received) {
+    IcmpResult res = icmp_recv_batch(slots, n, sockfd, received);
+    if (res != IcmpOk) return res;
+    icmp_view_parse_batch(slots, *received, IcmpSockRaw, IPv6, 0);
+    return IcmpOk;
+}
 
-    picm->h_id = ntohs(picm->h_id);
-    picm->h_seq = ntohs(picm->h_seq);
+IcmpResult recv_dgram_icmp_batch(IcmpRecvSlot slots[], size_t n, int sockfd, size_t *received) {
+    IcmpResult res = icmp_recv_batch(slots, n, sockfd, received);
+    if (res != IcmpOk) return res;
+    icmp_view_parse_batch(slots, *received, IcmpSockDgram, IPv4, 0);
     return IcmpOk;
 }
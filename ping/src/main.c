@@ -1,313 +1,397 @@
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <netdb.h>
 #include <netinet/ip_icmp.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "../include/args.h"
+#include "../include/engine.h"
 #include "../include/icmp.h"
-
-//Regular bold text
-#define BYEL "\e[1;33m"
-#define BBLU "\e[1;34m"
-#define BWHT "\e[1;37m"
-//Regular underline text
-#define UREG "\e[4;m"
-//Reset
-#define CRESET "\e[0m"
-
-/// Generate string with char `ch` `len` times.
-/// Need to manually `free` to release allocated string.
-const char *gen_str(const char symb, size_t len) {
-    char *str = malloc(len * sizeof(symb) + 1);
-    str[len] = '\0';
-    while (len > 0) {
-        str[--len] = symb;
-    }
-    return str;
-}
-
-/// Global application state for statistics printed at the end of execution.
-static struct {
-    uint sent;
-    uint received;
-    double t_min;
-    double t_max;
-    double t_sum;
-} glb_state = {
-    0, 0, 0, 0, 0
-};
-
-/// Create a new string with the specified ansi color code.
-/// `free` can be set to true to `free` passed string.
-/// Return: new duplicate string if stdout is not a `tty` or the config option is false.
-const char *color(const char *str, const char *color, bool to_free) {
-    size_t str_len = strlen(str);
-    if (
-        config.color == ClrNever || 
-        (config.color == ClrAuto && isatty(STDOUT_FILENO)) == false
-    ) {
-        char *new_str = (char *)malloc(str_len + 1);
-        new_str[0] = '\0';
-        strcat(new_str, str);
-        if (to_free) free((void *)str);
-        return new_str;
-    }
-
-    // Constructs new string as ColorCode->String->ResetColorCode->'\0'
-    size_t color_len = strlen(color);
-    size_t reset_len = strlen(CRESET);
-    size_t len = color_len + str_len + reset_len + 1;
-
-    char *new_str = (char *)malloc(len);
-    memcpy(new_str, color, color_len);
-    memcpy(new_str + color_len, str, str_len);
-    memcpy(new_str + color_len + str_len, CRESET, reset_len);
-    new_str[len - 1] = '\0';
-    if (to_free) free((void *)str);
-    return new_str;
-}
-
-/// Greeting message printed before main loop.
-void greeting() {
-    const char *sep = color(gen_str('+', 5), BYEL, true);
-    const char *name = color("Woojiq's utils", BBLU, false);
-    printf("%s %s %s\n", sep, name, sep);
-    free((void *)sep);
-    free((void *)name);
+#include "../include/output.h"
+#include "../include/payload.h"
+#include "../include/pmtu.h"
+#include "../include/record.h"
+#include "../include/resolve.h"
+#include "../include/stats.h"
+#include "../include/time_util.h"
+#include "../include/trace.h"
+#include "../include/worker.h"
+
+/// Microseconds `--low-jitter` engines spin for replies and ahead of deadlines instead of sleeping.
+#define LOW_JITTER_BUSY_POLL_US (1000)
+/// Plain sleeps sampled before `--low-jitter` tuning, and how long each of them is.
+#define LOW_JITTER_BASELINE_SLEEPS (50)
+#define LOW_JITTER_BASELINE_SLEEP_NS (500 * 1000)
+
+/// Hosts we are pinging, as they get resolved, and the workers driving them, each with its own shard of targets.
+static TargetList targets;
+static Resolver resolver;
+static Worker *workers = NULL;
+static size_t n_workers = 0;
+static Output output;
+static Recorder recorder;
+/// Data after the timestamp of every probe, shared by all workers; only with `--size` or `--pattern`.
+static IcmpPayload payload;
+static bool has_payload = false;
+/// Used instead of the workers in `--trace` mode.
+static Tracer tracer;
+static bool tracing = false;
+/// Used instead of the workers in `--pmtu` mode.
+static PmtuProber prober;
+static bool probing = false;
+/// How late plain sleeps woke up before `--low-jitter` tuning.
+static Histogram lag_baseline;
+
+static int cmp_order(const void *lhs, const void *rhs) {
+    size_t l = (*(const Target **)lhs)->order, r = (*(const Target **)rhs)->order;
+    return (l > r) - (l < r);
 }
 
-/// Print statistics stored in `glb_state`.
+/// Write statistics of every target in the command line order, and of all of them combined if there are several.
 void finish() {
-    const char *sep = color(gen_str('-', 3), BWHT, true);
-    printf("%s %s ping statistics %s\n", sep, config.hostname, sep);
-    float perc;
-    if (glb_state.received) {
-        perc = (float)(glb_state.sent - glb_state.received) * 100 / (float)glb_state.received;
-    } else if (glb_state.sent) {
-        perc = 100;
-    } else {
-        perc = 0;
+    size_t n_targets = target_list_ready(&targets);
+    const Target **sorted = malloc(n_targets * sizeof(Target *));
+    if (sorted == NULL) {
+        perror("malloc");
+        exit(1);
     }
-    printf(
-        "%i packets transmitted, %i packets received, %i%% packet loss\n",
-        glb_state.sent, glb_state.received, (int)perc
-    );
-    if (glb_state.received) {
-        double avg = glb_state.t_sum / glb_state.received;
-        printf("round-trip min/avg/max = %.2f/%.2f/%.2f ms\n", glb_state.t_min, avg, glb_state.t_max);
+    for (size_t i = 0; i < n_targets; i++) sorted[i] = &targets.items[i];
+    qsort(sorted, n_targets, sizeof(Target *), cmp_order);
+
+    TargetStats total = {0};
+    for (size_t i = 0; i < n_targets; i++) {
+        const TargetStats *stats = &sorted[i]->stats;
+        output_stats(&output, sorted[i]->hostname, stats);
+        total.sent += stats->sent;
+        total.received += stats->received;
+        hist_merge(&total.rtt, &stats->rtt);
     }
-    free((void *)sep);
-    exit(0);
+    if (n_targets > 1) output_stats(&output, "all targets", &total);
+    output_flush(&output);
+    hist_free(&total.rtt);
+    free(sorted);
+}
+
+/// Interrupt stops the resolver and all engines, statistics are written once they return.
+void on_sigint(int sig) {
+    (void)sig;
+    resolver_stop(&resolver);
+    for (size_t i = 0; i < n_workers; i++) engine_stop(&workers[i].engine);
+    if (tracing) tracer_stop(&tracer);
+    if (probing) pmtu_stop(&prober);
 }
 
 void setup_sigaction() {
     struct sigaction act = {0};
-    act.sa_handler = finish;
+    act.sa_handler = on_sigint;
     if (sigaction(SIGINT, &act, NULL) == -1) {
         perror("sigaction");
         exit(1);
     }
 }
 
-/// Calculate time between `start` and `end` in milliseconds with precision.
-double calc_time(const struct timespec *start, const struct timespec *end) {
-    #define MILLIS_IN_SEC (1000)
-    #define NANOS_IN_MILLI (1000000)
-    double time = 
-        (double)(end->tv_sec - start->tv_sec) * MILLIS_IN_SEC + 
-        (double)(end->tv_nsec - start->tv_nsec) / NANOS_IN_MILLI;
-    return time;
+/// Create ICMP socket of the configured IP version and kind.
+/// `id` is replaced with the kernel-assigned identifier for ping sockets.
+int get_icmp_socket(uint16_t *id) {
+    int sockfd = icmp_socket(config.ip, config.socket_kind, id);
+    if (sockfd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    return sockfd;
 }
 
-/// Resolve host by name and creates raw socket for sending ICMP packets.
-int get_icmp_socket(struct sockaddr_storage *addr, socklen_t *addr_len) {
-    struct addrinfo hints, *addrinfo_list, *paddr;
-    memset(&hints, 0, sizeof(hints));
-    // There is no AF_UNSPEC equivalent for IPPROTO_ICMP, so we need to select version manually.
-    if (config.ip == IPv4) {
-        hints.ai_family = AF_INET;
-        hints.ai_protocol = IPPROTO_ICMP;
-    } else if (config.ip == IPv6) {
-        hints.ai_family = AF_INET6;
-        hints.ai_protocol = IPPROTO_ICMPV6;
-    }
-    hints.ai_socktype = SOCK_RAW;
+/// Hosts that can't be resolved are reported and skipped.
+void on_resolve_error(const char *hostname, int status, void *ctx) {
+    (void)ctx;
+    (void)fprintf(stderr, "ping: %s: %s\n", hostname, gai_strerror(status));
+}
 
-    int status;
-    if ((status = getaddrinfo(config.hostname, NULL, &hints, &addrinfo_list)) != 0) {
-        (void)fprintf(stderr, "ping: %s\n", gai_strerror(status));
+/// Start resolving all hosts from the config into `targets` in the background.
+void resolve_targets() {
+    if (target_list_init(&targets, config.n_hostnames) == -1) {
+        perror("target_list_init");
         exit(1);
     }
-
-    int sockfd = -1;
-    for (paddr = addrinfo_list; paddr != NULL; paddr = addrinfo_list->ai_next) {
-        sockfd = socket(paddr->ai_family, paddr->ai_socktype, paddr->ai_protocol);
-        if (sockfd >= 0) break;
-    }
-
-    if (sockfd < 0) {
-        perror("socket");
+    int err = resolver_start(&resolver, config.hostnames, config.n_hostnames, config.ip, &targets, on_resolve_error, NULL);
+    if (err != 0) {
+        (void)fprintf(stderr, "%s: pthread_create: %s\n", config.bin, strerror(err));
         exit(1);
     }
+}
 
-    *addr_len = paddr->ai_addrlen;
-    memcpy(addr, paddr->ai_addr, *addr_len);
-
-    freeaddrinfo(addrinfo_list);
-    return sockfd;
+/// Write reply record for every matched reply.
+void on_reply(const EngineReply *reply, void *ctx) {
+    output_reply((Output *)ctx, reply);
 }
 
-/// Convert sockaddr (sockaddr_storage) to internet address.
-void *get_in_addr(struct sockaddr *sa) {
-    if (sa->sa_family == AF_INET) {
-        return &(((struct sockaddr_in*)sa)->sin_addr);
-    }
-    return &(((struct sockaddr_in6*)sa)->sin6_addr);
+/// Write the target line once the worker takes the target.
+void on_target(const Target *target, void *ctx) {
+    output_target((Output *)ctx, target, PAYLOAD_MIN + payload.len);
 }
 
-/// Pretty-print IP header
-void pr_iphdr(const struct iphdr *ip, const sa_family_t af) {
-    const char *sep = color(gen_str('=', 5), BWHT, true);
-    // frag_off and type of service are skipped
-    printf("\t%s IPv4 Header %s\n", sep, sep);
-    printf("\tVersion: %d\n", ip->version);
-    printf("\tHeader Length: %d\n", ip->ihl);
-    printf("\tTotal Length: %d\n", ntohs(ip->tot_len));
-    printf("\tId: %d\n", ntohs(ip->id));
-    printf("\tTime To Live: %d\n", ip->ttl);
-    printf("\tProtocol: %d\n", ip->protocol);
-    printf("\tChecksum (verified): %d\n", ntohs(ip->check));
+/// Flush buffered records before the engine starts waiting, so they are not delayed.
+void on_idle(void *ctx) {
+    output_flush((Output *)ctx);
+}
 
-    char str[INET_ADDRSTRLEN];
-    inet_ntop(af, &ip->saddr, str, sizeof(str));
-    printf("\tSource IP: %s\n", str);
-    inet_ntop(af, &ip->daddr, str, sizeof(str));
-    printf("\tDestination IP: %s\n", str);
+/// Split targets into `config.threads` interleaved shards, each with its own socket and id.
+/// Targets are assigned as they resolve, so shards stay balanced whatever the resolution order.
+/// Workers are pinned to the allowed CPUs round-robin (a single worker is not pinned).
+void init_workers(bool colored) {
+    n_workers = config.threads < config.n_hostnames ? config.threads : config.n_hostnames;
+    workers = calloc(n_workers, sizeof(Worker));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    int cpus[MAX_THREADS];
+    size_t n_cpus = n_workers > 1 ? worker_cpus(cpus, MAX_THREADS) : 0;
+
+    EngineOptions opts = {
+        .count = config.count,
+        .interval = config.interval,
+        .flood = config.flood,
+        .kernel_ts = config.kernel_ts,
+        .timeout = config.timeout,
+        .deadline = config.deadline,
+        .io_uring = config.io_uring,
+        .packet_ring = config.packet_ring,
+        .payload = has_payload ? &payload : NULL,
+        .busy_poll = config.low_jitter ? LOW_JITTER_BUSY_POLL_US : 0,
+    };
+    for (size_t i = 0; i < n_workers; i++) {
+        Worker *worker = &workers[i];
+        // Raw sockets see every ICMP packet, distinct ids let the kernel filter sort them out.
+        uint16_t id = (uint16_t)(getpid() + i);
+        int sockfd = get_icmp_socket(&id);
+        worker->cpu = n_cpus ? cpus[i % n_cpus] : -1;
+        output_init(&worker->output, STDOUT_FILENO, config.format, colored, config.verbosity, config.flood);
+        Engine *engine = &worker->engine;
+        if (engine_init(engine, sockfd, config.ip, id, &targets, i, n_workers, &opts, on_reply, &worker->output) == -1) {
+            perror("socket");
+            exit(1);
+        }
+        engine->on_idle = on_idle;
+        engine->on_target = on_target;
+    }
+}
 
-    free((void *)sep);
+/// Sample how late plain sleeps wake up before anything is tuned, to compare with how late
+/// the tuned loop gets going after its deadlines.
+static void measure_lag_baseline(void) {
+    struct timespec sleep = {0, LOW_JITTER_BASELINE_SLEEP_NS};
+    for (int i = 0; i < LOW_JITTER_BASELINE_SLEEPS; i++) {
+        struct timespec before, after;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &before);
+        (void)nanosleep(&sleep, NULL);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &after);
+        long long slept = (long long)(after.tv_sec - before.tv_sec) * NANOS_IN_SEC + (after.tv_nsec - before.tv_nsec);
+        hist_record(&lag_baseline, slept > LOW_JITTER_BASELINE_SLEEP_NS ? (uint64_t)(slept - LOW_JITTER_BASELINE_SLEEP_NS) : 0);
+    }
 }
 
-/// Pretty-print ICMP header
-void pr_icmp(const IcmpPacket *icm) {
-    const char *sep = color(gen_str('=', 5), BWHT, true);
+/// Tune the process for `--low-jitter` once the workers are ready: pin the worker, cut the timer
+/// slack to 1 ns and switch to `SCHED_FIFO` (worker threads inherit both), lock the memory mapped so
+/// far, the engine buffers included. Every step is best effort, failures are only reported.
+static void setup_low_jitter(void) {
+    measure_lag_baseline();
+    // Several workers are already pinned round-robin.
+    if (n_workers == 1) workers[0].cpu = config.low_jitter_cpu >= 0 ? config.low_jitter_cpu : worker_current_cpu();
+    if (prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == -1) {
+        (void)fprintf(stderr, "%s: can't reduce timer slack: %s\n", config.bin, strerror(errno));
+    }
+    struct sched_param param = {.sched_priority = sched_get_priority_min(SCHED_FIFO)};
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+        (void)fprintf(stderr, "%s: can't switch to SCHED_FIFO: %s\n", config.bin, strerror(errno));
+    }
+    // Not `MCL_FUTURE`: later mappings (thread stacks, histogram buckets) would fail once they
+    // hit `RLIMIT_MEMLOCK` instead of just staying unlocked.
+    if (mlockall(MCL_CURRENT) == -1) {
+        (void)fprintf(stderr, "%s: can't lock memory: %s\n", config.bin, strerror(errno));
+    }
+}
 
-    printf("\t%s ICMP Header %s\n", sep, sep);
-    printf("\tType: %d\n", icm->h_type);
-    printf("\tCode: %d\n", icm->h_code);
-    printf("\tChecksum: %d\n", icm->h_cksum);
-    printf("\tId: %d\n", icm->h_id);
-    printf("\tSeq: %d\n", icm->h_seq);
+/// Write how late the loops of all workers got going after their deadlines, next to plain sleeps.
+static void finish_low_jitter(void) {
+    Histogram lag;
+    hist_init(&lag);
+    for (size_t i = 0; i < n_workers; i++) hist_merge(&lag, &workers[i].engine.lag);
+    output_lag(&output, &lag, &lag_baseline);
+    output_flush(&output);
+    hist_free(&lag);
+    hist_free(&lag_baseline);
+}
 
-    free((void *)sep);
+/// Lines of the hop tables drawn last, a terminal gets them redrawn in place.
+static size_t trace_lines = 0;
+
+/// Write hop tables of every path. Text is written only at the end, unless it goes to a terminal.
+void on_trace_round(const Tracer *tracer, void *ctx) {
+    bool redraw = *(bool *)ctx;
+    bool final = tracer->stop || (tracer->opts.count != 0 && tracer->rounds == tracer->opts.count);
+    if (config.format == FmtText && redraw == false && final == false) return;
+    if (config.format == FmtText && redraw) output_rewind(&output, trace_lines);
+    trace_lines = 0;
+    for (size_t i = 0; i < tracer->n_paths; i++) trace_lines += output_trace(&output, tracer, &tracer->paths[i]);
+    output_flush(&output);
 }
 
-void add_time_to_stat(const double time) {
-    // First packet special case
-    if (glb_state.received == 1) {
-        glb_state.t_min = glb_state.t_max = glb_state.t_sum = time;
-    } else {
-        glb_state.t_sum += time;
-        if (time < glb_state.t_min) glb_state.t_min = time;
-        else if (time > glb_state.t_max) glb_state.t_max = time;
+/// Trace paths to all hosts once they are resolved, from a single raw socket.
+void run_trace() {
+    setup_sigaction();
+    resolver_join(&resolver);
+    if (target_list_ready(&targets) == 0) exit(1);
+    uint16_t id = (uint16_t)getpid();
+    int sockfd = icmp_socket(config.ip, IcmpSockRaw, &id);
+    if (sockfd < 0) {
+        perror("socket");
+        exit(1);
     }
+    TraceOptions opts = {
+        .max_hops = config.trace_hops,
+        .count = config.count,
+        .interval = config.interval,
+        .timeout = config.timeout,
+    };
+    if (tracer_init(&tracer, sockfd, config.ip, id, &targets, &opts) == -1) {
+        perror("tracer_init");
+        exit(1);
+    }
+    bool redraw = config.format == FmtText && isatty(STDOUT_FILENO);
+    tracer.on_round = on_trace_round;
+    tracer.ctx = &redraw;
+    tracing = true;
+    IcmpResult res = tracer_run(&tracer);
+    if (res != IcmpOk) {
+        printf("%s: %s\n", config.bin, icmp_func.strerror(res));
+        exit(1);
+    }
+    tracer_free(&tracer);
 }
 
-void process_ip4_response(
-    const struct iphdr *ip4, const struct IcmpPacket *icm,
-    const char *dest_str, sa_family_t fam,
-    double time
-) {
-    printf(
-        "%li bytes from %s: icmp_seq=%i time=%.3fms\n", 
-        sizeof(*ip4) + sizeof(*icm), dest_str, icm->h_seq, time
-    );
-    // We can't parse Ethernet header since we do not use `AF_PACKET`. See `packet(7)`.
-    if (config.verbosity > 0) {
-        pr_iphdr(ip4, fam);
-        pr_icmp(icm);
-        const char *sep = gen_str('=', 55);
-        printf("%s\n", sep);
-        free((void *)sep);
-    }
+void on_pmtu_path(const PmtuProber *prober, const PmtuPath *path, void *ctx) {
+    (void)ctx;
+    output_pmtu(&output, prober, path);
+    output_flush(&output);
 }
 
-void process_ip6_response(const struct IcmpPacket *icm, const char *dest_str, double time) {
-    printf(
-        "%li bytes from %s: icmp_seq=%i time=%.3fms\n", 
-        sizeof(*icm), dest_str, icm->h_seq, time
-    );
-    // We can't parse Ethernet header since we do not use `AF_PACKET`. See `packet(7)`.
-    if (config.verbosity > 0) {
-        pr_icmp(icm);
-        const char *sep = gen_str('=', 55);
-        printf("%s\n", sep);
-        free((void *)sep);
+/// Discover path MTU of all hosts once they are resolved, from a single raw socket.
+void run_pmtu() {
+    setup_sigaction();
+    resolver_join(&resolver);
+    if (target_list_ready(&targets) == 0) exit(1);
+    uint16_t id = (uint16_t)getpid();
+    int sockfd = icmp_socket(config.ip, IcmpSockRaw, &id);
+    if (sockfd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    PmtuOptions opts = {
+        .max_size = config.pmtu_max,
+        .timeout = config.timeout,
+    };
+    if (pmtu_init(&prober, sockfd, config.ip, id, &targets, &opts) == -1) {
+        perror("pmtu_init");
+        exit(1);
+    }
+    prober.on_path = on_pmtu_path;
+    probing = true;
+    IcmpResult res = pmtu_run(&prober);
+    if (res != IcmpOk) {
+        printf("%s: %s\n", config.bin, icmp_func.strerror(res));
+        exit(1);
     }
+    pmtu_free(&prober);
 }
 
 int main(int argc, char *argv[]) {
     parse_args(argc, argv);
-    greeting();
-    setup_sigaction();
-
-    struct sockaddr_storage addr, from;
-    socklen_t addr_len, from_len;
-    int sockfd = get_icmp_socket(&addr, &addr_len);
-
-    char dest_ip[INET6_ADDRSTRLEN];
-    inet_ntop(addr.ss_family, get_in_addr((struct sockaddr *)&addr), dest_ip, sizeof(dest_ip));
-
-    printf("PING %s (%s): %lu data bytes\n", config.hostname, dest_ip, sizeof(IcmpPacket));
-
-    uint16_t pid = (uint16_t)getpid();
-    u_char buf[128] = {0};
-    struct iphdr *ip4;
-    IcmpPacket *icm = NULL;
-    uint16_t max_seq = config.count == 0 ? UINT16_MAX : config.count;
-    for (uint16_t seq = 0; seq < max_seq; seq++) {
-        if (seq) sleep(1);
-        if (config.ip == IPv4) {
-            icm = icmp_func.new_echo4_req(pid, seq);
-        } else {
-            struct sockaddr_in6 *dest = (struct sockaddr_in6 *)&addr;
-            // FIXME find out source address
-            icm = icmp_func.new_echo6_req(in6addr_loopback, dest->sin6_addr, pid, seq);
+    bool colored = config.color == ClrAlways || (config.color == ClrAuto && isatty(STDOUT_FILENO));
+    output_init(&output, STDOUT_FILENO, config.format, colored, config.verbosity, config.flood);
+    output_greeting(&output);
+    // Resolver errors go to stderr, keep them after the greeting.
+    output_flush(&output);
+
+    resolve_targets();
+    if (config.trace_hops != 0) {
+        run_trace();
+        return 0;
+    }
+    if (config.pmtu_max != 0) {
+        run_pmtu();
+        return 0;
+    }
+    if (config.size != 0 || config.pattern_len != 0) {
+        size_t size = config.size != 0 ? config.size : PAYLOAD_DEFAULT;
+        if (payload_init(&payload, size - PAYLOAD_MIN, config.pattern, config.pattern_len) == -1) {
+            perror("payload_init");
+            exit(1);
         }
-        icmp_func.send(icm, sockfd, &addr);
-        free(icm);
+        has_payload = true;
+    }
+    init_workers(colored);
 
-        glb_state.sent ++;
-        IcmpResult res;
-        if (config.ip == IPv4) res = icmp_func.recv4(&ip4, &icm, sockfd, buf, sizeof(buf), &from, &from_len);
-        else res = icmp_func.recv6(&icm, sockfd, buf, sizeof(buf), &from, &from_len);
-        if (res != 0) {
-            printf("%s: %s\n", config.bin, icmp_func.strerror(res));
+    if (config.kernel_ts && workers[0].engine.kernel_ts == false) {
+        (void)fprintf(stderr, "%s: kernel timestamps are not supported, using user-space time\n", config.bin);
+    }
+    if (config.io_uring && workers[0].engine.io_uring == false) {
+        (void)fprintf(stderr, "%s: io_uring is not supported, using plain syscalls\n", config.bin);
+    }
+    if (config.packet_ring && workers[0].engine.packet_ring == false) {
+        (void)fprintf(
+            stderr, "%s: AF_PACKET ring is not available (needs CAP_NET_RAW and replies within %d bytes), "
+            "receiving through the ICMP socket\n", config.bin, PACKET_MTU
+        );
+    }
+    if (config.record_file != NULL) {
+        if (recorder_open(&recorder, config.record_file, config.n_hostnames, config.record_limit) == -1) {
+            perror(config.record_file);
             exit(1);
         }
-
-        glb_state.received ++;
-        struct timespec curr_time;
-        clock_gettime(CLOCK_MONOTONIC_RAW, &curr_time);
-        double time = calc_time(&icm->ts_creation, &curr_time);
-        add_time_to_stat(time);
-
-        const char *dest_str = color(dest_ip, UREG, false);
-        if (config.ip == IPv4) {
-            process_ip4_response(ip4, icm, dest_str, addr.ss_family, time);
-        } else {
-            process_ip6_response(icm, dest_str, time);
+        workers[0].engine.recorder = &recorder;
+    }
+    if (config.low_jitter) setup_low_jitter();
+    setup_sigaction();
+    if (n_workers == 1) {
+        worker_run(&workers[0]);
+    } else {
+        for (size_t i = 0; i < n_workers; i++) {
+            int err = worker_start(&workers[i]);
+            if (err != 0) {
+                (void)fprintf(stderr, "%s: pthread_create: %s\n", config.bin, strerror(err));
+                exit(1);
+            }
+        }
+        for (size_t i = 0; i < n_workers; i++) worker_join(&workers[i]);
+    }
+    // Engines may quit before all hosts are resolved (deadline, interrupt): no new lookups start,
+    // the ones in progress are awaited.
+    resolver_stop(&resolver);
+    resolver_join(&resolver);
+    if (config.record_file != NULL) recorder_close(&recorder);
+    for (size_t i = 0; i < n_workers; i++) {
+        if (workers[i].res != IcmpOk) {
+            printf("%s: %s\n", config.bin, icmp_func.strerror(workers[i].res));
+            exit(1);
         }
-        free((void *)dest_str);
     }
+    if (target_list_ready(&targets) == 0) exit(1);
     finish();
+    if (config.low_jitter) finish_low_jitter();
+    for (size_t i = 0; i < n_workers; i++) engine_free(&workers[i].engine);
+    if (has_payload) payload_free(&payload);
     return 0;
 }
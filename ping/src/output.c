@@ -0,0 +1,497 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/output.h"
+#include "../include/time_util.h"
+
+//Regular bold text
+#define BYEL "\e[1;33m"
+#define BBLU "\e[1;34m"
+#define BWHT "\e[1;37m"
+//Regular underline text
+#define UREG "\e[4;m"
+//Reset
+#define CRESET "\e[0m"
+
+/// Fill `dst` with char `symb` `len` times wrapped into `clr` and `reset` codes.
+static void fill_sep(char *dst, char symb, size_t len, const char *clr, const char *reset) {
+    size_t clr_len = strlen(clr);
+    memcpy(dst, clr, clr_len);
+    memset(dst + clr_len, symb, len);
+    strcpy(dst + clr_len + len, reset);
+}
+
+void output_init(Output *self, int fd, OutputFormat format, bool color, uint verbosity, bool flood) {
+    self->fd = fd;
+    self->format = format;
+    self->verbosity = verbosity;
+    self->flood = flood;
+    self->len = 0;
+    const char *reset = color ? CRESET : "";
+    self->clr_underline = color ? UREG : "";
+    self->clr_reset = reset;
+    fill_sep(self->sep_greeting, '+', 5, color ? BYEL : "", reset);
+    fill_sep(self->sep_stats, '-', 3, color ? BWHT : "", reset);
+    fill_sep(self->sep_header, '=', 5, color ? BWHT : "", reset);
+    fill_sep(self->sep_line, '=', 55, "", "");
+    (void)snprintf(self->name, sizeof(self->name), "%sWoojiq's utils%s", color ? BBLU : "", reset);
+}
+
+void output_flush(Output *self) {
+    size_t written = 0;
+    while (written < self->len) {
+        ssize_t res = write(self->fd, self->buf + written, self->len - written);
+        // Signals interrupt writes to a slow reader (a pipe), that is no reason to drop output.
+        if (res == -1 && errno == EINTR) continue;
+        // Output is best effort, there is nobody to report the error to.
+        if (res <= 0) break;
+        written += res;
+    }
+    self->len = 0;
+}
+
+/// Append formatted string to the buffer, flushing it first if the string doesn't fit.
+__attribute__((format(printf, 2, 3)))
+static void out_printf(Output *self, const char *fmt, ...) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t avail = sizeof(self->buf) - self->len;
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(self->buf + self->len, avail, fmt, args);
+        va_end(args);
+        if (len < 0) return;
+        if ((size_t)len < avail) {
+            self->len += len;
+            return;
+        }
+        output_flush(self);
+    }
+}
+
+/// Append `len` bytes of `data` as is, flushing the buffer whenever it fills up.
+static void out_write(Output *self, const char *data, size_t len) {
+    while (len > 0) {
+        if (self->len == sizeof(self->buf)) output_flush(self);
+        size_t n = sizeof(self->buf) - self->len < len ? sizeof(self->buf) - self->len : len;
+        memcpy(self->buf + self->len, data, n);
+        self->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/// Return: whether `ch` must be escaped in a JSON string.
+static inline bool json_special(unsigned char ch) {
+    return ch == '"' || ch == '\\' || ch < 0x20;
+}
+
+/// Append string as a JSON string literal, runs of plain characters are copied at once.
+static void out_json_str(Output *self, const char *str) {
+    out_write(self, "\"", 1);
+    while (*str != '\0') {
+        const char *run = str;
+        while (*str != '\0' && !json_special((unsigned char)*str)) str++;
+        out_write(self, run, (size_t)(str - run));
+        if (*str == '\0') break;
+        unsigned char ch = (unsigned char)*str++;
+        if (ch == '"' || ch == '\\') {
+            char escaped[2] = {'\\', (char)ch};
+            out_write(self, escaped, sizeof(escaped));
+        } else {
+            out_printf(self, "\\u%04x", ch);
+        }
+    }
+    out_write(self, "\"", 1);
+}
+
+/// Append string as a CSV field, quoted only if needed; quotes inside are doubled.
+static void out_csv_str(Output *self, const char *str) {
+    if (strpbrk(str, ",\"\n") == NULL) {
+        out_write(self, str, strlen(str));
+        return;
+    }
+    out_write(self, "\"", 1);
+    for (const char *quote; (quote = strchr(str, '"')) != NULL; str = quote + 1) {
+        // The quote goes out twice: once with the run before it, once more on its own.
+        out_write(self, str, (size_t)(quote - str) + 1);
+        out_write(self, "\"", 1);
+    }
+    out_write(self, str, strlen(str));
+    out_write(self, "\"", 1);
+}
+
+void output_greeting(Output *self) {
+    if (self->format == FmtText) {
+        out_printf(self, "%s %s %s\n", self->sep_greeting, self->name, self->sep_greeting);
+    } else if (self->format == FmtCsv) {
+        out_printf(
+            self,
+            "type,host,ip,seq,bytes,ttl,time_ms,sent,received,loss_pct,"
+            "min_ms,avg_ms,max_ms,mdev_ms,p50_ms,p90_ms,p99_ms,p999_ms,jitter_ms\n"
+        );
+    }
+}
+
+void output_target(Output *self, const Target *target, size_t data_len) {
+    if (self->format != FmtText) return;
+    out_printf(self, "PING %s (%s): %zu data bytes\n", target->hostname, target->ip_str, data_len);
+}
+
+/// Pretty-print Ethernet header
+static void pr_ethhdr(Output *self, const struct ether_header *eth) {
+    const uint8_t *src = eth->ether_shost, *dst = eth->ether_dhost;
+    out_printf(self, "\t%s Ethernet Header %s\n", self->sep_header, self->sep_header);
+    out_printf(
+        self, "\tSource MAC: %02x:%02x:%02x:%02x:%02x:%02x\n", src[0], src[1], src[2], src[3], src[4], src[5]
+    );
+    out_printf(
+        self, "\tDestination MAC: %02x:%02x:%02x:%02x:%02x:%02x\n", dst[0], dst[1], dst[2], dst[3], dst[4], dst[5]
+    );
+    out_printf(self, "\tType: 0x%04x\n", ntohs(eth->ether_type));
+}
+
+/// Pretty-print IP header
+static void pr_iphdr(Output *self, const struct iphdr *ip) {
+    // frag_off and type of service are skipped
+    out_printf(self, "\t%s IPv4 Header %s\n", self->sep_header, self->sep_header);
+    out_printf(self, "\tVersion: %d\n", ip->version);
+    out_printf(self, "\tHeader Length: %d\n", ip->ihl);
+    out_printf(self, "\tTotal Length: %d\n", ntohs(ip->tot_len));
+    out_printf(self, "\tId: %d\n", ntohs(ip->id));
+    out_printf(self, "\tTime To Live: %d\n", ip->ttl);
+    out_printf(self, "\tProtocol: %d\n", ip->protocol);
+    out_printf(self, "\tChecksum (verified): %d\n", ntohs(ip->check));
+
+    char str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ip->saddr, str, sizeof(str));
+    out_printf(self, "\tSource IP: %s\n", str);
+    inet_ntop(AF_INET, &ip->daddr, str, sizeof(str));
+    out_printf(self, "\tDestination IP: %s\n", str);
+}
+
+/// Pretty-print IPv6 header
+static void pr_ip6hdr(Output *self, const struct ip6_hdr *ip) {
+    uint32_t flow = ntohl(ip->ip6_flow);
+    out_printf(self, "\t%s IPv6 Header %s\n", self->sep_header, self->sep_header);
+    out_printf(self, "\tVersion: %u\n", flow >> 28);
+    out_printf(self, "\tTraffic Class: %u\n", (flow >> 20) & 0xff);
+    out_printf(self, "\tFlow Label: %u\n", flow & 0xfffff);
+    out_printf(self, "\tPayload Length: %d\n", ntohs(ip->ip6_plen));
+    out_printf(self, "\tNext Header: %d\n", ip->ip6_nxt);
+    out_printf(self, "\tHop Limit: %d\n", ip->ip6_hlim);
+
+    char str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &ip->ip6_src, str, sizeof(str));
+    out_printf(self, "\tSource IP: %s\n", str);
+    inet_ntop(AF_INET6, &ip->ip6_dst, str, sizeof(str));
+    out_printf(self, "\tDestination IP: %s\n", str);
+}
+
+/// Pretty-print IPv6 header fields delivered as ancillary data
+static void pr_info6(Output *self, const Icmp6Info *info) {
+    out_printf(self, "\t%s IPv6 Packet Info %s\n", self->sep_header, self->sep_header);
+    out_printf(self, "\tHop Limit: %d\n", info->hop_limit);
+    char str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &info->dst, str, sizeof(str));
+    out_printf(self, "\tDestination IP: %s\n", str);
+}
+
+/// Pretty-print ICMP header
+static void pr_icmp(Output *self, const IcmpView *view) {
+    out_printf(self, "\t%s ICMP Header %s\n", self->sep_header, self->sep_header);
+    out_printf(self, "\tType: %d\n", icmp_view_type(view));
+    out_printf(self, "\tCode: %d\n", icmp_view_code(view));
+    out_printf(self, "\tChecksum: %d\n", ntohs(view->icm->h_cksum));
+    out_printf(self, "\tId: %d\n", icmp_view_id(view));
+    out_printf(self, "\tSeq: %d\n", icmp_view_seq(view));
+}
+
+void output_reply(Output *self, const EngineReply *reply) {
+    const Target *target = reply->target;
+    size_t bytes = icmp_view_len(&reply->view) + (reply->ip6 != NULL ? sizeof(*reply->ip6) : 0);
+    int ttl = reply->ttl;
+    switch (self->format) {
+    case FmtText:
+        if (self->flood) return;
+        out_printf(
+            self, "%zu bytes from %s%s%s: icmp_seq=%u time=%.3fms",
+            bytes, self->clr_underline, target->ip_str, self->clr_reset, reply->seq, reply->time
+        );
+        if (reply->corrupt_at >= 0) out_printf(self, " (corrupted data at byte %ld)", reply->corrupt_at);
+        out_printf(self, "\n");
+        // Link-layer and IPv6 headers are only seen through the `AF_PACKET` ring. See `packet(7)`.
+        if (self->verbosity > 0) {
+            if (reply->eth != NULL) pr_ethhdr(self, reply->eth);
+            if (reply->view.ip4 != NULL) pr_iphdr(self, reply->view.ip4);
+            if (reply->ip6 != NULL) pr_ip6hdr(self, reply->ip6);
+            if (reply->info6 != NULL) pr_info6(self, reply->info6);
+            pr_icmp(self, &reply->view);
+            out_printf(self, "%s\n", self->sep_line);
+        }
+        break;
+    case FmtJson:
+        out_printf(self, "{\"type\":\"reply\",\"host\":");
+        out_json_str(self, target->hostname);
+        out_printf(self, ",\"ip\":\"%s\",\"seq\":%u,\"bytes\":%zu,\"ttl\":", target->ip_str, reply->seq, bytes);
+        if (ttl >= 0) out_printf(self, "%d", ttl);
+        else out_printf(self, "null");
+        out_printf(self, ",\"time_ms\":%.3f", reply->time);
+        // Present only if the data came back corrupted.
+        if (reply->corrupt_at >= 0) out_printf(self, ",\"corrupt_at\":%ld", reply->corrupt_at);
+        out_printf(self, "}\n");
+        break;
+    case FmtCsv:
+        out_printf(self, "reply,");
+        out_csv_str(self, target->hostname);
+        out_printf(self, ",%s,%u,%zu,", target->ip_str, reply->seq, bytes);
+        if (ttl >= 0) out_printf(self, "%d", ttl);
+        out_printf(self, ",%.3f,,,,,,,,,,,,\n", reply->time);
+        break;
+    }
+    if (self->len >= OUTPUT_FLUSH_LEN) output_flush(self);
+}
+
+void output_stats(Output *self, const char *name, const TargetStats *stats) {
+    double loss = stats->sent ? (double)(stats->sent - stats->received) * 100 / stats->sent : 0;
+    const Histogram *rtt = &stats->rtt;
+    double min = NS_TO_MS(rtt->min), avg = hist_mean(rtt), max = NS_TO_MS(rtt->max), mdev = hist_stddev(rtt);
+    double p50 = NS_TO_MS(hist_percentile(rtt, 50)), p90 = NS_TO_MS(hist_percentile(rtt, 90));
+    double p99 = NS_TO_MS(hist_percentile(rtt, 99)), p999 = NS_TO_MS(hist_percentile(rtt, 99.9));
+    double jitter = hist_jitter(rtt);
+
+    switch (self->format) {
+    case FmtText:
+        out_printf(self, "%s %s ping statistics %s\n", self->sep_stats, name, self->sep_stats);
+        out_printf(
+            self, "%u packets transmitted, %u packets received, %.1f%% packet loss\n",
+            stats->sent, stats->received, loss
+        );
+        if (rtt->count == 0) break;
+        out_printf(self, "round-trip min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n", min, avg, max, mdev);
+        out_printf(
+            self, "percentiles p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms, jitter = %.3f ms\n",
+            p50, p90, p99, p999, jitter
+        );
+        break;
+    case FmtJson:
+        out_printf(self, "{\"type\":\"stats\",\"host\":");
+        out_json_str(self, name);
+        out_printf(self, ",\"sent\":%u,\"received\":%u,\"loss_pct\":%.3f", stats->sent, stats->received, loss);
+        if (rtt->count) {
+            out_printf(
+                self,
+                ",\"min_ms\":%.3f,\"avg_ms\":%.3f,\"max_ms\":%.3f,\"mdev_ms\":%.3f,"
+                "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"jitter_ms\":%.3f",
+                min, avg, max, mdev, p50, p90, p99, p999, jitter
+            );
+        }
+        out_printf(self, "}\n");
+        break;
+    case FmtCsv:
+        out_printf(self, "stats,");
+        out_csv_str(self, name);
+        out_printf(self, ",,,,,,%u,%u,%.3f", stats->sent, stats->received, loss);
+        if (rtt->count) {
+            out_printf(
+                self, ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                min, avg, max, mdev, p50, p90, p99, p999, jitter
+            );
+        } else {
+            out_printf(self, ",,,,,,,,,\n");
+        }
+        break;
+    }
+}
+
+/// CSV record of lateness histogram `hist`, it goes to the RTT columns.
+static void out_lag_csv(Output *self, const char *name, const Histogram *hist) {
+    out_printf(
+        self, "lag,%s,,,,,,,,,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", name,
+        NS_TO_MS(hist->min), hist_mean(hist), NS_TO_MS(hist->max), hist_stddev(hist),
+        NS_TO_MS(hist_percentile(hist, 50)), NS_TO_MS(hist_percentile(hist, 90)),
+        NS_TO_MS(hist_percentile(hist, 99)), NS_TO_MS(hist_percentile(hist, 99.9)), hist_jitter(hist)
+    );
+}
+
+void output_lag(Output *self, const Histogram *lag, const Histogram *baseline) {
+    double p50 = NS_TO_MS(hist_percentile(lag, 50)), p99 = NS_TO_MS(hist_percentile(lag, 99));
+    double base_p50 = NS_TO_MS(hist_percentile(baseline, 50)), base_p99 = NS_TO_MS(hist_percentile(baseline, 99));
+
+    switch (self->format) {
+    case FmtText:
+        out_printf(self, "%s wakeup lateness %s\n", self->sep_stats, self->sep_stats);
+        out_printf(
+            self, "busy-poll loop p50/p99/max = %.3f/%.3f/%.3f ms over %lu deadlines\n",
+            p50, p99, NS_TO_MS(lag->max), (unsigned long)lag->count
+        );
+        out_printf(
+            self, "plain sleeps   p50/p99/max = %.3f/%.3f/%.3f ms over %lu sleeps\n",
+            base_p50, base_p99, NS_TO_MS(baseline->max), (unsigned long)baseline->count
+        );
+        break;
+    case FmtJson:
+        out_printf(
+            self,
+            "{\"type\":\"lag\",\"wakeups\":%lu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+            "\"baseline_p50_ms\":%.3f,\"baseline_p99_ms\":%.3f,\"baseline_max_ms\":%.3f}\n",
+            (unsigned long)lag->count, p50, p99, NS_TO_MS(lag->max),
+            base_p50, base_p99, NS_TO_MS(baseline->max)
+        );
+        break;
+    case FmtCsv:
+        out_lag_csv(self, "low-jitter", lag);
+        out_lag_csv(self, "baseline", baseline);
+        break;
+    }
+}
+
+/// Return: traceroute-like mark of the unreachable hop ("!H" - host, "!N" - network, ...),
+/// empty if the hop didn't report the target unreachable (port unreachable means it got there).
+static const char *unreach_mark(const TraceHop *hop) {
+    if (hop->addr.ss_family == AF_INET) {
+        if (hop->type != ICMP_DEST_UNREACH) return "";
+        switch (hop->code) {
+        case ICMP_NET_UNREACH: return " !N";
+        case ICMP_HOST_UNREACH: return " !H";
+        case ICMP_PROT_UNREACH: return " !P";
+        case ICMP_PORT_UNREACH: return "";
+        case ICMP_PKT_FILTERED: return " !X";
+        default: return " !";
+        }
+    }
+    if (hop->type != ICMP6_DST_UNREACH) return "";
+    switch (hop->code) {
+    case ICMP6_DST_UNREACH_NOROUTE: return " !N";
+    case ICMP6_DST_UNREACH_ADMIN: return " !X";
+    case ICMP6_DST_UNREACH_ADDR: return " !H";
+    case ICMP6_DST_UNREACH_NOPORT: return "";
+    default: return " !";
+    }
+}
+
+size_t output_trace(Output *self, const Tracer *tracer, const TracePath *path) {
+    const Target *target = path->target;
+    size_t lines = 0;
+    if (self->format == FmtText) {
+        out_printf(
+            self, "TRACE %s (%s): %u hops max\n", target->hostname, target->ip_str, tracer->opts.max_hops
+        );
+        out_printf(
+            self, "%s%4s  %-40s %6s %6s %6s %8s %8s %8s %8s %8s%s\n", self->clr_underline,
+            "HOP", "ADDRESS", "LOSS%", "SENT", "RECV", "LAST", "AVG", "BEST", "WORST", "STDEV", self->clr_reset
+        );
+        lines += 2;
+    }
+    for (uint32_t ttl = 1; ttl <= path->n_hops; ttl++) {
+        const TraceHop *hop = &path->hops[ttl - 1];
+        const TargetStats *stats = &hop->stats;
+        const Histogram *rtt = &stats->rtt;
+        bool known = hop->addr.ss_family != 0;
+        double loss = stats->sent ? (double)(stats->sent - stats->received) * 100 / stats->sent : 0;
+        double last = NS_TO_MS(rtt->last), min = NS_TO_MS(rtt->min), avg = hist_mean(rtt);
+        double max = NS_TO_MS(rtt->max), mdev = hist_stddev(rtt);
+        bool end = path->done && ttl == path->n_hops;
+        switch (self->format) {
+        case FmtText:
+            if (known == false) {
+                out_printf(self, "%3u.  %-40s %5.1f%% %6u %6u\n", ttl, "???", loss, stats->sent, stats->received);
+                break;
+            }
+            char addr[INET6_ADDRSTRLEN + 4];
+            (void)snprintf(addr, sizeof(addr), "%s%s", hop->ip_str, unreach_mark(hop));
+            out_printf(
+                self, "%3u.  %-40s %5.1f%% %6u %6u %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+                ttl, addr, loss, stats->sent, stats->received, last, avg, min, max, mdev
+            );
+            break;
+        case FmtJson:
+            out_printf(self, "{\"type\":\"hop\",\"host\":");
+            out_json_str(self, target->hostname);
+            out_printf(self, ",\"round\":%u,\"hop\":%u,\"ip\":", tracer->rounds, ttl);
+            if (known) out_printf(self, "\"%s\"", hop->ip_str);
+            else out_printf(self, "null");
+            out_printf(self, ",\"sent\":%u,\"received\":%u,\"loss_pct\":%.3f", stats->sent, stats->received, loss);
+            if (rtt->count) {
+                out_printf(
+                    self, ",\"last_ms\":%.3f,\"min_ms\":%.3f,\"avg_ms\":%.3f,\"max_ms\":%.3f,\"mdev_ms\":%.3f",
+                    last, min, avg, max, mdev
+                );
+            }
+            if (known) out_printf(self, ",\"icmp_type\":%u,\"icmp_code\":%u", hop->type, hop->code);
+            out_printf(self, ",\"end\":%s}\n", end ? "true" : "false");
+            break;
+        case FmtCsv:
+            // Hop number goes to the `ttl` column and the last RTT to `time_ms`.
+            out_printf(self, "hop,");
+            out_csv_str(self, target->hostname);
+            out_printf(self, ",%s,,,%u,", known ? hop->ip_str : "", ttl);
+            if (rtt->count) out_printf(self, "%.3f", last);
+            out_printf(self, ",%u,%u,%.3f", stats->sent, stats->received, loss);
+            if (rtt->count) {
+                out_printf(
+                    self, ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                    min, avg, max, mdev, NS_TO_MS(hist_percentile(rtt, 50)), NS_TO_MS(hist_percentile(rtt, 90)),
+                    NS_TO_MS(hist_percentile(rtt, 99)), NS_TO_MS(hist_percentile(rtt, 99.9)), hist_jitter(rtt)
+                );
+            } else {
+                out_printf(self, ",,,,,,,,,\n");
+            }
+            break;
+        }
+        lines ++;
+    }
+    return lines;
+}
+
+void output_pmtu(Output *self, const PmtuProber *prober, const PmtuPath *path) {
+    const Target *target = path->target;
+    uint32_t mtu = pmtu_result(prober, path);
+    bool limited = path->limit_addr.ss_family != 0;
+    // Range the path MTU is in, its lower end is below the protocol minimum until something got through.
+    uint32_t min_size = prober->ip == IPv4 ? PMTU_MIN_IP4 : PMTU_MIN_IP6;
+    uint32_t lo = path->lo >= min_size ? path->lo : min_size, hi = path->hi - 1;
+    bool unknown = hi < min_size;
+    double loss = path->sent ? (double)(path->sent - path->received) * 100 / path->sent : 0;
+    switch (self->format) {
+    case FmtText:
+        out_printf(self, "PMTU %s (%s): ", target->hostname, target->ip_str);
+        if (unknown) out_printf(self, "nothing got through");
+        else if (mtu == 0) out_printf(self, "%u-%u bytes", lo, hi);
+        else if (mtu == prober->opts.max_size) out_printf(self, "%u bytes or more", mtu);
+        else out_printf(self, "%u bytes", mtu);
+        if (limited) out_printf(self, ", limited by %s (mtu %u)", path->limit_ip, path->limit_mtu);
+        out_printf(self, ", %u rounds, %u/%u probes answered\n", path->rounds, path->received, path->sent);
+        break;
+    case FmtJson:
+        out_printf(self, "{\"type\":\"pmtu\",\"host\":");
+        out_json_str(self, target->hostname);
+        out_printf(self, ",\"ip\":\"%s\",\"pmtu\":", target->ip_str);
+        if (mtu) out_printf(self, "%u", mtu);
+        else out_printf(self, "null");
+        if (unknown == false) out_printf(self, ",\"min\":%u,\"max\":%u", lo, hi);
+        out_printf(self, ",\"limited_by\":");
+        if (limited) out_printf(self, "\"%s\",\"limit_mtu\":%u", path->limit_ip, path->limit_mtu);
+        else out_printf(self, "null");
+        out_printf(
+            self, ",\"rounds\":%u,\"sent\":%u,\"received\":%u,\"done\":%s}\n",
+            path->rounds, path->sent, path->received, path->done ? "true" : "false"
+        );
+        break;
+    case FmtCsv:
+        // Path MTU goes to the `bytes` column.
+        out_printf(self, "pmtu,");
+        out_csv_str(self, target->hostname);
+        out_printf(self, ",%s,,", target->ip_str);
+        if (mtu) out_printf(self, "%u", mtu);
+        out_printf(self, ",,,%u,%u,%.3f,,,,,,,,,\n", path->sent, path->received, loss);
+        break;
+    }
+}
+
+void output_rewind(Output *self, size_t lines) {
+    if (lines > 0) out_printf(self, "\e[%zuA\r\e[J", lines);
+}
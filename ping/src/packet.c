@@ -0,0 +1,146 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/packet.h"
+
+/// Attach classic BPF program that passes only incoming echo replies to `id`.
+/// Offsets are relative to the network header (`SKF_NET_OFF`), so it works on any link type.
+static int packet_attach_filter(int fd, IpVersion ip, uint16_t id) {
+    // On loopback every reply is seen twice: when it is sent and when it is received.
+    struct sock_filter ip4_code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 8, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 6),
+        // X = IP header length.
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, SKF_NET_OFF),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF + 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    // Extension headers are not followed, the ICMPv6 header must come right after the fixed one.
+    struct sock_filter ip6_code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 7, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 6),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 5),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 40),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 40 + 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, id, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog = ip == IPv4
+        ? (struct sock_fprog){sizeof(ip4_code) / sizeof(*ip4_code), ip4_code}
+        : (struct sock_fprog){sizeof(ip6_code) / sizeof(*ip6_code), ip6_code};
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+int packet_ring_open(PacketRing *self, IpVersion ip, uint16_t id) {
+    memset(self, 0, sizeof(*self));
+    self->ip = ip;
+    self->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ip == IPv4 ? ETH_P_IP : ETH_P_IPV6));
+    if (self->fd == -1) return -1;
+    // Filter goes first, so the ring never sees foreign packets.
+    if (packet_attach_filter(self->fd, ip, id) == -1) goto err;
+
+    int version = TPACKET_V3;
+    if (setsockopt(self->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) goto err;
+    // NIC timestamps if it has them turned on, software ones otherwise.
+    int ts_flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+    (void)setsockopt(self->fd, SOL_PACKET, PACKET_TIMESTAMP, &ts_flags, sizeof(ts_flags));
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PACKET_BLOCK_SIZE;
+    req.tp_block_nr = PACKET_BLOCK_NR;
+    req.tp_frame_size = PACKET_FRAME_SIZE;
+    req.tp_frame_nr = PACKET_BLOCK_SIZE / PACKET_FRAME_SIZE * PACKET_BLOCK_NR;
+    req.tp_retire_blk_tov = PACKET_BLOCK_TIMEOUT_MS;
+    if (setsockopt(self->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) goto err;
+
+    self->map_len = (size_t)PACKET_BLOCK_SIZE * PACKET_BLOCK_NR;
+    self->map = mmap(NULL, self->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, 0);
+    if (self->map == MAP_FAILED) goto err;
+    return 0;
+
+err: {
+        int saved = errno;
+        (void)close(self->fd);
+        self->fd = -1;
+        errno = saved;
+        return -1;
+    }
+}
+
+/// Parse reply right in the ring block and pass it to `cb`.
+static void packet_ring_frame(PacketRing *self, struct tpacket3_hdr *hdr, packet_frame_cb cb, void *ctx) {
+    u_char *base = (u_char *)hdr;
+    const struct sockaddr_ll *sll = (const struct sockaddr_ll *)(base + TPACKET_ALIGN(sizeof(*hdr)));
+    if (hdr->tp_net < hdr->tp_mac) return;
+    uint32_t link_len = (uint32_t)(hdr->tp_net - hdr->tp_mac);
+    if (hdr->tp_snaplen < link_len) return;
+    u_char *net = base + hdr->tp_net;
+    size_t len = hdr->tp_snaplen - link_len;
+
+    PacketFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    bool has_eth = sll->sll_hatype == ARPHRD_ETHER || sll->sll_hatype == ARPHRD_LOOPBACK;
+    if (has_eth && hdr->tp_net - hdr->tp_mac == sizeof(struct ether_header)) {
+        frame.eth = (const struct ether_header *)(base + hdr->tp_mac);
+    }
+
+    if (self->ip == IPv4) {
+        // Frames are captured before the IP layer has checked anything.
+        if (icmp_view_parse(&frame.view, IcmpSockRaw, IPv4, net, len, 0) != IcmpOk) return;
+        struct sockaddr_in *from = (struct sockaddr_in *)&frame.from;
+        from->sin_family = AF_INET;
+        from->sin_addr.s_addr = frame.view.ip4->saddr;
+    } else {
+        if (len < sizeof(struct ip6_hdr)) return;
+        frame.ip6 = (const struct ip6_hdr *)net;
+        const u_char *icmp = net + sizeof(struct ip6_hdr);
+        if (icmp_view_parse(&frame.view, IcmpSockRaw, IPv6, icmp, len - sizeof(struct ip6_hdr), 0) != IcmpOk) return;
+        struct sockaddr_in6 *from = (struct sockaddr_in6 *)&frame.from;
+        from->sin6_family = AF_INET6;
+        from->sin6_addr = frame.ip6->ip6_src;
+    }
+
+    struct timespec ts = {hdr->tp_sec, hdr->tp_nsec};
+    if (hdr->tp_status & TP_STATUS_TS_RAW_HARDWARE) frame.ts.hw = ts;
+    else frame.ts.sw = ts;
+    cb(&frame, ctx);
+}
+
+void packet_ring_read(PacketRing *self, packet_frame_cb cb, void *ctx) {
+    while (true) {
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(self->map + (size_t)self->block * PACKET_BLOCK_SIZE);
+        if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) return;
+
+        u_char *frame = (u_char *)desc + desc->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+            struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)frame;
+            packet_ring_frame(self, hdr, cb, ctx);
+            frame += hdr->tp_next_offset;
+        }
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        self->block = (self->block + 1) % PACKET_BLOCK_NR;
+    }
+}
+
+void packet_ring_close(PacketRing *self) {
+    if (self->map != NULL && self->map != MAP_FAILED) (void)munmap(self->map, self->map_len);
+    if (self->fd >= 0) (void)close(self->fd);
+    self->map = NULL;
+    self->fd = -1;
+}
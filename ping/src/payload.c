@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MISMATCH_X86
+#endif
+
+#include "../include/payload.h"
+
+/// Longest IPv4 header, with every option.
+#define IP4_HDR_MAX (60)
+
+int payload_init(IcmpPayload *self, size_t len, const u_char pattern[], size_t pattern_len) {
+    memset(self, 0, sizeof(*self));
+    // One spare byte, so `malloc(0)` never hands out NULL for an empty payload.
+    self->data = malloc(len + 1);
+    if (self->data == NULL) return -1;
+    self->len = len;
+    for (size_t i = 0; i < len; i++) {
+        self->data[i] = pattern_len > 0 ? pattern[i % pattern_len] : (u_char)i;
+    }
+    // Payload follows the 24-byte packet, so its 16-bit words line up with the message ones.
+    self->cksum = in_cksum((const char *)self->data, len, 0);
+    return 0;
+}
+
+void payload_free(IcmpPayload *self) {
+    free(self->data);
+    self->data = NULL;
+    self->len = 0;
+}
+
+void payload_apply(const IcmpPayload *self, IcmpPacket *packet) {
+    if (packet->h_type != ICMP_ECHO) return;
+    // One's complement sums of both parts added together, then folded back.
+    uint32_t sum = (uint16_t)~packet->h_cksum + (uint32_t)(uint16_t)~self->cksum;
+    sum = (sum & UINT16_MAX) + (sum >> 16);
+    packet->h_cksum = (uint16_t)~sum;
+}
+
+size_t payload_recv_len(const IcmpPayload *self) {
+    size_t len = IP4_HDR_MAX + sizeof(IcmpPacket) + self->len;
+    return len > ICMP_RECV_BUF_LEN ? len : ICMP_RECV_BUF_LEN;
+}
+
+long payload_check(const IcmpPayload *self, const IcmpView *view, const struct timespec *ts) {
+    const u_char *data = (const u_char *)view->icm + sizeof(struct icmphdr);
+    size_t len = view->icmp_len - sizeof(struct icmphdr);
+    size_t expected = sizeof(*ts) + self->len;
+    size_t common = len < expected ? len : expected;
+
+    size_t ts_len = common < sizeof(*ts) ? common : sizeof(*ts);
+    size_t off = mem_mismatch(data, ts, ts_len);
+    if (off < ts_len) return (long)off;
+    off = mem_mismatch(data + ts_len, self->data, common - ts_len);
+    if (off < common - ts_len) return (long)(ts_len + off);
+    return len == expected ? -1 : (long)common;
+}
+
+static size_t mismatch_scalar(const u_char *a, const u_char *b, size_t size) {
+    size_t i = 0;
+    // Word at a time until the differing word, then the byte within it.
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y) break;
+    }
+    for (; i < size; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return size;
+}
+
+#ifdef MISMATCH_X86
+/// Bytes are compared 32 at a time, the mask of equal ones locates the first difference.
+__attribute__((target("sse2")))
+static size_t mismatch_sse2(const u_char *a, const u_char *b, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m128i lo = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))
+        );
+        __m128i hi = _mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(a + i + 16)), _mm_loadu_si128((const __m128i *)(b + i + 16))
+        );
+        uint32_t equal = (uint32_t)_mm_movemask_epi8(lo) | (uint32_t)_mm_movemask_epi8(hi) << 16;
+        if (equal != UINT32_MAX) return i + (size_t)__builtin_ctz(~equal);
+    }
+    return i + mismatch_scalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const u_char *a, const u_char *b, size_t size) {
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m256i lo = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i))
+        );
+        __m256i hi = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(a + i + 32)), _mm256_loadu_si256((const __m256i *)(b + i + 32))
+        );
+        uint64_t equal = (uint32_t)_mm256_movemask_epi8(lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32;
+        if (equal != UINT64_MAX) return i + (size_t)__builtin_ctzll(~equal);
+    }
+    return i + mismatch_sse2(a + i, b + i, size - i);
+}
+#endif
+
+/// Fastest implementation supported by the CPU, resolved once on the first call from any thread.
+static size_t (*mismatch_impl)(const u_char *, const u_char *, size_t) = mismatch_scalar;
+static pthread_once_t mismatch_impl_once = PTHREAD_ONCE_INIT;
+
+static void mismatch_impl_resolve(void) {
+#ifdef MISMATCH_X86
+    if (in_cksum_supported(CksumAvx2)) mismatch_impl = mismatch_avx2;
+    else if (in_cksum_supported(CksumSse2)) mismatch_impl = mismatch_sse2;
+#endif
+}
+
+size_t mem_mismatch(const void *a, const void *b, size_t size) {
+    pthread_once(&mismatch_impl_once, mismatch_impl_resolve);
+    return mismatch_impl(a, b, size);
+}
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+#include "../include/pmtu.h"
+#include "../include/time_util.h"
+
+/// How long a probe may go unanswered without a timeout given.
+#define DEFAULT_TIMEOUT_MS (1000)
+/// Rounds after which the search gives up and reports the range, unless stopped by losses it takes
+/// `log(max_size) / log(PMTU_PROBES + 1)` of them.
+#define MAX_ROUNDS (16)
+
+/// Return: size of the IP header in front of the echo request, no options or extension headers are sent.
+static uint32_t ip_header_len(IpVersion ip) {
+    return ip == IPv4 ? sizeof(struct iphdr) : sizeof(struct ip6_hdr);
+}
+
+int pmtu_init(PmtuProber *self, int sockfd, IpVersion ip, uint16_t id, TargetList *targets, const PmtuOptions *opts) {
+    memset(self, 0, sizeof(*self));
+    self->sockfd = sockfd;
+    self->ip = ip;
+    self->id = id;
+    self->opts = *opts;
+    if (self->opts.timeout <= 0) self->opts.timeout = DEFAULT_TIMEOUT_MS;
+    if (icmp_attach_filter(sockfd, ip, id) == -1) return -1;
+    if (icmp_set_dont_fragment(sockfd, ip) == -1) return -1;
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+    // Only headers of the replies are read, larger ones are truncated.
+    if (icmp_recv_ring_init(self->ring, ICMP_BATCH_MAX, ICMP_RECV_BUF_LEN) == -1) return -1;
+
+    self->n_paths = target_list_ready(targets);
+    self->paths = calloc(self->n_paths, sizeof(PmtuPath));
+    if (self->paths == NULL) return -1;
+    uint32_t min_size = ip == IPv4 ? PMTU_MIN_IP4 : PMTU_MIN_IP6;
+    for (size_t i = 0; i < self->n_paths; i++) {
+        PmtuPath *path = &self->paths[i];
+        path->target = &targets->items[i];
+        path->lo = min_size - 1;
+        path->hi = opts->max_size + 1;
+        if (ip == IPv4) icmp_func.echo4_template(&path->target->packet, id);
+        else icmp_func.echo6_template(&path->target->packet, id);
+    }
+    return 0;
+}
+
+uint32_t pmtu_result(const PmtuProber *self, const PmtuPath *path) {
+    uint32_t min_size = self->ip == IPv4 ? PMTU_MIN_IP4 : PMTU_MIN_IP6;
+    return path->hi - path->lo <= 1 && path->lo >= min_size ? path->lo : 0;
+}
+
+/// Probe of `size` bytes didn't get through: lower the upper bound, unless a larger one did.
+static void pmtu_too_big(PmtuPath *path, uint32_t size) {
+    if (size > path->lo && size < path->hi) path->hi = size;
+}
+
+/// Free the probe slot of sequence number `seq`.
+/// Return: the probe it held.
+static PmtuProbe pmtu_take(PmtuProber *self, uint16_t seq) {
+    PmtuProbe probe = self->probes[seq];
+    self->probes[seq].path = 0;
+    self->outstanding --;
+    return probe;
+}
+
+/// Account answer to its probe: echo replies prove the size gets through, errors prove it doesn't.
+static void pmtu_answer(
+    PmtuProber *self, const IcmpProbeReply *reply, const struct sockaddr_storage *from, socklen_t from_len
+) {
+    if (reply->id != self->id || self->probes[reply->seq].path == 0) return;
+    PmtuPath *path = &self->paths[self->probes[reply->seq].path - 1];
+    bool echo_reply = reply->type == (self->ip == IPv4 ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY);
+    if (echo_reply && target_addr_eq(path->target, from) == false) return;
+    PmtuProbe probe = pmtu_take(self, reply->seq);
+    path->received ++;
+
+    if (echo_reply) {
+        if (probe.size > path->lo) path->lo = probe.size;
+        // Losses taken for "too big" were just losses (or the route changed): search above again.
+        if (path->lo >= path->hi) {
+            path->hi = self->opts.max_size + 1;
+            path->limit_addr.ss_family = 0;
+            path->limit_mtu = 0;
+        }
+        return;
+    }
+    bool too_big = self->ip == IPv4
+        ? reply->type == ICMP_DEST_UNREACH && reply->code == ICMP_FRAG_NEEDED
+        : reply->type == ICMP6_PACKET_TOO_BIG;
+    if (too_big == false) {
+        // Unreachable target (or a routing loop): no size gets through, whatever already did is the answer.
+        path->hi = path->lo + 1;
+        return;
+    }
+    if (reply->mtu == 0 || probe.size <= reply->mtu) {
+        // Router that didn't tell its MTU.
+        pmtu_too_big(path, probe.size);
+        return;
+    }
+    // Nothing above the next-hop MTU passes that router, sizes up to it might.
+    uint32_t limit = reply->mtu + 1 > path->lo + 1 ? reply->mtu + 1 : probe.size;
+    if (limit >= path->hi) return;
+    path->hi = limit;
+    memcpy(&path->limit_addr, from, from_len < sizeof(path->limit_addr) ? from_len : sizeof(path->limit_addr));
+    const void *addr = from->ss_family == AF_INET
+        ? (const void *)&((const struct sockaddr_in *)from)->sin_addr
+        : (const void *)&((const struct sockaddr_in6 *)from)->sin6_addr;
+    inet_ntop(from->ss_family, addr, path->limit_ip, sizeof(path->limit_ip));
+    path->limit_mtu = reply->mtu;
+}
+
+/// Receive answers until the socket is drained.
+static IcmpResult pmtu_recv(PmtuProber *self) {
+    while (true) {
+        size_t received = 0;
+        IcmpResult res = icmp_recv_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        if (res == IcmpRecvFromErr && (errno == EAGAIN || errno == EWOULDBLOCK)) return IcmpOk;
+        if (res != IcmpOk) return res;
+        for (size_t i = 0; i < received; i++) {
+            IcmpRecvSlot *slot = &self->ring[i];
+            IcmpProbeReply reply;
+            // Large echo replies don't fit the slot, only the headers are needed.
+            if (icmp_parse_probe_reply(self->ip, slot->buf, slot->len, &reply) != IcmpOk) continue;
+            pmtu_answer(self, &reply, &slot->addr, slot->addr_len);
+        }
+        if (received < ICMP_BATCH_MAX) return IcmpOk;
+    }
+}
+
+/// Batch of probes waiting for `sendmmsg`.
+typedef struct PmtuBatch {
+    IcmpPacket packets[ICMP_BATCH_MAX];
+    const IcmpPacket *ptrs[ICMP_BATCH_MAX];
+    const struct sockaddr_storage *addrs[ICMP_BATCH_MAX];
+    uint16_t lens[ICMP_BATCH_MAX];
+    uint16_t seqs[ICMP_BATCH_MAX];
+    size_t n;
+} PmtuBatch;
+
+/// Send the batch. Probes larger than the interface MTU fail right away and count as too big.
+/// Probes that find the socket buffer full are taken back, the next round covers their sizes again.
+static IcmpResult pmtu_flush(PmtuProber *self, PmtuBatch *batch) {
+    size_t done = 0;
+    while (done < batch->n) {
+        size_t sent;
+        IcmpResult res = icmp_send_batch_len(
+            batch->ptrs + done, batch->addrs + done, batch->lens + done, batch->n - done, self->sockfd, &sent
+        );
+        done += sent;
+        if (res == IcmpOk) break;
+        // A probe that was never sent must not end up counted as too big by `pmtu_end_round`.
+        if (errno == ENOBUFS || errno == EAGAIN) {
+            PmtuProbe probe = pmtu_take(self, batch->seqs[done++]);
+            self->paths[probe.path - 1].sent --;
+            continue;
+        }
+        if (errno != EMSGSIZE) return res;
+        PmtuProbe probe = pmtu_take(self, batch->seqs[done++]);
+        pmtu_too_big(&self->paths[probe.path - 1], probe.size);
+    }
+    batch->n = 0;
+    return IcmpOk;
+}
+
+/// Send probes of sizes spread evenly over the unknown range of every path that is not done,
+/// the largest one always included. Paths that don't fit the sequence space wait for the next round.
+static IcmpResult pmtu_send_round(PmtuProber *self) {
+    PmtuBatch batch;
+    batch.n = 0;
+    uint32_t ip_len = ip_header_len(self->ip);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    for (size_t i = 0; i < self->n_paths; i++) {
+        PmtuPath *path = &self->paths[i];
+        if (path->done) continue;
+        if (self->outstanding + PMTU_PROBES > UINT16_MAX + 1) break;
+        uint32_t first = path->lo + 1, width = path->hi - first;
+        uint32_t n = width < PMTU_PROBES ? width : PMTU_PROBES;
+        path->rounds ++;
+        for (uint32_t k = 1; k <= n; k++) {
+            uint32_t size = first - 1 + (uint32_t)(((uint64_t)width * k + n - 1) / n);
+            uint16_t seq = self->next_seq++;
+            // Rounds wait for all their probes, so the slot is free.
+            self->probes[seq] = (PmtuProbe){.path = i + 1, .size = size};
+            self->outstanding ++;
+            path->sent ++;
+
+            batch.packets[batch.n] = path->target->packet;
+            icmp_func.echo_update(&batch.packets[batch.n], seq, &now);
+            batch.ptrs[batch.n] = &batch.packets[batch.n];
+            batch.addrs[batch.n] = &path->target->addr;
+            batch.lens[batch.n] = (uint16_t)(size - ip_len);
+            batch.seqs[batch.n] = seq;
+            if (++batch.n < ICMP_BATCH_MAX) continue;
+            IcmpResult res = pmtu_flush(self, &batch);
+            if (res != IcmpOk) return res;
+        }
+    }
+    return batch.n > 0 ? pmtu_flush(self, &batch) : IcmpOk;
+}
+
+/// Count unanswered probes of the round as too big, and finish paths whose range closed.
+/// Return: whether every path is done.
+static bool pmtu_end_round(PmtuProber *self) {
+    for (size_t seq = 0; self->outstanding > 0 && seq <= UINT16_MAX; seq++) {
+        if (self->probes[seq].path == 0) continue;
+        PmtuProbe probe = pmtu_take(self, (uint16_t)seq);
+        pmtu_too_big(&self->paths[probe.path - 1], probe.size);
+    }
+    bool all_done = true;
+    for (size_t i = 0; i < self->n_paths; i++) {
+        PmtuPath *path = &self->paths[i];
+        if (path->done) continue;
+        if (path->hi - path->lo <= 1 || path->rounds >= MAX_ROUNDS) {
+            path->done = true;
+            if (self->on_path) self->on_path(self, path, self->ctx);
+        } else {
+            all_done = false;
+        }
+    }
+    return all_done;
+}
+
+IcmpResult pmtu_run(PmtuProber *self) {
+    struct pollfd pfd = {.fd = self->sockfd, .events = POLLIN};
+    struct timespec now, round_end;
+    bool all_done = self->n_paths == 0;
+
+    while (self->stop == false && all_done == false) {
+        IcmpResult res = pmtu_send_round(self);
+        if (res != IcmpOk) return res;
+        self->rounds ++;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        round_end = ts_add_ms(now, self->opts.timeout);
+
+        // Next round needs all answers of this one (or the timeout), that is when the range is known.
+        while (self->stop == false && self->outstanding > 0 && calc_time(&round_end, &now) < 0) {
+            struct timespec timeout = ts_add_ms((struct timespec){0, 0}, calc_time(&now, &round_end));
+            if (ppoll(&pfd, 1, &timeout, NULL) == -1 && errno != EINTR) return IcmpRecvFromErr;
+            if (pfd.revents & POLLIN) {
+                res = pmtu_recv(self);
+                if (res != IcmpOk) return res;
+            }
+            clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        }
+        if (self->stop) break;
+        all_done = pmtu_end_round(self);
+    }
+    // Interrupted search reports the range it got to.
+    for (size_t i = 0; i < self->n_paths; i++) {
+        if (self->paths[i].done || self->on_path == NULL) continue;
+        self->on_path(self, &self->paths[i], self->ctx);
+    }
+    return IcmpOk;
+}
+
+void pmtu_stop(PmtuProber *self) {
+    self->stop = true;
+}
+
+void pmtu_free(PmtuProber *self) {
+    icmp_recv_ring_free(self->ring);
+    free(self->paths);
+    self->paths = NULL;
+    self->n_paths = 0;
+}
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../include/record.h"
+#include "../include/time_util.h"
+
+/// Return: nanoseconds from `start` to `end`, 0 if `end` is earlier.
+static uint64_t ns_between(const struct timespec *start, const struct timespec *end) {
+    long long ns = (long long)(end->tv_sec - start->tv_sec) * NANOS_IN_SEC + (end->tv_nsec - start->tv_nsec);
+    return ns > 0 ? (uint64_t)ns : 0;
+}
+
+/// Return: file length with room for `capacity` records.
+static size_t record_file_len(const RecordHeader *header, uint64_t capacity) {
+    return header->data_offset + capacity * sizeof(RecordEntry);
+}
+
+/// Extend file from `from` to `len` bytes reserving disk blocks, so stores into
+/// the mapping don't fault on a full disk later.
+static int record_reserve(int fd, size_t from, size_t len) {
+    if (fallocate(fd, 0, (off_t)from, (off_t)(len - from)) == 0) return 0;
+    // Not every filesystem supports preallocation, a sparse file works too.
+    if (errno != EOPNOTSUPP) return -1;
+    return ftruncate(fd, (off_t)len);
+}
+
+int recorder_open(Recorder *self, const char *path, size_t n_targets, uint64_t limit) {
+    memset(self, 0, sizeof(*self));
+    if (limit == 0 || n_targets > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    self->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (self->fd == -1) return -1;
+
+    RecordHeader header = {
+        .magic = RECORD_MAGIC,
+        .version = RECORD_VERSION,
+        .record_size = sizeof(RecordEntry),
+        .capacity = limit < RECORD_INITIAL_CAPACITY ? limit : RECORD_INITIAL_CAPACITY,
+        .limit = limit,
+        .n_targets = (uint32_t)n_targets,
+        .addr_len = RECORD_ADDR_LEN,
+    };
+    // Records start at a page boundary after the header and the target table.
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t meta_len = sizeof(header) + n_targets * RECORD_ADDR_LEN;
+    header.data_offset = (meta_len + page - 1) / page * page;
+    self->map_len = record_file_len(&header, header.capacity);
+
+    if (record_reserve(self->fd, 0, self->map_len) == -1) goto err;
+    void *map = mmap(NULL, self->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (map == MAP_FAILED) goto err;
+    self->header = map;
+    self->entries = (RecordEntry *)((char *)map + header.data_offset);
+
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &self->start);
+    header.start_ns = (uint64_t)realtime.tv_sec * NANOS_IN_SEC + (uint64_t)realtime.tv_nsec;
+    *self->header = header;
+    return 0;
+
+err: {
+        int saved = errno;
+        (void)close(self->fd);
+        errno = saved;
+        return -1;
+    }
+}
+
+/// Double the file (up to the limit) and remap it.
+static int recorder_grow(Recorder *self) {
+    RecordHeader *header = self->header;
+    uint64_t capacity = header->capacity * 2 < header->limit ? header->capacity * 2 : header->limit;
+    size_t len = record_file_len(header, capacity);
+    if (record_reserve(self->fd, self->map_len, len) == -1) return -1;
+    void *map = mremap(self->header, self->map_len, len, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) return -1;
+    self->header = map;
+    self->entries = (RecordEntry *)((char *)map + self->header->data_offset);
+    self->map_len = len;
+    self->header->capacity = capacity;
+    return 0;
+}
+
+void recorder_target(Recorder *self, size_t index, const Target *target) {
+    char *addr = (char *)self->header + sizeof(RecordHeader) + index * RECORD_ADDR_LEN;
+    strncpy(addr, target->ip_str, RECORD_ADDR_LEN - 1);
+}
+
+uint64_t recorder_append(Recorder *self, uint32_t target, uint32_t seq, const struct timespec *sent_at) {
+    if (self->header->head == self->header->capacity && self->header->capacity < self->header->limit) {
+        // If the file can't grow (e.g. the disk is full), the ring just wraps earlier.
+        if (recorder_grow(self) == -1) self->header->limit = self->header->capacity;
+    }
+    RecordHeader *header = self->header;
+    uint64_t index = header->head;
+    self->entries[index % header->capacity] = (RecordEntry){
+        .send_ns = ns_between(&self->start, sent_at),
+        .seq = seq,
+        .target = target,
+        .result = IcmpNoReplyErr,
+    };
+    header->head = index + 1;
+    return index;
+}
+
+void recorder_complete(Recorder *self, uint64_t index, double rtt, uint8_t ttl) {
+    const RecordHeader *header = self->header;
+    if (header->head - index > header->capacity) return;
+    RecordEntry *entry = &self->entries[index % header->capacity];
+    entry->recv_ns = entry->send_ns + (uint64_t)llround(rtt * NANOS_IN_MILLI);
+    entry->ttl = ttl;
+    entry->result = IcmpOk;
+}
+
+void recorder_close(Recorder *self) {
+    RecordHeader *header = self->header;
+    // Give back the preallocated tail the ring never reached.
+    size_t len = self->map_len;
+    if (header->head < header->capacity) {
+        header->capacity = header->head;
+        len = record_file_len(header, header->capacity);
+    }
+    (void)munmap(self->header, self->map_len);
+    (void)ftruncate(self->fd, (off_t)len);
+    (void)close(self->fd);
+    self->header = NULL;
+    self->entries = NULL;
+}
+
+int record_reader_open(RecordReader *self, const char *path) {
+    memset(self, 0, sizeof(*self));
+    self->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (self->fd == -1) return -1;
+
+    RecordHeader *header = &self->header;
+    if (pread(self->fd, header, sizeof(*header), 0) != sizeof(*header)) goto invalid;
+    if (
+        memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != RECORD_VERSION ||
+        header->record_size != sizeof(RecordEntry) ||
+        header->addr_len != RECORD_ADDR_LEN ||
+        header->data_offset < sizeof(*header) + (uint64_t)header->n_targets * RECORD_ADDR_LEN ||
+        (header->capacity == 0 && header->head != 0)
+    ) goto invalid;
+
+    size_t addrs_len = (size_t)header->n_targets * RECORD_ADDR_LEN;
+    self->addrs = malloc(addrs_len + 1);
+    if (self->addrs == NULL) goto err;
+    if (pread(self->fd, self->addrs, addrs_len, sizeof(*header)) != (ssize_t)addrs_len) goto invalid;
+    for (uint32_t i = 0; i < header->n_targets; i++) {
+        self->addrs[i * RECORD_ADDR_LEN + RECORD_ADDR_LEN - 1] = '\0';
+    }
+
+    // Once the ring wrapped, the oldest record is the one after the newest.
+    self->left = header->head < header->capacity ? header->head : header->capacity;
+    self->next = header->head - self->left;
+    (void)posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return 0;
+
+invalid:
+    errno = EINVAL;
+err: {
+        int saved = errno;
+        free(self->addrs);
+        (void)close(self->fd);
+        errno = saved;
+        return -1;
+    }
+}
+
+ssize_t record_reader_read(RecordReader *self, RecordEntry *entries, size_t n) {
+    if (n > self->left) n = self->left;
+    if (n == 0) return 0;
+    uint64_t pos = self->next % self->header.capacity;
+    // Reads never cross the end of the ring.
+    if (pos + n > self->header.capacity) n = self->header.capacity - pos;
+
+    off_t offset = (off_t)(self->header.data_offset + pos * sizeof(RecordEntry));
+    ssize_t res = pread(self->fd, entries, n * sizeof(RecordEntry), offset);
+    if (res == -1) return -1;
+    size_t read = (size_t)res / sizeof(RecordEntry);
+    // File was cut short (e.g. the writer crashed before syncing), nothing follows.
+    if (read == 0) self->left = 0;
+    self->left -= read;
+    self->next += read;
+    return (ssize_t)read;
+}
+
+const char *record_reader_addr(const RecordReader *self, uint32_t index) {
+    if (index >= self->header.n_targets) return "?";
+    return self->addrs + (size_t)index * RECORD_ADDR_LEN;
+}
+
+void record_reader_close(RecordReader *self) {
+    free(self->addrs);
+    (void)close(self->fd);
+}
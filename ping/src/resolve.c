@@ -0,0 +1,304 @@
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <errno.h>
+#include <netdb.h>
+#include <resolv.h>
+#include <ctype.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../include/resolve.h"
+
+/// Return: FNV-1a hash of the string, case-insensitive like hostnames.
+static uint64_t hash_str(const char *str) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *str != '\0'; str++) {
+        hash ^= (unsigned char)tolower((unsigned char)*str);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static time_t now_sec() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/// Return: entry of the hostname, stale ones included. Must be called with the lock held.
+static ResolveEntry *cache_find(ResolveCache *self, const char *hostname) {
+    ResolveEntry *entry = self->buckets[hash_str(hostname) & (self->n_buckets - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (strcasecmp(entry->hostname, hostname) == 0) return entry;
+    }
+    return NULL;
+}
+
+/// Add an empty entry of the hostname. Must be called with the lock held.
+/// Return: the entry, NULL if out of memory.
+static ResolveEntry *cache_insert(ResolveCache *self, const char *hostname) {
+    ResolveEntry *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) return NULL;
+    entry->hostname = strdup(hostname);
+    if (entry->hostname == NULL) {
+        free(entry);
+        return NULL;
+    }
+    size_t bucket = hash_str(hostname) & (self->n_buckets - 1);
+    entry->next = self->buckets[bucket];
+    self->buckets[bucket] = entry;
+    return entry;
+}
+
+/// Parse numeric address of the `ip` family.
+/// Return: 0 on success, -1 if the hostname is not a numeric address.
+static int resolve_numeric(const char *hostname, IpVersion ip, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    memset(addr, 0, sizeof(*addr));
+    if (ip == IPv4) {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        if (inet_pton(AF_INET, hostname, &in->sin_addr) != 1) return -1;
+        in->sin_family = AF_INET;
+        *addr_len = sizeof(*in);
+    } else {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+        if (inet_pton(AF_INET6, hostname, &in6->sin6_addr) != 1) return -1;
+        in6->sin6_family = AF_INET6;
+        *addr_len = sizeof(*in6);
+    }
+    return 0;
+}
+
+/// Take names with an address of the `ip` family from the hosts file, the first line
+/// of a name wins as in `getaddrinfo`. A missing file is no error, nor is running out of memory:
+/// names that don't fit are looked up like any other.
+static void cache_load_hosts(ResolveCache *self, IpVersion ip) {
+    FILE *file = fopen(RESOLVE_HOSTS_PATH, "re");
+    if (file == NULL) return;
+    char line[1024];
+    const char *blank = " \t\r\n";
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+        char *save = NULL;
+        const char *addr_str = strtok_r(line, blank, &save);
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        if (addr_str == NULL || resolve_numeric(addr_str, ip, &addr, &addr_len) == -1) continue;
+        for (const char *name = strtok_r(NULL, blank, &save); name != NULL; name = strtok_r(NULL, blank, &save)) {
+            if (cache_find(self, name) != NULL) continue;
+            ResolveEntry *entry = cache_insert(self, name);
+            if (entry == NULL) break;
+            entry->addr = addr;
+            entry->addr_len = addr_len;
+        }
+    }
+    (void)fclose(file);
+}
+
+/// Size the table for `n_hint` names, so chains stay short, and fill it from the hosts file.
+/// Return: 0 on success, otherwise error number.
+static int cache_init(ResolveCache *self, size_t n_hint, IpVersion ip) {
+    self->n_buckets = 16;
+    while (self->n_buckets < n_hint * 2) self->n_buckets *= 2;
+    self->buckets = calloc(self->n_buckets, sizeof(ResolveEntry *));
+    if (self->buckets == NULL) return ENOMEM;
+    int err = pthread_mutex_init(&self->lock, NULL);
+    if (err == 0) err = pthread_cond_init(&self->resolved, NULL);
+    if (err != 0) return err;
+    cache_load_hosts(self, ip);
+    return 0;
+}
+
+/// Return: true and the cached result if there is a fresh entry for the hostname. Otherwise
+/// the caller has to look the name up and `cache_put` the result: callers that ask for the
+/// same name meanwhile wait for it rather than query too.
+static bool cache_get(
+    ResolveCache *self, const char *hostname, int *status,
+    struct sockaddr_storage *addr, socklen_t *addr_len
+) {
+    pthread_mutex_lock(&self->lock);
+    ResolveEntry *entry = cache_find(self, hostname);
+    while (entry != NULL && entry->resolving) pthread_cond_wait(&self->resolved, &self->lock);
+    bool fresh = entry != NULL && (entry->expires == 0 || entry->expires > now_sec());
+    if (fresh) {
+        *status = entry->status;
+        *addr = entry->addr;
+        *addr_len = entry->addr_len;
+    } else if (entry != NULL || (entry = cache_insert(self, hostname)) != NULL) {
+        entry->resolving = true;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return fresh;
+}
+
+/// Remember result for `ttl` seconds and wake threads waiting for it.
+/// The cache is best effort, so allocation failures are ignored.
+static void cache_put(
+    ResolveCache *self, const char *hostname, int status,
+    const struct sockaddr_storage *addr, socklen_t addr_len, uint32_t ttl
+) {
+    pthread_mutex_lock(&self->lock);
+    ResolveEntry *entry = cache_find(self, hostname);
+    if (entry == NULL) entry = cache_insert(self, hostname);
+    if (entry != NULL) {
+        entry->status = status;
+        if (status == 0) {
+            entry->addr = *addr;
+            entry->addr_len = addr_len;
+        }
+        entry->expires = now_sec() + ttl;
+        entry->resolving = false;
+    }
+    pthread_cond_broadcast(&self->resolved);
+    pthread_mutex_unlock(&self->lock);
+}
+
+static void cache_free(ResolveCache *self) {
+    if (self->buckets == NULL) return;
+    for (size_t i = 0; i < self->n_buckets; i++) {
+        ResolveEntry *entry = self->buckets[i];
+        while (entry != NULL) {
+            ResolveEntry *next = entry->next;
+            free(entry->hostname);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(self->buckets);
+    self->buckets = NULL;
+    pthread_cond_destroy(&self->resolved);
+    pthread_mutex_destroy(&self->lock);
+}
+
+/// Query DNS for the A (AAAA) record of a name, it is the only way to learn its TTL.
+/// Return: 0 and the smallest TTL of the answer chain (CNAMEs included) up to the address in `ttl`,
+/// -1 if DNS has no such address or couldn't answer.
+static int resolve_ttl(res_state state, const char *hostname, IpVersion ip, uint32_t *ttl) {
+    u_char answer[4 * NS_PACKETSZ];
+    ns_type type = ip == IPv4 ? ns_t_a : ns_t_aaaa;
+    int len = res_nsearch(state, hostname, ns_c_in, type, answer, sizeof(answer));
+    if (len < 0) return -1;
+    ns_msg msg;
+    if (ns_initparse(answer, len < (int)sizeof(answer) ? len : (int)sizeof(answer), &msg) == -1) return -1;
+
+    uint32_t min_ttl = UINT32_MAX;
+    for (int i = 0; i < ns_msg_count(msg, ns_s_an); i++) {
+        ns_rr rr;
+        if (ns_parserr(&msg, ns_s_an, i, &rr) == -1) return -1;
+        if (ns_rr_ttl(rr) < min_ttl) min_ttl = ns_rr_ttl(rr);
+        if (ns_rr_type(rr) == type) {
+            *ttl = min_ttl;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/// Return: true if the name belongs to multicast DNS (RFC 6762), unicast DNS has no answer for it.
+static bool resolve_mdns(const char *hostname) {
+    size_t len = strlen(hostname);
+    if (len > 0 && hostname[len - 1] == '.') len --;
+    return len >= 6 && strncasecmp(hostname + len - 6, ".local", 6) == 0;
+}
+
+/// Resolve hostname through the cache, `state` is the resolver of the thread (NULL without DNS).
+/// Return: 0 on success, otherwise `getaddrinfo` error code.
+static int resolve_cached(
+    ResolveCache *cache, res_state state, const char *hostname, IpVersion ip,
+    struct sockaddr_storage *addr, socklen_t *addr_len
+) {
+    if (resolve_numeric(hostname, ip, addr, addr_len) == 0) return 0;
+    int status;
+    if (cache_get(cache, hostname, &status, addr, addr_len)) return status;
+
+    // Names are resolved the way the system is configured to (nsswitch: local hostname, LDAP,
+    // container names), DNS is only asked how long the answer stays valid.
+    uint32_t ttl = RESOLVE_DEFAULT_TTL;
+    status = target_lookup(hostname, ip, addr, addr_len);
+    if (status == 0 && state != NULL && resolve_mdns(hostname) == false && resolve_ttl(state, hostname, ip, &ttl) == -1) {
+        ttl = RESOLVE_DEFAULT_TTL;
+    }
+    cache_put(cache, hostname, status, addr, *addr_len, ttl);
+    return status;
+}
+
+static void *resolver_main(void *arg) {
+    Resolver *self = arg;
+    struct __res_state state;
+    memset(&state, 0, sizeof(state));
+    bool dns = res_ninit(&state) == 0;
+
+    while (atomic_load(&self->stop) == false) {
+        size_t i = atomic_fetch_add(&self->next, 1);
+        if (i >= self->n_hostnames) break;
+        const char *hostname = self->hostnames[i];
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        int status = resolve_cached(&self->cache, dns ? &state : NULL, hostname, self->ip, &addr, &addr_len);
+        if (status != 0) {
+            if (self->on_error) self->on_error(hostname, status, self->ctx);
+            continue;
+        }
+        Target target;
+        target_init(&target, hostname, i, &addr, addr_len);
+        target_list_push(self->targets, &target);
+    }
+
+    if (dns) res_nclose(&state);
+    if (atomic_fetch_sub(&self->running, 1) == 1) target_list_finish(self->targets);
+    return NULL;
+}
+
+int resolver_start(
+    Resolver *self, char **hostnames, size_t n_hostnames, IpVersion ip,
+    TargetList *targets, resolve_error_cb on_error, void *ctx
+) {
+    memset(self, 0, sizeof(*self));
+    self->hostnames = hostnames;
+    self->n_hostnames = n_hostnames;
+    self->ip = ip;
+    self->targets = targets;
+    self->on_error = on_error;
+    self->ctx = ctx;
+    int err = cache_init(&self->cache, n_hostnames, ip);
+    if (err != 0) return err;
+
+    size_t n_threads = n_hostnames < RESOLVE_MAX_THREADS ? n_hostnames : RESOLVE_MAX_THREADS;
+    if (n_threads == 0) {
+        target_list_finish(targets);
+        return 0;
+    }
+    atomic_init(&self->next, 0);
+    atomic_init(&self->running, n_threads);
+    atomic_init(&self->stop, false);
+
+    // Signals are left to the caller's thread.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (; self->n_threads < n_threads; self->n_threads++) {
+        err = pthread_create(&self->threads[self->n_threads], NULL, resolver_main, self);
+        if (err != 0) break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    // Fewer threads just resolve slower, but the last one still has to finish the list.
+    size_t missing = n_threads - self->n_threads;
+    if (missing > 0 && atomic_fetch_sub(&self->running, missing) == missing) target_list_finish(targets);
+    return self->n_threads > 0 ? 0 : err;
+}
+
+void resolver_stop(Resolver *self) {
+    atomic_store(&self->stop, true);
+}
+
+void resolver_join(Resolver *self) {
+    for (size_t i = 0; i < self->n_threads; i++) {
+        (void)pthread_join(self->threads[i], NULL);
+    }
+    self->n_threads = 0;
+    cache_free(&self->cache);
+}
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "../include/session.h"
+#include "../include/time_util.h"
+
+/// Timeout of probes unless the options give one.
+#define DEFAULT_TIMEOUT_MS (1000)
+/// Probe slots a session starts with, the table doubles up to the whole sequence space
+/// as more probes are in flight at once.
+#define MIN_PROBES (64)
+/// Results a session starts with, the queue doubles up to `ICMP_SESSION_RESULTS` while nobody collects them.
+#define MIN_RESULTS (64)
+
+/// Outstanding probe slot indexed by the ICMP sequence number on the wire.
+typedef struct SessionProbe {
+    /// Index of the target + 1, 0 means the slot is free.
+    size_t target;
+    uint32_t seq;
+    /// Number of the probe in the session, its wire sequence number is the low 16 bits.
+    uint64_t n;
+    struct timespec sent_at;
+} SessionProbe;
+
+struct IcmpSession {
+    pthread_mutex_t lock;
+    int sockfd;
+    IcmpSocketKind kind;
+    IpVersion ip;
+    uint16_t id;
+    double timeout;
+    Target *targets;
+    size_t n_targets;
+    size_t cap_targets;
+    /// Probes sent so far, and the oldest one that may still be waiting for its timeout.
+    uint64_t n_sent;
+    uint64_t n_expired;
+    /// Probe slots indexed by the number of the probe modulo `cap_probes` (a power of two),
+    /// the table holds every probe that may still be waiting for its reply.
+    SessionProbe *probes;
+    size_t cap_probes;
+    /// Ring of results not collected yet.
+    IcmpProbeResult *results;
+    size_t cap_results;
+    size_t results_head;
+    size_t n_results;
+    IcmpRecvSlot ring[ICMP_BATCH_MAX];
+};
+
+/// Return: slot of the probe with number `n`.
+static inline SessionProbe *session_probe(IcmpSession *self, uint64_t n) {
+    return &self->probes[n & (self->cap_probes - 1)];
+}
+
+IcmpSession *icmp_session_new(const IcmpSessionOptions *opts) {
+    IcmpSession *self = calloc(1, sizeof(IcmpSession));
+    if (self == NULL) return NULL;
+    self->probes = calloc(MIN_PROBES, sizeof(SessionProbe));
+    self->results = calloc(MIN_RESULTS, sizeof(IcmpProbeResult));
+    if (self->probes == NULL || self->results == NULL) {
+        free(self->probes);
+        free(self->results);
+        free(self);
+        return NULL;
+    }
+    self->cap_probes = MIN_PROBES;
+    self->cap_results = MIN_RESULTS;
+    self->ip = opts->ip;
+    self->timeout = opts->timeout > 0 ? opts->timeout : DEFAULT_TIMEOUT_MS;
+    // Raw sockets of all sessions see the same packets, the kernel filter sorts them out by a random id.
+    if (getrandom(&self->id, sizeof(self->id), 0) != sizeof(self->id)) self->id = (uint16_t)getpid();
+    self->sockfd = icmp_socket(opts->ip, opts->kind, &self->id);
+    if (self->sockfd == -1) {
+        int err = errno;
+        free(self->probes);
+        free(self->results);
+        free(self);
+        errno = err;
+        return NULL;
+    }
+    self->kind = icmp_socket_kind(self->sockfd);
+    int flags = fcntl(self->sockfd, F_GETFL);
+    if (
+        (self->kind == IcmpSockRaw && icmp_attach_filter(self->sockfd, self->ip, self->id) == -1) ||
+        flags == -1 || fcntl(self->sockfd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        icmp_recv_ring_init(self->ring, ICMP_BATCH_MAX, ICMP_RECV_BUF_LEN) == -1
+    ) {
+        int err = errno;
+        close(self->sockfd);
+        free(self->probes);
+        free(self->results);
+        free(self);
+        errno = err;
+        return NULL;
+    }
+    pthread_mutex_init(&self->lock, NULL);
+    return self;
+}
+
+long icmp_session_add(IcmpSession *self, const char *name, const struct sockaddr_storage *addr, socklen_t addr_len) {
+    if (addr->ss_family != (self->ip == IPv4 ? AF_INET : AF_INET6)) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+    char *hostname = strdup(name);
+    if (hostname == NULL) return -1;
+    pthread_mutex_lock(&self->lock);
+    if (self->n_targets == self->cap_targets) {
+        size_t cap = self->cap_targets ? self->cap_targets * 2 : 16;
+        Target *targets = realloc(self->targets, cap * sizeof(Target));
+        if (targets == NULL) {
+            pthread_mutex_unlock(&self->lock);
+            free(hostname);
+            return -1;
+        }
+        self->targets = targets;
+        self->cap_targets = cap;
+    }
+    size_t i = self->n_targets++;
+    Target *target = &self->targets[i];
+    target_init(target, hostname, i, addr, addr_len);
+    if (self->ip == IPv4) icmp_func.echo4_template(&target->packet, self->id);
+    else icmp_func.echo6_template(&target->packet, self->id);
+    pthread_mutex_unlock(&self->lock);
+    return (long)i;
+}
+
+int icmp_session_fd(const IcmpSession *self) {
+    return self->sockfd;
+}
+
+/// Double the result queue, unless it holds `ICMP_SESSION_RESULTS` already.
+/// Return: 0 on success, -1 if it can't grow.
+static int session_grow_results(IcmpSession *self) {
+    if (self->cap_results == ICMP_SESSION_RESULTS) return -1;
+    size_t cap = self->cap_results * 2;
+    IcmpProbeResult *results = malloc(cap * sizeof(IcmpProbeResult));
+    if (results == NULL) return -1;
+    for (size_t i = 0; i < self->n_results; i++) {
+        results[i] = self->results[(self->results_head + i) % self->cap_results];
+    }
+    free(self->results);
+    self->results = results;
+    self->cap_results = cap;
+    self->results_head = 0;
+    return 0;
+}
+
+/// Queue result, the oldest one is dropped if nobody collected them for too long.
+static void session_push_result(IcmpSession *self, const IcmpProbeResult *result) {
+    if (self->n_results == self->cap_results && session_grow_results(self) == -1) {
+        self->results_head = (self->results_head + 1) % self->cap_results;
+        self->n_results --;
+    }
+    self->results[(self->results_head + self->n_results++) % self->cap_results] = *result;
+}
+
+/// Make room for `n` more probes: the table grows until every probe that may still get
+/// a reply has a slot of its own, or it covers the whole sequence space.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+static int session_reserve(IcmpSession *self, size_t n) {
+    uint64_t need = self->n_sent - self->n_expired + n;
+    if (need <= self->cap_probes || self->cap_probes == UINT16_MAX + 1) return 0;
+    size_t cap = self->cap_probes;
+    while (cap < need && cap < UINT16_MAX + 1) cap *= 2;
+    SessionProbe *probes = calloc(cap, sizeof(SessionProbe));
+    if (probes == NULL) return -1;
+    for (uint64_t k = self->n_expired; k < self->n_sent; k++) {
+        const SessionProbe *probe = session_probe(self, k);
+        if (probe->target != 0 && probe->n == k) probes[k & (cap - 1)] = *probe;
+    }
+    free(self->probes);
+    self->probes = probes;
+    self->cap_probes = cap;
+    return 0;
+}
+
+/// Report probe lost and free its slot.
+static void session_lose(IcmpSession *self, SessionProbe *probe) {
+    IcmpProbeResult result = {.target = probe->target - 1, .seq = probe->seq, .status = ProbeTimeout, .ttl = -1};
+    probe->target = 0;
+    session_push_result(self, &result);
+}
+
+/// Patch echo request template of target `i` with the next wire sequence number and take a probe slot for it.
+static const IcmpPacket *session_new_probe(IcmpSession *self, size_t i, const struct timespec *now) {
+    uint64_t n = self->n_sent++;
+    SessionProbe *probe = session_probe(self, n);
+    // Slot of the probe sent 65536 probes ago: it waited way too long already.
+    if (probe->target != 0) session_lose(self, probe);
+    Target *target = &self->targets[i];
+    *probe = (SessionProbe){.target = i + 1, .seq = target->next_seq++, .n = n, .sent_at = *now};
+    target->stats.sent ++;
+    icmp_func.echo_update(&target->packet, (uint16_t)n, now);
+    return &target->packet;
+}
+
+/// Free slots of probes that were not sent after all.
+static void session_unsend(IcmpSession *self, uint64_t from) {
+    for (uint64_t n = from; n < self->n_sent; n++) {
+        SessionProbe *probe = session_probe(self, n);
+        self->targets[probe->target - 1].stats.sent --;
+        self->targets[probe->target - 1].next_seq --;
+        probe->target = 0;
+    }
+    self->n_sent = from;
+}
+
+int icmp_session_submit(IcmpSession *self, size_t target) {
+    pthread_mutex_lock(&self->lock);
+    if (target >= self->n_targets) {
+        pthread_mutex_unlock(&self->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    if (session_reserve(self, 1) == -1) {
+        pthread_mutex_unlock(&self->lock);
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    uint64_t first = self->n_sent;
+    const IcmpPacket *packet = session_new_probe(self, target, &now);
+    IcmpResult res = icmp_func.send(packet, self->sockfd, &self->targets[target].addr);
+    if (res != IcmpOk) session_unsend(self, first);
+    pthread_mutex_unlock(&self->lock);
+    return res == IcmpOk ? 0 : -1;
+}
+
+int icmp_session_submit_all(IcmpSession *self) {
+    const IcmpPacket *packets[ICMP_BATCH_MAX];
+    const struct sockaddr_storage *addrs[ICMP_BATCH_MAX];
+    pthread_mutex_lock(&self->lock);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    int ret = 0;
+    for (size_t i = 0; i < self->n_targets && ret == 0; i += ICMP_BATCH_MAX) {
+        size_t chunk = self->n_targets - i < ICMP_BATCH_MAX ? self->n_targets - i : ICMP_BATCH_MAX;
+        if (session_reserve(self, chunk) == -1) {
+            ret = -1;
+            break;
+        }
+        uint64_t first = self->n_sent;
+        for (size_t j = 0; j < chunk; j++) {
+            packets[j] = session_new_probe(self, i + j, &now);
+            addrs[j] = &self->targets[i + j].addr;
+        }
+        size_t sent = 0;
+        if (icmp_func.send_batch(packets, addrs, chunk, self->sockfd, &sent) != IcmpOk) ret = -1;
+        session_unsend(self, first + sent);
+    }
+    pthread_mutex_unlock(&self->lock);
+    return ret;
+}
+
+/// Match reply to its outstanding probe and queue the result.
+static void session_dispatch(
+    IcmpSession *self, const IcmpRecvSlot *slot, const struct timespec *recv_at
+) {
+    const IcmpView *view = &slot->view;
+    uint8_t reply_type = self->ip == IPv4 ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY;
+    if (icmp_view_type(view) != reply_type || icmp_view_id(view) != self->id) return;
+    SessionProbe *probe = session_probe(self, icmp_view_seq(view));
+    // Slots are shared by sequence numbers `cap_probes` apart.
+    if (probe->target == 0 || (uint16_t)probe->n != icmp_view_seq(view)) return;
+    Target *target = &self->targets[probe->target - 1];
+    if (target_addr_eq(target, &slot->addr) == false) return;
+
+    IcmpProbeResult result = {.target = probe->target - 1, .seq = probe->seq, .status = ProbeReply};
+    probe->target = 0;
+    result.time = calc_time(&probe->sent_at, recv_at);
+    if (view->ip4 != NULL) result.ttl = icmp_view_ttl(view);
+    else if (self->ip == IPv6) result.ttl = slot->info6.hop_limit;
+    else result.ttl = -1;
+    target->stats.received ++;
+    hist_record(&target->stats.rtt, (uint64_t)llround(result.time * NANOS_IN_MILLI));
+    session_push_result(self, &result);
+}
+
+/// Receive replies until the socket is drained.
+static int session_recv(IcmpSession *self) {
+    while (true) {
+        size_t received = 0;
+        IcmpResult res;
+        if (self->kind == IcmpSockDgram) {
+            res = icmp_func.recv_dgram_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        } else if (self->ip == IPv4) {
+            res = icmp_func.recv4_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        } else {
+            res = icmp_func.recv6_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        }
+        if (res == IcmpRecvFromErr && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (res != IcmpOk) return -1;
+
+        struct timespec recv_at;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &recv_at);
+        for (size_t i = 0; i < received; i++) {
+            // Corrupted packets are dropped just like foreign ones.
+            if (self->ring[i].res != IcmpOk) continue;
+            session_dispatch(self, &self->ring[i], &recv_at);
+        }
+        if (received < ICMP_BATCH_MAX) return 0;
+    }
+}
+
+/// Report probes whose timeout elapsed as lost. Probes time out in the order they were sent.
+static void session_expire(IcmpSession *self, const struct timespec *now) {
+    for (; self->n_expired < self->n_sent; self->n_expired++) {
+        SessionProbe *probe = session_probe(self, self->n_expired);
+        // Answered already, or the slot was taken over by a newer probe.
+        if (probe->target == 0 || probe->n != self->n_expired) continue;
+        if (calc_time(&probe->sent_at, now) < self->timeout) break;
+        session_lose(self, probe);
+    }
+}
+
+int icmp_session_poll(IcmpSession *self, int timeout_ms) {
+    struct timespec now;
+    if (timeout_ms > 0) {
+        pthread_mutex_lock(&self->lock);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        session_expire(self, &now);
+        // Don't sleep through the timeout of the oldest probe.
+        if (self->n_expired < self->n_sent) {
+            const SessionProbe *oldest = session_probe(self, self->n_expired);
+            double expire_ms = self->timeout - calc_time(&oldest->sent_at, &now);
+            if (expire_ms < timeout_ms) timeout_ms = (int)ceil(expire_ms);
+        }
+        bool ready = self->n_results > 0;
+        pthread_mutex_unlock(&self->lock);
+        // Wait without the lock, so other threads can submit meanwhile.
+        struct pollfd pfd = {.fd = self->sockfd, .events = POLLIN};
+        if (ready == false && poll(&pfd, 1, timeout_ms) == -1 && errno != EINTR) return -1;
+    }
+    pthread_mutex_lock(&self->lock);
+    int res = session_recv(self);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    session_expire(self, &now);
+    if (res == 0) res = (int)self->n_results;
+    pthread_mutex_unlock(&self->lock);
+    return res;
+}
+
+size_t icmp_session_collect(IcmpSession *self, IcmpProbeResult results[], size_t n) {
+    pthread_mutex_lock(&self->lock);
+    if (n > self->n_results) n = self->n_results;
+    for (size_t i = 0; i < n; i++) {
+        results[i] = self->results[self->results_head];
+        self->results_head = (self->results_head + 1) % self->cap_results;
+    }
+    self->n_results -= n;
+    pthread_mutex_unlock(&self->lock);
+    return n;
+}
+
+int icmp_session_stats(IcmpSession *self, size_t target, TargetStats *stats) {
+    pthread_mutex_lock(&self->lock);
+    bool valid = target < self->n_targets;
+    if (valid) {
+        const TargetStats *own = &self->targets[target].stats;
+        *stats = (TargetStats){.sent = own->sent, .received = own->received};
+        hist_merge(&stats->rtt, &own->rtt);
+    }
+    pthread_mutex_unlock(&self->lock);
+    if (valid == false) errno = EINVAL;
+    return valid ? 0 : -1;
+}
+
+void icmp_session_free(IcmpSession *self) {
+    for (size_t i = 0; i < self->n_targets; i++) {
+        free((char *)self->targets[i].hostname);
+        hist_free(&self->targets[i].stats.rtt);
+    }
+    free(self->targets);
+    free(self->probes);
+    free(self->results);
+    icmp_recv_ring_free(self->ring);
+    close(self->sockfd);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+}
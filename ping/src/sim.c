@@ -0,0 +1,379 @@
+#include <errno.h>
+#include <math.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/cksum.h"
+#include "../include/sim.h"
+#include "../include/time_util.h"
+
+/// Bytes of the original datagram an ICMP error quotes after its IP header.
+#define ERROR_QUOTE_LEN (8)
+
+int sim_init(SimNet *self, IpVersion ip, const SimLink *link, uint64_t seed) {
+    memset(self, 0, sizeof(*self));
+    self->ip = ip;
+    self->rng = seed;
+    self->default_link = *link;
+    return 0;
+}
+
+void sim_free(SimNet *self) {
+    free(self->routes);
+    free(self->index);
+    free(self->events);
+    memset(self, 0, sizeof(*self));
+}
+
+/// Return: next number of the splitmix64 sequence.
+static uint64_t sim_next(SimNet *self) {
+    uint64_t z = (self->rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/// Return: uniform number in `[0; 1)`.
+static double sim_uniform(SimNet *self) {
+    return (double)(sim_next(self) >> 11) * 0x1.0p-53;
+}
+
+/// Return: true with probability `p`. Nothing is drawn for impossible events.
+static bool sim_chance(SimNet *self, double p) {
+    return p > 0 && sim_uniform(self) < p;
+}
+
+/// Return: round-trip time drawn from the link distribution, in nanoseconds.
+static uint64_t sim_delay(SimNet *self, const SimLink *link) {
+    double ms = link->rtt;
+    switch (link->delay) {
+    case SimConstant:
+        break;
+    case SimUniform:
+        ms += link->jitter * sim_uniform(self);
+        break;
+    case SimNormal:
+        // Box-Muller, `1 - u` keeps the logarithm finite.
+        ms += link->jitter * sqrt(-2 * log(1 - sim_uniform(self))) * cos(2 * M_PI * sim_uniform(self));
+        break;
+    case SimExponential:
+        ms -= link->jitter * log(1 - sim_uniform(self));
+        break;
+    }
+    return ms > 0 ? (uint64_t)llround(ms * NANOS_IN_MILLI) : 0;
+}
+
+/// Return: address bytes of `addr` and their length through `len`.
+static const void *sim_addr_key(const struct sockaddr_storage *addr, size_t *len) {
+    if (addr->ss_family == AF_INET) {
+        *len = sizeof(struct in_addr);
+        return &((const struct sockaddr_in *)addr)->sin_addr;
+    }
+    *len = sizeof(struct in6_addr);
+    return &((const struct sockaddr_in6 *)addr)->sin6_addr;
+}
+
+/// Return: FNV-1a hash of the address bytes.
+static size_t sim_addr_hash(const struct sockaddr_storage *addr) {
+    size_t len;
+    const u_char *key = sim_addr_key(addr, &len);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ key[i]) * 0x100000001b3ULL;
+    }
+    return (size_t)hash;
+}
+
+/// Return: slot of the index holding `addr`, or the empty slot it would take.
+static size_t sim_index_slot(const SimNet *self, const struct sockaddr_storage *addr) {
+    size_t len;
+    const void *key = sim_addr_key(addr, &len);
+    size_t mask = self->index_cap - 1;
+    for (size_t slot = sim_addr_hash(addr) & mask;; slot = (slot + 1) & mask) {
+        uint32_t route = self->index[slot];
+        if (route == 0) return slot;
+        size_t other_len;
+        const void *other = sim_addr_key(&self->routes[route - 1].addr, &other_len);
+        if (memcmp(key, other, len) == 0) return slot;
+    }
+}
+
+/// Double the index (and the routes it points to) once it is half full.
+static int sim_index_grow(SimNet *self) {
+    if (self->n_routes * 2 < self->index_cap) return 0;
+    size_t cap = self->index_cap > 0 ? self->index_cap * 2 : 64;
+    SimRoute *routes = realloc(self->routes, cap / 2 * sizeof(SimRoute));
+    if (routes == NULL) return -1;
+    self->routes = routes;
+    uint32_t *index = calloc(cap, sizeof(uint32_t));
+    if (index == NULL) return -1;
+    free(self->index);
+    self->index = index;
+    self->index_cap = cap;
+    for (size_t i = 0; i < self->n_routes; i++) {
+        self->index[sim_index_slot(self, &self->routes[i].addr)] = (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+/// Return: index of the route to `addr`, added with `link` if there is none, -1 on error (errno is set).
+static long sim_lookup(SimNet *self, const struct sockaddr_storage *addr, const SimLink *link) {
+    if (self->index_cap > 0) {
+        uint32_t route = self->index[sim_index_slot(self, addr)];
+        if (route != 0) return (long)route - 1;
+    }
+    if (sim_index_grow(self) == -1) return -1;
+    SimRoute *route = &self->routes[self->n_routes];
+    memset(route, 0, sizeof(*route));
+    memcpy(&route->addr, addr, addr->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    route->link = *link;
+    self->index[sim_index_slot(self, addr)] = (uint32_t)++self->n_routes;
+    return (long)self->n_routes - 1;
+}
+
+int sim_route(SimNet *self, const struct sockaddr_storage *addr, const SimLink *link) {
+    long route = sim_lookup(self, addr, link);
+    if (route == -1) return -1;
+    self->routes[route].link = *link;
+    return 0;
+}
+
+/// Return: true if event `a` is delivered before `b`.
+static inline bool sim_event_before(const SimEvent *a, const SimEvent *b) {
+    return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+/// Schedule `event` on the heap.
+static int sim_push(SimNet *self, SimEvent *event) {
+    if (self->n_events == self->cap_events) {
+        size_t cap = self->cap_events > 0 ? self->cap_events * 2 : 1024;
+        SimEvent *events = realloc(self->events, cap * sizeof(SimEvent));
+        if (events == NULL) return -1;
+        self->events = events;
+        self->cap_events = cap;
+    }
+    event->order = self->next_order++;
+    size_t i = self->n_events++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (sim_event_before(&self->events[parent], event)) break;
+        self->events[i] = self->events[parent];
+        i = parent;
+    }
+    self->events[i] = *event;
+    return 0;
+}
+
+/// Take the earliest event off the heap into `event`.
+static void sim_pop(SimNet *self, SimEvent *event) {
+    *event = self->events[0];
+    SimEvent last = self->events[--self->n_events];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= self->n_events) break;
+        if (child + 1 < self->n_events && sim_event_before(&self->events[child + 1], &self->events[child])) child++;
+        if (sim_event_before(&last, &self->events[child])) break;
+        self->events[i] = self->events[child];
+        i = child;
+    }
+    if (self->n_events > 0) self->events[i] = last;
+}
+
+/// Fill IPv4 header of a packet with `len` bytes of ICMP from `src` to `dst`.
+static void sim_ip4_header(struct iphdr *ip4, size_t len, uint8_t ttl, in_addr_t src, in_addr_t dst) {
+    memset(ip4, 0, sizeof(*ip4));
+    ip4->version = 4;
+    ip4->ihl = sizeof(*ip4) / sizeof(int32_t);
+    ip4->tot_len = htons((uint16_t)(sizeof(*ip4) + len));
+    ip4->ttl = ttl;
+    ip4->protocol = IPPROTO_ICMP;
+    ip4->saddr = src;
+    ip4->daddr = dst;
+    ip4->check = in_cksum((const char *)ip4, sizeof(*ip4), 0);
+}
+
+/// Copy `len` bytes at `off` of the packet into the slot, as much of them as fits.
+static void sim_copy(IcmpRecvSlot *slot, size_t off, const void *data, size_t len) {
+    if (len == 0 || off >= slot->cap) return;
+    memcpy(slot->buf + off, data, len < slot->cap - off ? len : slot->cap - off);
+}
+
+/// Write echo reply to the request of `event` into `slot`, as a raw socket receives it.
+/// Returns the packet length, the slot holds at most `cap` bytes of it.
+static size_t sim_echo_reply(const SimNet *self, const SimEvent *event, const SimRoute *route, IcmpRecvSlot *slot) {
+    IcmpPacket reply = event->packet;
+    size_t off = 0;
+    if (self->ip == IPv4) {
+        // Type and code are the first word of the message.
+        uint16_t request;
+        memcpy(&request, &reply.header, sizeof(request));
+        reply.h_type = ICMP_ECHOREPLY;
+        reply.h_cksum = in_cksum_update(reply.h_cksum, &request, &reply.header, sizeof(request));
+        struct iphdr ip4;
+        in_addr_t src = ((const struct sockaddr_in *)&route->addr)->sin_addr.s_addr;
+        sim_ip4_header(&ip4, sizeof(reply) + event->payload_len, route->link.ttl, src, htonl(INADDR_LOOPBACK));
+        sim_copy(slot, 0, &ip4, sizeof(ip4));
+        off = sizeof(ip4);
+    } else {
+        reply.h_type = ICMP6_ECHO_REPLY;
+    }
+    sim_copy(slot, off, &reply, sizeof(reply));
+    sim_copy(slot, off + sizeof(reply), event->payload, event->payload_len);
+    return off + sizeof(reply) + event->payload_len;
+}
+
+/// Write Destination Unreachable quoting the request of `event` into `slot`.
+/// Returns the packet length, the slot holds at most `cap` bytes of it.
+static size_t sim_error(const SimNet *self, const SimEvent *event, const SimRoute *route, IcmpRecvSlot *slot) {
+    size_t request_len = sizeof(event->packet) + event->payload_len;
+    if (self->ip == IPv4) {
+        struct {
+            struct icmphdr header;
+            struct iphdr ip4;
+            u_char quote[ERROR_QUOTE_LEN];
+        } error;
+        memset(&error, 0, sizeof(error));
+        in_addr_t dst = ((const struct sockaddr_in *)&route->addr)->sin_addr.s_addr;
+        sim_ip4_header(&error.ip4, request_len, IPDEFTTL, htonl(INADDR_LOOPBACK), dst);
+        memcpy(error.quote, &event->packet, sizeof(error.quote));
+        error.header.type = ICMP_DEST_UNREACH;
+        error.header.code = ICMP_HOST_UNREACH;
+        error.header.checksum = in_cksum((const char *)&error, sizeof(error), 0);
+        struct iphdr ip4;
+        sim_ip4_header(&ip4, sizeof(error), route->link.ttl, dst, htonl(INADDR_LOOPBACK));
+        sim_copy(slot, 0, &ip4, sizeof(ip4));
+        sim_copy(slot, sizeof(ip4), &error, sizeof(error));
+        return sizeof(ip4) + sizeof(error);
+    }
+    struct {
+        struct icmp6_hdr header;
+        struct ip6_hdr ip6;
+        u_char quote[ERROR_QUOTE_LEN];
+    } error;
+    memset(&error, 0, sizeof(error));
+    error.header.icmp6_type = ICMP6_DST_UNREACH;
+    error.header.icmp6_code = ICMP6_DST_UNREACH_ADDR;
+    error.ip6.ip6_vfc = 6 << 4;
+    error.ip6.ip6_plen = htons((uint16_t)request_len);
+    error.ip6.ip6_nxt = IPPROTO_ICMPV6;
+    error.ip6.ip6_hlim = IPDEFTTL;
+    error.ip6.ip6_src = in6addr_loopback;
+    error.ip6.ip6_dst = ((const struct sockaddr_in6 *)&route->addr)->sin6_addr;
+    memcpy(error.quote, &event->packet, sizeof(error.quote));
+    sim_copy(slot, 0, &error, sizeof(error));
+    return sizeof(error);
+}
+
+/// Hand the packet of `event` over to `slot`, like `recvmmsg` does.
+static void sim_deliver(const SimNet *self, const SimEvent *event, IcmpRecvSlot *slot) {
+    const SimRoute *route = &self->routes[event->route];
+    memset(&slot->addr, 0, sizeof(slot->addr));
+    slot->addr_len = route->addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    memcpy(&slot->addr, &route->addr, slot->addr_len);
+    memset(&slot->ts, 0, sizeof(slot->ts));
+    memset(&slot->info6, 0, sizeof(slot->info6));
+    slot->info6.dst = in6addr_loopback;
+    slot->info6.hop_limit = self->ip == IPv6 ? route->link.ttl : -1;
+    size_t len = event->error ? sim_error(self, event, route, slot) : sim_echo_reply(self, event, route, slot);
+    // Longer packets are truncated to the buffer, like datagram sockets do.
+    slot->len = len < slot->cap ? len : slot->cap;
+}
+
+static void sim_now(void *ctx, struct timespec *ts) {
+    const SimNet *self = ctx;
+    ts->tv_sec = (time_t)(self->now / NANOS_IN_SEC);
+    ts->tv_nsec = (long)(self->now % NANOS_IN_SEC);
+}
+
+/// Every probe is handed to the network at once: lost, answered or answered with an error,
+/// its fate is drawn right away and its replies are scheduled.
+static IcmpResult sim_send(
+    void *ctx, const IcmpPacket *const packets[], const struct sockaddr_storage *const addrs[],
+    const u_char payload[], size_t payload_len, size_t n, size_t *sent
+) {
+    SimNet *self = ctx;
+    int family = self->ip == IPv4 ? AF_INET : AF_INET6;
+    for (*sent = 0; *sent < n; (*sent)++) {
+        if (addrs[*sent]->ss_family != family) {
+            errno = EAFNOSUPPORT;
+            return IcmpSendToErr;
+        }
+        long route = sim_lookup(self, addrs[*sent], &self->default_link);
+        if (route == -1) return IcmpSendToErr;
+        const SimLink *link = &self->routes[route].link;
+        self->stats.sent ++;
+        if (sim_chance(self, link->loss)) {
+            self->stats.lost ++;
+            continue;
+        }
+        SimEvent event = {
+            .at = self->now + sim_delay(self, link),
+            .route = (uint32_t)route,
+            .error = sim_chance(self, link->error),
+            .packet = *packets[*sent],
+            .payload = payload,
+            .payload_len = payload_len,
+        };
+        if (event.error) {
+            self->stats.errors ++;
+            if (sim_push(self, &event) == -1) return IcmpSendToErr;
+            continue;
+        }
+        self->stats.replied ++;
+        if (sim_chance(self, link->reorder)) {
+            self->stats.reordered ++;
+            event.at += (uint64_t)llround(link->reorder_delay * NANOS_IN_MILLI);
+        }
+        if (sim_push(self, &event) == -1) return IcmpSendToErr;
+        if (sim_chance(self, link->duplicate)) {
+            self->stats.duplicated ++;
+            event.at = self->now + sim_delay(self, link);
+            if (sim_push(self, &event) == -1) return IcmpSendToErr;
+        }
+    }
+    return IcmpOk;
+}
+
+static IcmpResult sim_recv(void *ctx, IcmpRecvSlot slots[], size_t n, size_t *received) {
+    SimNet *self = ctx;
+    *received = 0;
+    while (*received < n && self->n_events > 0 && self->events[0].at <= self->now) {
+        SimEvent event;
+        sim_pop(self, &event);
+        sim_deliver(self, &event, &slots[(*received)++]);
+    }
+    if (*received == 0) {
+        errno = EAGAIN;
+        return IcmpRecvFromErr;
+    }
+    self->stats.delivered += *received;
+    icmp_view_parse_batch(slots, *received, IcmpSockRaw, self->ip, 0);
+    return IcmpOk;
+}
+
+/// Nothing to wait for: the clock jumps to the next arrival or to the end of the timeout.
+static int sim_wait(void *ctx, const struct timespec *timeout) {
+    SimNet *self = ctx;
+    uint64_t deadline = self->now + (uint64_t)timeout->tv_sec * NANOS_IN_SEC + (uint64_t)timeout->tv_nsec;
+    if (self->n_events > 0 && self->events[0].at <= deadline) {
+        if (self->events[0].at > self->now) self->now = self->events[0].at;
+        return 1;
+    }
+    self->now = deadline;
+    return 0;
+}
+
+Transport sim_transport(SimNet *self) {
+    return (Transport){
+        .now = sim_now,
+        .send = sim_send,
+        .recv = sim_recv,
+        .wait = sim_wait,
+        .ctx = self,
+    };
+}
@@ -0,0 +1,120 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/stats.h"
+#include "../include/time_util.h"
+
+void hist_init(Histogram *self) {
+    memset(self, 0, sizeof(*self));
+}
+
+/// Return: bucket of the value. Values below 2 * HIST_SUB_BUCKETS have a bucket each,
+/// then every power of two gets HIST_SUB_BUCKETS buckets.
+static uint32_t bucket_index(uint64_t value) {
+    if (value < 2 * HIST_SUB_BUCKETS) return value;
+    uint32_t exp = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return exp * HIST_SUB_BUCKETS + (uint32_t)(value >> exp);
+}
+
+/// Return: middle of the values range stored in the bucket.
+static uint64_t bucket_value(uint32_t index) {
+    if (index < 2 * HIST_SUB_BUCKETS) return index;
+    uint32_t exp = index / HIST_SUB_BUCKETS - 1;
+    uint64_t mantissa = index - exp * HIST_SUB_BUCKETS;
+    return (mantissa << exp) + ((1ULL << exp) >> 1);
+}
+
+/// Grow buckets to cover indices `[lo; hi)`, widened to whole powers of two,
+/// so a range that keeps widening takes at most one reallocation per power of two.
+/// Return: 0 on success, on error, -1 is returned, and errno is set.
+static int hist_cover(Histogram *self, uint32_t lo, uint32_t hi) {
+    uint32_t old_hi = self->lo + self->n_buckets;
+    if (self->n_buckets > 0) {
+        if (lo >= self->lo && hi <= old_hi) return 0;
+        if (lo > self->lo) lo = self->lo;
+        if (hi < old_hi) hi = old_hi;
+    }
+    lo = lo / HIST_SUB_BUCKETS * HIST_SUB_BUCKETS;
+    hi = (hi + HIST_SUB_BUCKETS - 1) / HIST_SUB_BUCKETS * HIST_SUB_BUCKETS;
+    uint32_t *buckets = calloc(hi - lo, sizeof(*buckets));
+    if (buckets == NULL) return -1;
+    if (self->n_buckets > 0) memcpy(buckets + (self->lo - lo), self->buckets, self->n_buckets * sizeof(*buckets));
+    free(self->buckets);
+    self->buckets = buckets;
+    self->lo = lo;
+    self->n_buckets = hi - lo;
+    return 0;
+}
+
+void hist_record(Histogram *self, uint64_t ns) {
+    const uint64_t max_value = (1ULL << HIST_MAX_BITS) - 1;
+    if (ns > max_value) ns = max_value;
+
+    double ms = (double)ns / NANOS_IN_MILLI;
+    if (self->count == 0 || ns < self->min) self->min = ns;
+    if (self->count == 0 || ns > self->max) self->max = ns;
+    if (self->count > 0) {
+        self->jitter_sum += fabs(ms - (double)self->last / NANOS_IN_MILLI);
+        self->jitter_count ++;
+    }
+    self->count ++;
+    self->sum += ms;
+    self->sum_sq += ms * ms;
+    self->last = ns;
+    uint32_t index = bucket_index(ns);
+    if (hist_cover(self, index, index + 1) == 0) self->buckets[index - self->lo] ++;
+}
+
+void hist_merge(Histogram *self, const Histogram *other) {
+    if (other->count == 0) return;
+    if (self->count == 0 || other->min < self->min) self->min = other->min;
+    if (self->count == 0 || other->max > self->max) self->max = other->max;
+    self->count += other->count;
+    self->sum += other->sum;
+    self->sum_sq += other->sum_sq;
+    self->jitter_sum += other->jitter_sum;
+    self->jitter_count += other->jitter_count;
+    if (other->n_buckets == 0 || hist_cover(self, other->lo, other->lo + other->n_buckets) == -1) return;
+    for (uint32_t i = 0; i < other->n_buckets; i++) {
+        self->buckets[other->lo - self->lo + i] += other->buckets[i];
+    }
+}
+
+uint64_t hist_percentile(const Histogram *self, double perc) {
+    if (self->count == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(perc / 100 * (double)self->count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < self->n_buckets; i++) {
+        seen += self->buckets[i];
+        if (seen >= rank) {
+            // Bucket middle may lie outside of the values actually seen.
+            uint64_t value = bucket_value(self->lo + i);
+            if (value < self->min) return self->min;
+            if (value > self->max) return self->max;
+            return value;
+        }
+    }
+    return self->max;
+}
+
+double hist_mean(const Histogram *self) {
+    return self->count ? self->sum / (double)self->count : 0;
+}
+
+double hist_stddev(const Histogram *self) {
+    if (self->count == 0) return 0;
+    double mean = hist_mean(self);
+    double variance = self->sum_sq / (double)self->count - mean * mean;
+    return variance > 0 ? sqrt(variance) : 0;
+}
+
+double hist_jitter(const Histogram *self) {
+    return self->jitter_count ? self->jitter_sum / (double)self->jitter_count : 0;
+}
+
+void hist_free(Histogram *self) {
+    free(self->buckets);
+    hist_init(self);
+}
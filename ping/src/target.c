@@ -0,0 +1,97 @@
+#include <netdb.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/target.h"
+
+int target_lookup(const char *hostname, IpVersion ip, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    struct addrinfo hints, *addrinfo_list;
+    memset(&hints, 0, sizeof(hints));
+    // There is no AF_UNSPEC equivalent for IPPROTO_ICMP, so we need to select version manually.
+    if (ip == IPv4) {
+        hints.ai_family = AF_INET;
+        hints.ai_protocol = IPPROTO_ICMP;
+    } else if (ip == IPv6) {
+        hints.ai_family = AF_INET6;
+        hints.ai_protocol = IPPROTO_ICMPV6;
+    }
+    hints.ai_socktype = SOCK_RAW;
+
+    int status;
+    if ((status = getaddrinfo(hostname, NULL, &hints, &addrinfo_list)) != 0) {
+        return status;
+    }
+    *addr_len = addrinfo_list->ai_addrlen;
+    memcpy(addr, addrinfo_list->ai_addr, *addr_len);
+    freeaddrinfo(addrinfo_list);
+    return 0;
+}
+
+void target_init(Target *self, const char *hostname, size_t order, const struct sockaddr_storage *addr, socklen_t addr_len) {
+    memset(self, 0, sizeof(*self));
+    self->hostname = hostname;
+    self->order = order;
+    self->addr_len = addr_len;
+    memcpy(&self->addr, addr, addr_len);
+
+    const void *in_addr = self->addr.ss_family == AF_INET
+        ? (void *)&((struct sockaddr_in *)&self->addr)->sin_addr
+        : (void *)&((struct sockaddr_in6 *)&self->addr)->sin6_addr;
+    inet_ntop(self->addr.ss_family, in_addr, self->ip_str, sizeof(self->ip_str));
+}
+
+bool target_addr_eq(const Target *self, const struct sockaddr_storage *addr) {
+    if (self->addr.ss_family != addr->ss_family) return false;
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *lhs = (const struct sockaddr_in *)&self->addr;
+        const struct sockaddr_in *rhs = (const struct sockaddr_in *)addr;
+        return lhs->sin_addr.s_addr == rhs->sin_addr.s_addr;
+    }
+    const struct sockaddr_in6 *lhs = (const struct sockaddr_in6 *)&self->addr;
+    const struct sockaddr_in6 *rhs = (const struct sockaddr_in6 *)addr;
+    return memcmp(&lhs->sin6_addr, &rhs->sin6_addr, sizeof(lhs->sin6_addr)) == 0;
+}
+
+int target_list_init(TargetList *self, size_t capacity) {
+    memset(self, 0, sizeof(*self));
+    self->items = calloc(capacity, sizeof(Target));
+    if (self->items == NULL && capacity > 0) return -1;
+    self->capacity = capacity;
+    atomic_init(&self->ready, 0);
+    atomic_init(&self->done, false);
+    return pthread_mutex_init(&self->lock, NULL) == 0 ? 0 : -1;
+}
+
+/// Wake every watcher. Must be called with the lock held.
+static void target_list_wake(TargetList *self) {
+    uint64_t one = 1;
+    for (size_t i = 0; i < self->n_watchers; i++) {
+        (void)!write(self->watchers[i], &one, sizeof(one));
+    }
+}
+
+void target_list_watch(TargetList *self, int fd) {
+    pthread_mutex_lock(&self->lock);
+    if (self->n_watchers < TARGET_LIST_MAX_WATCHERS) self->watchers[self->n_watchers++] = fd;
+    pthread_mutex_unlock(&self->lock);
+}
+
+void target_list_push(TargetList *self, const Target *target) {
+    pthread_mutex_lock(&self->lock);
+    size_t ready = atomic_load_explicit(&self->ready, memory_order_relaxed);
+    if (ready < self->capacity) {
+        self->items[ready] = *target;
+        atomic_store_explicit(&self->ready, ready + 1, memory_order_release);
+        target_list_wake(self);
+    }
+    pthread_mutex_unlock(&self->lock);
+}
+
+void target_list_finish(TargetList *self) {
+    pthread_mutex_lock(&self->lock);
+    atomic_store_explicit(&self->done, true, memory_order_release);
+    target_list_wake(self);
+    pthread_mutex_unlock(&self->lock);
+}
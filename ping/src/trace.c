@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/net_tstamp.h>
+
+#include "../include/time_util.h"
+#include "../include/trace.h"
+
+/// How long we wait for late answers after the last round.
+#define LINGER_MS (1000)
+
+int tracer_init(Tracer *self, int sockfd, IpVersion ip, uint16_t id, TargetList *targets, const TraceOptions *opts) {
+    memset(self, 0, sizeof(*self));
+    self->sockfd = sockfd;
+    self->ip = ip;
+    self->id = id;
+    self->opts = *opts;
+    if (icmp_attach_filter(sockfd, ip, id) == -1) return -1;
+    // A whole path answers within one batch, a single receive time would give every hop the same RTT.
+    int ts_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)) == -1) return -1;
+    int flags = fcntl(sockfd, F_GETFL);
+    if (flags == -1 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+    if (icmp_recv_ring_init(self->ring, ICMP_BATCH_MAX, ICMP_RECV_BUF_LEN) == -1) return -1;
+
+    self->n_paths = target_list_ready(targets);
+    self->paths = calloc(self->n_paths, sizeof(TracePath));
+    if (self->paths == NULL) return -1;
+    for (size_t i = 0; i < self->n_paths; i++) {
+        TracePath *path = &self->paths[i];
+        path->target = &targets->items[i];
+        path->n_hops = opts->max_hops;
+        path->hops = calloc(opts->max_hops, sizeof(TraceHop));
+        if (path->hops == NULL) return -1;
+        if (ip == IPv4) icmp_func.echo4_template(&path->target->packet, id);
+        else icmp_func.echo6_template(&path->target->packet, id);
+    }
+    return 0;
+}
+
+/// Send probes with every TTL to every target.
+static IcmpResult tracer_send_round(Tracer *self) {
+    IcmpPacket packets[ICMP_BATCH_MAX];
+    const IcmpPacket *ptrs[ICMP_BATCH_MAX];
+    const struct sockaddr_storage *addrs[ICMP_BATCH_MAX];
+    uint8_t ttls[ICMP_BATCH_MAX];
+    size_t n = 0;
+    // Same clock as kernel receive timestamps.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (size_t i = 0; i < self->n_paths; i++) {
+        TracePath *path = &self->paths[i];
+        for (uint32_t ttl = 1; ttl <= path->n_hops; ttl++) {
+            uint16_t seq = self->next_seq++;
+            TraceProbe *probe = &self->probes[seq];
+            // Slot is still taken if the probe sent 65536 packets ago was never answered.
+            if (probe->path == 0) self->outstanding ++;
+            probe->path = i + 1;
+            probe->ttl = ttl;
+            probe->sent_at = now;
+            path->hops[ttl - 1].stats.sent ++;
+
+            packets[n] = path->target->packet;
+            icmp_func.echo_update(&packets[n], seq, &now);
+            ptrs[n] = &packets[n];
+            addrs[n] = &path->target->addr;
+            ttls[n] = (uint8_t)ttl;
+            if (++n < ICMP_BATCH_MAX) continue;
+            size_t sent;
+            IcmpResult res = icmp_send_batch_ttl(ptrs, addrs, ttls, n, self->sockfd, &sent);
+            if (res != IcmpOk) return res;
+            n = 0;
+        }
+    }
+    size_t sent;
+    return n > 0 ? icmp_send_batch_ttl(ptrs, addrs, ttls, n, self->sockfd, &sent) : IcmpOk;
+}
+
+/// Account answer to its probe: the hop learns who answered it, and the path ends
+/// at the closest hop reached by an echo reply or reported unreachable.
+static void tracer_answer(
+    Tracer *self, const IcmpProbeReply *reply, const struct sockaddr_storage *from, socklen_t from_len,
+    const struct timespec *recv_at
+) {
+    if (reply->id != self->id) return;
+    TraceProbe *probe = &self->probes[reply->seq];
+    if (probe->path == 0) return;
+    TracePath *path = &self->paths[probe->path - 1];
+    bool echo_reply = reply->type == (self->ip == IPv4 ? ICMP_ECHOREPLY : ICMP6_ECHO_REPLY);
+    if (echo_reply && target_addr_eq(path->target, from) == false) return;
+    uint8_t ttl = probe->ttl;
+    probe->path = 0;
+    self->outstanding --;
+
+    bool unreachable = reply->type == (self->ip == IPv4 ? ICMP_DEST_UNREACH : ICMP6_DST_UNREACH);
+    if ((echo_reply || unreachable) && ttl <= path->n_hops) {
+        path->n_hops = ttl;
+        path->done = true;
+    }
+    // Answers to probes beyond the end of the path repeat what the last hop says.
+    if (ttl > path->n_hops) return;
+
+    TraceHop *hop = &path->hops[ttl - 1];
+    memcpy(&hop->addr, from, from_len < sizeof(hop->addr) ? from_len : sizeof(hop->addr));
+    const void *addr = from->ss_family == AF_INET
+        ? (const void *)&((const struct sockaddr_in *)from)->sin_addr
+        : (const void *)&((const struct sockaddr_in6 *)from)->sin6_addr;
+    inet_ntop(from->ss_family, addr, hop->ip_str, sizeof(hop->ip_str));
+    hop->type = reply->type;
+    hop->code = reply->code;
+    hop->stats.received ++;
+    double rtt = calc_time(&probe->sent_at, recv_at);
+    hist_record(&hop->stats.rtt, (uint64_t)llround(rtt * NANOS_IN_MILLI));
+}
+
+/// Receive answers until the socket is drained.
+static IcmpResult tracer_recv(Tracer *self) {
+    while (true) {
+        size_t received = 0;
+        IcmpResult res = icmp_recv_batch(self->ring, ICMP_BATCH_MAX, self->sockfd, &received);
+        if (res == IcmpRecvFromErr && (errno == EAGAIN || errno == EWOULDBLOCK)) return IcmpOk;
+        if (res != IcmpOk) return res;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        for (size_t i = 0; i < received; i++) {
+            IcmpRecvSlot *slot = &self->ring[i];
+            IcmpProbeReply reply;
+            // Corrupted packets are dropped just like foreign ones.
+            if (icmp_parse_probe_reply(self->ip, slot->buf, slot->len, &reply) != IcmpOk) continue;
+            const struct timespec *recv_at = icmp_timestamp_valid(&slot->ts.sw) ? &slot->ts.sw : &now;
+            tracer_answer(self, &reply, &slot->addr, slot->addr_len, recv_at);
+        }
+        if (received < ICMP_BATCH_MAX) return IcmpOk;
+    }
+}
+
+IcmpResult tracer_run(Tracer *self) {
+    struct pollfd pfd = {.fd = self->sockfd, .events = POLLIN};
+    double linger_ms = self->opts.timeout > 0 ? self->opts.timeout : LINGER_MS;
+    struct timespec now, next_round, linger;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    next_round = now;
+    bool lingering = false;
+
+    while (self->stop == false) {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        bool all_sent = self->opts.count != 0 && self->rounds == self->opts.count;
+        if (all_sent == false && calc_time(&next_round, &now) >= 0) {
+            if (self->rounds > 0 && self->on_round) self->on_round(self, self->ctx);
+            IcmpResult res = tracer_send_round(self);
+            // Full socket buffer is not fatal, such probes are simply lost.
+            if (res != IcmpOk && errno != ENOBUFS) return res;
+            self->rounds ++;
+            next_round = ts_add_ms(next_round, self->opts.interval);
+            if (calc_time(&next_round, &now) >= 0) next_round = ts_add_ms(now, self->opts.interval);
+            all_sent = self->opts.count != 0 && self->rounds == self->opts.count;
+        }
+        if (all_sent && lingering == false) {
+            linger = ts_add_ms(now, linger_ms);
+            lingering = true;
+        }
+        const struct timespec *deadline = all_sent ? &linger : &next_round;
+        if (all_sent && (self->outstanding == 0 || calc_time(deadline, &now) >= 0)) break;
+
+        double wait_ms = calc_time(&now, deadline);
+        struct timespec timeout = ts_add_ms((struct timespec){0, 0}, wait_ms > 0 ? wait_ms : 0);
+        if (ppoll(&pfd, 1, &timeout, NULL) == -1) {
+            if (errno == EINTR) continue;
+            return IcmpRecvFromErr;
+        }
+        if (pfd.revents & POLLIN) {
+            IcmpResult res = tracer_recv(self);
+            if (res != IcmpOk) return res;
+        }
+    }
+    if (self->on_round) self->on_round(self, self->ctx);
+    return IcmpOk;
+}
+
+void tracer_stop(Tracer *self) {
+    self->stop = true;
+}
+
+void tracer_free(Tracer *self) {
+    icmp_recv_ring_free(self->ring);
+    for (size_t i = 0; i < self->n_paths; i++) {
+        TracePath *path = &self->paths[i];
+        // Hops past `n_hops` may have been answered before the path got cut short.
+        for (size_t ttl = 0; path->hops != NULL && ttl < self->opts.max_hops; ttl++) hist_free(&path->hops[ttl].stats.rtt);
+        free(path->hops);
+    }
+    free(self->paths);
+    self->paths = NULL;
+    self->n_paths = 0;
+}
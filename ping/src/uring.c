@@ -0,0 +1,285 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/uring.h"
+
+/// `user_data` of the multishot receive, sends use their slot index.
+#define URING_RECV_TAG (UINT64_MAX)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/// Return: free submission entry, zeroed, or NULL if the queue is full.
+/// Entries become visible to the kernel only in `uring_submit`.
+static struct io_uring_sqe *uring_get_sqe(Uring *self) {
+    unsigned head = __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+    if (self->sq_local_tail - head > *self->sq_mask) return NULL;
+    unsigned index = self->sq_local_tail & *self->sq_mask;
+    self->sq_array[index] = index;
+    self->sq_local_tail ++;
+    self->sq_queued ++;
+    struct io_uring_sqe *sqe = &self->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/// Give buffer `bid` back to the kernel, it is published with `uring_publish_bufs`.
+static void uring_push_buf(Uring *self, uint16_t bid) {
+    struct io_uring_buf *buf = &self->buf_ring->bufs[self->buf_tail & (self->n_bufs - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(self->bufs + (size_t)bid * self->buf_len);
+    buf->len = (uint32_t)self->buf_len;
+    buf->bid = bid;
+    self->buf_tail ++;
+}
+
+static void uring_publish_bufs(Uring *self) {
+    __atomic_store_n(&self->buf_ring->tail, self->buf_tail, __ATOMIC_RELEASE);
+}
+
+/// Queue multishot `recvmsg`, it keeps completing into provided buffers until stopped.
+static int uring_arm_recv(Uring *self) {
+    struct io_uring_sqe *sqe = uring_get_sqe(self);
+    if (sqe == NULL) {
+        if (uring_submit(self) == -1) return -1;
+        sqe = uring_get_sqe(self);
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = self->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&self->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_RECV_TAG;
+    self->recv_armed = true;
+    return 0;
+}
+
+int uring_init(Uring *self, int sockfd, IcmpSocketKind kind, IpVersion ip, bool kernel_ts, size_t recv_len) {
+    memset(self, 0, sizeof(*self));
+    self->sockfd = sockfd;
+    self->kind = kind;
+    self->ip = ip;
+    self->buf_len = recv_len > ICMP_RECV_BUF_LEN ? URING_BUF_LEN - ICMP_RECV_BUF_LEN + recv_len : URING_BUF_LEN;
+    self->n_bufs = URING_BUFS;
+    while (self->n_bufs > ICMP_BATCH_MAX && self->n_bufs * self->buf_len > URING_BUFS_MEM) self->n_bufs /= 2;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Every provided buffer may complete before we reap, plus the sends.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2 * (unsigned)self->n_bufs;
+    self->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (self->fd == -1) return -1;
+
+    self->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    self->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (self->cq_map_len > self->sq_map_len) self->sq_map_len = self->cq_map_len;
+        self->cq_map_len = self->sq_map_len;
+    }
+    self->sq_map = mmap(NULL, self->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+    if (self->sq_map == MAP_FAILED) goto err;
+    self->cq_map = single_mmap
+        ? self->sq_map
+        : mmap(NULL, self->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_CQ_RING);
+    if (self->cq_map == MAP_FAILED) goto err;
+    self->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    self->sqes = mmap(NULL, self->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED) goto err;
+
+    char *sq = self->sq_map, *cq = self->cq_map;
+    self->sq_head = (unsigned *)(sq + params.sq_off.head);
+    self->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    self->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    self->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    self->sq_array = (unsigned *)(sq + params.sq_off.array);
+    self->cq_head = (unsigned *)(cq + params.cq_off.head);
+    self->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    self->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    self->sq_local_tail = *self->sq_tail;
+
+    self->buf_ring = mmap(NULL, self->n_bufs * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->buf_ring == MAP_FAILED) goto err;
+    self->bufs = mmap(NULL, self->n_bufs * self->buf_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->bufs == MAP_FAILED) goto err;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)self->buf_ring;
+    reg.ring_entries = (uint32_t)self->n_bufs;
+    reg.bgid = URING_BGID;
+    // Provided buffer rings appeared in 5.19, older kernels fail here.
+    if (sys_io_uring_register(self->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) goto err;
+    for (uint16_t bid = 0; bid < self->n_bufs; bid++) uring_push_buf(self, bid);
+    uring_publish_bufs(self);
+
+    self->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+    // IPv6 header fields come as ancillary data too.
+    self->recv_msg.msg_controllen = kernel_ts || ip == IPv6 ? ICMP_CONTROL_LEN : 0;
+    for (size_t i = 0; i < URING_SENDS; i++) self->free_sends[i] = (uint16_t)(URING_SENDS - 1 - i);
+    self->n_free_sends = URING_SENDS;
+
+    if (uring_arm_recv(self) == -1 || uring_submit(self) == -1) goto err;
+    return 0;
+
+err: {
+        int saved = errno;
+        uring_close(self);
+        errno = saved;
+        return -1;
+    }
+}
+
+int uring_send(
+    Uring *self, const IcmpPacket *packet, const u_char *payload, size_t payload_len,
+    const struct sockaddr_storage *addr, uint64_t tag
+) {
+    struct io_uring_sqe *sqe = self->n_free_sends > 0 ? uring_get_sqe(self) : NULL;
+    if (sqe == NULL) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    uint16_t index = self->free_sends[--self->n_free_sends];
+    UringSend *send = &self->sends[index];
+    send->packet = *packet;
+    send->addr = *addr;
+    send->iov[0].iov_base = &send->packet;
+    send->iov[0].iov_len = sizeof(send->packet);
+    send->iov[1].iov_base = (void *)payload;
+    send->iov[1].iov_len = payload_len;
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_name = &send->addr;
+    send->msg.msg_namelen = sizeof(send->addr);
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = payload_len > 0 ? 2 : 1;
+    send->tag = tag;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = self->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+    sqe->len = 1;
+    sqe->user_data = index;
+    return 0;
+}
+
+int uring_submit(Uring *self) {
+    if (self->sq_queued == 0) return 0;
+    __atomic_store_n(self->sq_tail, self->sq_local_tail, __ATOMIC_RELEASE);
+    while (self->sq_queued > 0) {
+        int res = sys_io_uring_enter(self->fd, self->sq_queued, 0, 0);
+        if (res == -1 && errno == EINTR) continue;
+        if (res == -1) {
+            // Entries stay in the queue and go with the next submit, like a full socket buffer.
+            if (errno == EAGAIN || errno == EBUSY) errno = ENOBUFS;
+            return -1;
+        }
+        self->sq_queued -= (unsigned)res;
+    }
+    return 0;
+}
+
+/// Parse packet received into provided buffer `buf` (`len` bytes filled) and pass it to `on_recv`.
+static void uring_dispatch(Uring *self, u_char *buf, size_t len, uring_recv_cb on_recv, void *ctx) {
+    const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)buf;
+    size_t name_off = sizeof(*out);
+    size_t control_off = name_off + self->recv_msg.msg_namelen;
+    size_t payload_off = control_off + self->recv_msg.msg_controllen;
+    if (len < payload_off) return;
+    size_t payload_len = len - payload_off;
+    if (out->payloadlen < payload_len) payload_len = out->payloadlen;
+    u_char *payload = buf + payload_off;
+
+    struct sockaddr_storage from;
+    memset(&from, 0, sizeof(from));
+    size_t name_len = out->namelen < sizeof(from) ? out->namelen : sizeof(from);
+    memcpy(&from, buf + name_off, name_len);
+
+    IcmpTimestamp ts, *pts = NULL;
+    Icmp6Info info6, *pinfo6 = NULL;
+    if (self->recv_msg.msg_controllen > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = buf + control_off;
+        msg.msg_controllen = out->controllen;
+        icmp_read_control(&msg, &ts, &info6);
+        if (icmp_timestamp_valid(&ts.sw) || icmp_timestamp_valid(&ts.hw)) pts = &ts;
+        if (self->ip == IPv6) pinfo6 = &info6;
+    }
+
+    IcmpView view;
+    // Corrupted packets are dropped just like foreign ones.
+    if (icmp_view_parse(&view, self->kind, self->ip, payload, payload_len, ICMP_VIEW_SKIP_IP_CKSUM) != IcmpOk) return;
+    on_recv(&view, &from, pts, pinfo6, ctx);
+}
+
+int uring_reap(Uring *self, uring_recv_cb on_recv, uring_send_cb on_send_err, void *ctx) {
+    // Completions that didn't fit are kept by the kernel until we ask for them.
+    if (__atomic_load_n(self->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+        (void)sys_io_uring_enter(self->fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+    int res = 0;
+    bool recycled = false;
+    unsigned head = *self->cq_head;
+    unsigned tail = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail && res == 0; head++) {
+        const struct io_uring_cqe *cqe = &self->cqes[head & *self->cq_mask];
+        if (cqe->user_data != URING_RECV_TAG) {
+            const UringSend *send = &self->sends[cqe->user_data];
+            if (cqe->res < 0 && on_send_err) on_send_err(send->tag, -cqe->res, ctx);
+            self->free_sends[self->n_free_sends++] = (uint16_t)cqe->user_data;
+            continue;
+        }
+        if ((cqe->flags & IORING_CQE_F_MORE) == 0) self->recv_armed = false;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe->res >= 0) {
+                self->recv_works = true;
+                uring_dispatch(self, self->bufs + (size_t)bid * self->buf_len, (size_t)cqe->res, on_recv, ctx);
+            }
+            uring_push_buf(self, bid);
+            recycled = true;
+        } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+            // Out of buffers only stops the receive until it is re-armed, anything else is fatal.
+            // Kernels before 6.0 reject multishot `recvmsg` with `EINVAL` right away.
+            errno = -cqe->res;
+            res = -1;
+        }
+    }
+    __atomic_store_n(self->cq_head, head, __ATOMIC_RELEASE);
+    if (recycled) uring_publish_bufs(self);
+    if (res == -1) return -1;
+    if (self->recv_armed == false && uring_arm_recv(self) == -1) return -1;
+    return uring_submit(self);
+}
+
+void uring_close(Uring *self) {
+    if (self->fd >= 0) (void)close(self->fd);
+    self->fd = -1;
+    if (self->sqes != NULL && self->sqes != MAP_FAILED) (void)munmap(self->sqes, self->sqes_len);
+    if (self->cq_map != NULL && self->cq_map != MAP_FAILED && self->cq_map != self->sq_map) {
+        (void)munmap(self->cq_map, self->cq_map_len);
+    }
+    if (self->sq_map != NULL && self->sq_map != MAP_FAILED) (void)munmap(self->sq_map, self->sq_map_len);
+    if (self->buf_ring != NULL && self->buf_ring != MAP_FAILED) {
+        (void)munmap(self->buf_ring, self->n_bufs * sizeof(struct io_uring_buf));
+    }
+    if (self->bufs != NULL && self->bufs != MAP_FAILED) (void)munmap(self->bufs, self->n_bufs * self->buf_len);
+    self->sqes = NULL;
+    self->sq_map = self->cq_map = NULL;
+    self->buf_ring = NULL;
+    self->bufs = NULL;
+}
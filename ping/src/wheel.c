@@ -0,0 +1,143 @@
+#include "../include/wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+static void list_init(WheelTimer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static int list_empty(const WheelTimer *head) {
+    return head->next == head;
+}
+
+static void list_del(WheelTimer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+void wheel_init(TimerWheel *self, uint64_t now) {
+    self->now = now;
+    self->count = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        self->occupied[level] = 0;
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) list_init(&self->slots[level][slot]);
+    }
+}
+
+/// Link timer into the slot of the lowest level where its expiry and the current tick
+/// have the same higher digits. Timers beyond the top level wrap around in it.
+static void wheel_place(TimerWheel *self, WheelTimer *timer) {
+    uint64_t diff = timer->expires ^ self->now;
+    uint32_t level = 0;
+    while (level < WHEEL_LEVELS - 1 && (diff >> (WHEEL_BITS * (level + 1))) != 0) level ++;
+    uint32_t slot = (timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    WheelTimer *head = &self->slots[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    self->occupied[level] |= 1ULL << slot;
+}
+
+/// Move all timers of the slot to `list`.
+static void wheel_detach(TimerWheel *self, uint32_t level, uint32_t slot, WheelTimer *list) {
+    WheelTimer *head = &self->slots[level][slot];
+    self->occupied[level] &= ~(1ULL << slot);
+    if (list_empty(head)) {
+        list_init(list);
+        return;
+    }
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    list_init(head);
+}
+
+void wheel_insert(TimerWheel *self, WheelTimer *timer, uint64_t expires) {
+    wheel_remove(self, timer);
+    if (expires <= self->now) expires = self->now + 1;
+    if (expires - self->now > WHEEL_MAX_DELAY) expires = self->now + WHEEL_MAX_DELAY;
+    timer->expires = expires;
+    wheel_place(self, timer);
+    self->count ++;
+}
+
+void wheel_remove(TimerWheel *self, WheelTimer *timer) {
+    if (wheel_pending(timer) == 0) return;
+    list_del(timer);
+    if (list_empty(&self->slots[timer->level][timer->slot])) {
+        self->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    self->count --;
+}
+
+uint64_t wheel_next(const TimerWheel *self) {
+    if (self->count == 0) return UINT64_MAX;
+    uint64_t next = UINT64_MAX;
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t occupied = self->occupied[level];
+        if (occupied == 0) continue;
+        uint32_t shift = WHEEL_BITS * level;
+        uint32_t digit = (self->now >> shift) & WHEEL_MASK;
+        // Start of the range covered by the level, slots up to `digit` are already processed.
+        uint64_t base = self->now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS);
+        uint64_t later = digit == WHEEL_MASK ? 0 : occupied & (~0ULL << (digit + 1));
+        uint64_t tick;
+        if (later) {
+            tick = base + ((uint64_t)__builtin_ctzll(later) << shift);
+        } else {
+            // Only the top level has slots of the next round.
+            tick = base + (1ULL << (shift + WHEEL_BITS)) + ((uint64_t)__builtin_ctzll(occupied) << shift);
+        }
+        if (tick < next) next = tick;
+    }
+    return next;
+}
+
+/// Process tick `self->now`: cascade every level it is the boundary of, top-down,
+/// so timers may fall through several levels at once, then expire level 0.
+static void wheel_tick(TimerWheel *self, wheel_expire_cb on_expire, void *ctx) {
+    uint64_t now = self->now;
+    WheelTimer list;
+    for (uint32_t level = WHEEL_LEVELS - 1; level > 0; level--) {
+        uint32_t shift = WHEEL_BITS * level;
+        if ((now & ((1ULL << shift) - 1)) != 0) continue;
+        uint32_t slot = (now >> shift) & WHEEL_MASK;
+        if ((self->occupied[level] & (1ULL << slot)) == 0) continue;
+        wheel_detach(self, level, slot, &list);
+        while (list_empty(&list) == 0) {
+            WheelTimer *timer = list.next;
+            list_del(timer);
+            wheel_place(self, timer);
+        }
+    }
+
+    uint32_t slot = now & WHEEL_MASK;
+    if ((self->occupied[0] & (1ULL << slot)) == 0) return;
+    wheel_detach(self, 0, slot, &list);
+    while (list_empty(&list) == 0) {
+        WheelTimer *timer = list.next;
+        list_del(timer);
+        self->count --;
+        on_expire(timer, ctx);
+    }
+}
+
+void wheel_advance(TimerWheel *self, uint64_t now, wheel_expire_cb on_expire, void *ctx) {
+    while (self->now < now) {
+        uint64_t next = wheel_next(self);
+        if (next > now) {
+            self->now = now;
+            return;
+        }
+        self->now = next;
+        wheel_tick(self, on_expire, ctx);
+    }
+}
@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <signal.h>
+
+#include "../include/worker.h"
+
+size_t worker_cpus(int *cpus, size_t max) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) return 0;
+    size_t n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &set)) cpus[n++] = cpu;
+    }
+    return n;
+}
+
+int worker_current_cpu(void) {
+    return sched_getcpu();
+}
+
+void worker_run(Worker *self) {
+    if (self->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(self->cpu, &set);
+        // Unpinned worker is slower, but still correct.
+        (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    self->res = engine_run(&self->engine);
+    output_flush(&self->output);
+}
+
+static void *worker_main(void *arg) {
+    worker_run((Worker *)arg);
+    return NULL;
+}
+
+int worker_start(Worker *self) {
+    sigset_t all, old;
+    sigfillset(&all);
+    // New thread inherits the mask, the caller gets its own back right away.
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int res = pthread_create(&self->thread, NULL, worker_main, self);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return res;
+}
+
+void worker_join(Worker *self) {
+    (void)pthread_join(self->thread, NULL);
+}
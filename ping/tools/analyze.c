@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/icmp.h"
+#include "../include/record.h"
+#include "../include/stats.h"
+#include "../include/time_util.h"
+
+/// Records read per `pread`, 2 MiB.
+#define CHUNK_RECORDS (64 * 1024)
+
+/// Probe counters and RTT histogram of a target, the whole file or a time bucket.
+typedef struct Summary {
+    uint64_t sent;
+    uint64_t received;
+    Histogram rtt;
+} Summary;
+
+static void summary_add(Summary *self, const RecordEntry *entry) {
+    self->sent ++;
+    if (entry->result != IcmpOk) return;
+    self->received ++;
+    hist_record(&self->rtt, entry->recv_ns - entry->send_ns);
+}
+
+static double summary_loss(const Summary *self) {
+    return self->sent ? (double)(self->sent - self->received) * 100 / (double)self->sent : 0;
+}
+
+static void print_summary(const char *name, const Summary *summary) {
+    printf("--- %s ---\n", name);
+    printf(
+        "%lu packets transmitted, %lu packets received, %.3f%% packet loss\n",
+        summary->sent, summary->received, summary_loss(summary)
+    );
+    const Histogram *rtt = &summary->rtt;
+    if (rtt->count == 0) return;
+    printf(
+        "round-trip min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n",
+        NS_TO_MS(rtt->min), hist_mean(rtt), NS_TO_MS(rtt->max), hist_stddev(rtt)
+    );
+    printf(
+        "percentiles p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms, jitter = %.3f ms\n",
+        NS_TO_MS(hist_percentile(rtt, 50)), NS_TO_MS(hist_percentile(rtt, 90)),
+        NS_TO_MS(hist_percentile(rtt, 99)), NS_TO_MS(hist_percentile(rtt, 99.9)),
+        hist_jitter(rtt)
+    );
+}
+
+/// Print a row of the time series for the bucket starting at `start_ns` (wall clock).
+static void print_bucket(uint64_t start_ns, const Summary *bucket) {
+    time_t sec = (time_t)(start_ns / NANOS_IN_SEC);
+    struct tm tm;
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", gmtime_r(&sec, &tm));
+    const Histogram *rtt = &bucket->rtt;
+    printf(
+        "%s.%03luZ %10lu %10lu %8.3f %9.3f %9.3f %9.3f %9.3f\n",
+        date, (unsigned long)(start_ns % NANOS_IN_SEC / NANOS_IN_MILLI), bucket->sent, bucket->received, summary_loss(bucket),
+        NS_TO_MS(hist_percentile(rtt, 50)), NS_TO_MS(hist_percentile(rtt, 90)),
+        NS_TO_MS(hist_percentile(rtt, 99)), NS_TO_MS(rtt->max)
+    );
+}
+
+static void usage_and_exit(const char *bin, int status_code) {
+    (void)fprintf(
+        stderr,
+        "Usage: %s [-b SEC] FILE\n"
+        "Print loss and round-trip statistics of a file written by `ping --record`.\n"
+        "  -b SEC    also print time series with SEC seconds long buckets\n",
+        bin
+    );
+    exit(status_code);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    uint64_t bucket_ns = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            char *end = NULL;
+            double sec = strtod(argv[++i], &end);
+            if (end == argv[i] || *end != '\0' || !(sec > 0)) usage_and_exit(argv[0], 1);
+            bucket_ns = (uint64_t)(sec * NANOS_IN_SEC);
+            if (bucket_ns == 0) usage_and_exit(argv[0], 1);
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage_and_exit(argv[0], 1);
+        }
+    }
+    if (path == NULL) usage_and_exit(argv[0], 1);
+
+    RecordReader reader;
+    if (record_reader_open(&reader, path) == -1) {
+        (void)fprintf(stderr, "%s: %s: %s\n", argv[0], path, errno == EINVAL ? "not a record file" : strerror(errno));
+        exit(1);
+    }
+    uint32_t n_targets = reader.header.n_targets;
+    Summary *targets = calloc(n_targets, sizeof(Summary));
+    Summary *total = calloc(1, sizeof(Summary));
+    Summary *bucket = calloc(1, sizeof(Summary));
+    RecordEntry *chunk = malloc(CHUNK_RECORDS * sizeof(RecordEntry));
+    if ((targets == NULL && n_targets > 0) || total == NULL || bucket == NULL || chunk == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    if (bucket_ns) {
+        printf(
+            "%-24s %10s %10s %8s %9s %9s %9s %9s\n",
+            "time", "sent", "received", "loss%", "p50_ms", "p90_ms", "p99_ms", "max_ms"
+        );
+    }
+    // Records are appended in send order, so every bucket is complete once a later one starts.
+    uint64_t curr_bucket = 0;
+    ssize_t n;
+    while ((n = record_reader_read(&reader, chunk, CHUNK_RECORDS)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            const RecordEntry *entry = &chunk[i];
+            if (bucket_ns) {
+                uint64_t index = entry->send_ns / bucket_ns;
+                if (index != curr_bucket && bucket->sent) {
+                    print_bucket(reader.header.start_ns + curr_bucket * bucket_ns, bucket);
+                    hist_free(&bucket->rtt);
+                    memset(bucket, 0, sizeof(*bucket));
+                }
+                curr_bucket = index;
+                summary_add(bucket, entry);
+            }
+            if (entry->target < n_targets) summary_add(&targets[entry->target], entry);
+            summary_add(total, entry);
+        }
+    }
+    if (n == -1) {
+        (void)fprintf(stderr, "%s: %s: %s\n", argv[0], path, strerror(errno));
+        exit(1);
+    }
+    if (bucket_ns && bucket->sent) print_bucket(reader.header.start_ns + curr_bucket * bucket_ns, bucket);
+
+    for (uint32_t i = 0; i < n_targets; i++) {
+        const char *addr = record_reader_addr(&reader, i);
+        // Hostnames that never resolved have no address and no records.
+        if (addr[0] == '\0') continue;
+        print_summary(addr, &targets[i]);
+    }
+    if (n_targets > 1) print_summary("all targets", total);
+    if (reader.header.head > reader.header.capacity) {
+        printf("%lu oldest records were overwritten\n", reader.header.head - reader.header.capacity);
+    }
+
+    record_reader_close(&reader);
+    for (uint32_t i = 0; i < n_targets; i++) hist_free(&targets[i].rtt);
+    hist_free(&total->rtt);
+    hist_free(&bucket->rtt);
+    free(chunk);
+    free(bucket);
+    free(total);
+    free(targets);
+    return 0;
+}